@@ -0,0 +1,557 @@
+#include "APU.h"
+#include <math.h>
+
+#define APU_NEVER 0xFFFFFFFFFFFFFFFFULL
+#define APU_CHUNK_CLOCKS 16384 // Keeps the delta buffer from filling up between samples
+
+const uint8_t DutyTable [4][8] = {
+	{0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
+	{1, 0, 0, 0, 0, 0, 0, 1}, // 25%
+	{1, 0, 0, 0, 0, 1, 1, 1}, // 50%
+	{0, 1, 1, 1, 1, 1, 1, 0}  // 75%
+};
+
+const uint8_t ReadMasks [0x30] = { // Bits that always read as 1
+	0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10 - NR14
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20 - NR24
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30 - NR34
+	0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40 - NR44
+	0x00, 0x00, 0x70, // NR50 - NR52
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // Unused
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 // Wave RAM
+};
+
+const uint8_t WaveShift [4] = {4, 0, 1, 2}; // 0%, 100%, 50%, 25%
+
+// Steps until a duty pattern changes its output, so square channels only wake up on edges that matter
+static uint8_t RunLength [4][8];
+
+// Band-limited impulse, one per fractional position. Integrated, it becomes a band-limited step.
+static float Kernel [APU_BLIP_PHASES][APU_BLIP_TAPS];
+
+static void BuildTables () {
+	for (int Duty = 0; Duty < 4; Duty++)
+		for (int Position = 0; Position < 8; Position++) {
+			int Steps = 1;
+			while (DutyTable [Duty][(Position + Steps) & 7] == DutyTable [Duty][Position])
+				Steps++;
+			RunLength [Duty][Position] = Steps;
+		}
+	
+	const double Cutoff = 0.9; // Of Nyquist
+	const double Center = APU_BLIP_TAPS / 2;
+	
+	for (int Phase = 0; Phase < APU_BLIP_PHASES; Phase++) {
+		double Sum = 0;
+		for (int k = 0; k < APU_BLIP_TAPS; k++) {
+			double x = k - Center - (double) Phase / APU_BLIP_PHASES;
+			double Sinc = (x == 0) ? 1 : sin (M_PI * x * Cutoff) / (M_PI * x * Cutoff);
+			double Window = 0.42 + 0.5 * cos (M_PI * x / Center) + 0.08 * cos (2 * M_PI * x / Center); // Blackman
+			if (fabs (x) > Center)
+				Window = 0;
+			
+			Kernel [Phase][k] = Sinc * Window;
+			Sum += Kernel [Phase][k];
+		}
+		
+		for (int k = 0; k < APU_BLIP_TAPS; k++) // Every step has to add up to its full height
+			Kernel [Phase][k] /= Sum;
+	}
+}
+
+// Ring
+uint32_t AudioRing::Write (const int16_t* Samples, uint32_t Frames) {
+	uint32_t Write = WriteIndex.load (std::memory_order_relaxed);
+	uint32_t Free = Size - (Write - ReadIndex.load (std::memory_order_acquire));
+	if (Frames > Free)
+		Frames = Free;
+	
+	for (uint32_t i = 0; i < Frames; i++) {
+		uint32_t Slot = (Write + i) & (Size - 1);
+		Buffer [Slot * 2] = Samples [i * 2];
+		Buffer [Slot * 2 + 1] = Samples [i * 2 + 1];
+	}
+	
+	WriteIndex.store (Write + Frames, std::memory_order_release);
+	return Frames;
+}
+
+uint32_t AudioRing::Read (int16_t* Out, uint32_t Frames) {
+	uint32_t Read = ReadIndex.load (std::memory_order_relaxed);
+	uint32_t Ready = WriteIndex.load (std::memory_order_acquire) - Read;
+	if (Frames > Ready)
+		Frames = Ready;
+	
+	for (uint32_t i = 0; i < Frames; i++) {
+		uint32_t Slot = (Read + i) & (Size - 1);
+		Out [i * 2] = Buffer [Slot * 2];
+		Out [i * 2 + 1] = Buffer [Slot * 2 + 1];
+	}
+	
+	ReadIndex.store (Read + Frames, std::memory_order_release);
+	return Frames;
+}
+
+uint32_t AudioRing::Available () {
+	return WriteIndex.load (std::memory_order_acquire) - ReadIndex.load (std::memory_order_acquire);
+}
+
+void AudioRing::Clear () { // Consumer side
+	ReadIndex.store (WriteIndex.load (std::memory_order_acquire), std::memory_order_release);
+}
+
+// APU
+APU::APU (uint32_t _SampleRate) {
+	static uint8_t TablesBuilt = (BuildTables (), 1);
+	(void) TablesBuilt;
+	
+	SampleRate = _SampleRate;
+	if (SampleRate < APU_MIN_SAMPLE_RATE)
+		SampleRate = APU_MIN_SAMPLE_RATE;
+	if (SampleRate > APU_MAX_SAMPLE_RATE)
+		SampleRate = APU_MAX_SAMPLE_RATE;
+	ClocksToSamples = (double) SampleRate / APU_CLOCK_RATE;
+	HighPass = pow (0.999958, (double) APU_CLOCK_RATE / SampleRate);
+	
+	Reset ();
+}
+
+void APU::Reset () {
+	memset (Channels, 0, sizeof (Channels));
+	memset (Registers, 0, sizeof (Registers));
+	memset (Delta, 0, sizeof (Delta));
+	
+	for (int i = 0; i < 4; i++) {
+		Channels [i].NextEdge = APU_NEVER;
+		Channels [i].Steps = 1;
+	}
+	Channels [3].LFSR = 0x7FFF;
+	
+	Power = 1;
+	SweepEnabled = 0;
+	SweepTimer = 0;
+	SweepShadow = 0;
+	
+	Time = 0;
+	LastClock = 0;
+	NextSequencer = 8192;
+	SequencerStep = 0;
+	
+	LastLeft = LastRight = 0;
+	Integrator [0] = Integrator [1] = 0;
+	Capacitor [0] = Capacitor [1] = 0;
+	OriginTime = 0;
+	OriginPosition = 0;
+}
+
+void APU::SyncState (StateStream &State) {
+	State.Bytes (Channels, sizeof (Channels));
+	State.Bytes (Registers, sizeof (Registers));
+	State.Sync (Power);
+	
+	State.Sync (SweepEnabled);
+	State.Sync (SweepTimer);
+	State.Sync (SweepShadow);
+	
+	State.Sync (Time);
+	State.Sync (LastClock);
+	State.Sync (NextSequencer);
+	State.Sync (SequencerStep);
+	
+	State.Sync (LastLeft);
+	State.Sync (LastRight);
+	State.Bytes (Delta, sizeof (Delta));
+	State.Bytes (Integrator, sizeof (Integrator));
+	State.Bytes (Capacitor, sizeof (Capacitor));
+	State.Sync (OriginTime);
+	State.Sync (OriginPosition);
+}
+
+void APU::SetClockRate (double Rate) {
+	OriginPosition += (Time - OriginTime) * ClocksToSamples; // Samples so far keep their position
+	OriginTime = Time;
+	ClocksToSamples = SampleRate / Rate;
+}
+
+uint8_t APU::ReadRegister (uint16_t Address, uint32_t Clock) {
+	uint8_t Register = Address - 0xFF10;
+	
+	if (Register == 0x16) { // NR52, Channel status may have changed since
+		Update (Clock);
+		uint8_t Status = (Power << 7) | ReadMasks [Register];
+		for (int i = 0; i < 4; i++)
+			Status |= Channels [i].Enabled << i;
+		return Status;
+	}
+	
+	return Registers [Register] | ReadMasks [Register];
+}
+
+void APU::WriteRegister (uint16_t Address, uint8_t Value, uint32_t Clock) {
+	Update (Clock);
+	
+	uint8_t Register = Address - 0xFF10;
+	
+	if (Register >= 0x20) { // Wave RAM
+		Registers [Register] = Value;
+		return;
+	}
+	
+	if (Register == 0x16) { // NR52
+		if (!(Value & 0x80) && Power) { // Power off clears everything but Wave RAM
+			memset (Registers, 0, 0x20);
+			for (int i = 0; i < 4; i++) {
+				Channels [i].Enabled = 0;
+				Channels [i].DAC = 0;
+				Channels [i].NextEdge = APU_NEVER;
+				UpdateOutput (i);
+			}
+			Power = 0;
+		} else if ((Value & 0x80) && !Power) {
+			Power = 1;
+			SequencerStep = 0;
+		}
+		Mix ();
+		return;
+	}
+	
+	if (!Power) // Ignored while off
+		return;
+	
+	Registers [Register] = Value;
+	
+	if (Register >= 0x14) { // NR50, NR51
+		Mix ();
+		return;
+	}
+	
+	uint8_t ID = Register / 5;
+	Channel* Ch = Channels + ID;
+	
+	switch (Register % 5) {
+		case 0: // NR30 - DAC, NR10 is only read when needed
+			if (ID == 2) {
+				Ch->DAC = Value >> 7;
+				if (!Ch->DAC)
+					Ch->Enabled = 0;
+			}
+			break;
+		case 1: // Length, Duty
+			if (ID == 2)
+				Ch->Length = 256 - Value;
+			else
+				Ch->Length = 64 - (Value & 0x3F);
+			Ch->Duty = Value >> 6;
+			break;
+		case 2: // Envelope, Volume
+			if (ID == 2)
+				Ch->VolumeShift = WaveShift [(Value >> 5) & 3];
+			else {
+				Ch->DAC = (Value & 0xF8) != 0;
+				if (!Ch->DAC)
+					Ch->Enabled = 0;
+			}
+			break;
+		case 3: // Frequency low, Noise polynomial
+			Ch->Frequency = (Ch->Frequency & 0x700) | Value;
+			UpdatePeriod (ID);
+			break;
+		case 4: // Frequency high, Length enable, Trigger
+			Ch->Frequency = (Ch->Frequency & 0xFF) | ((Value & 7) << 8);
+			Ch->LengthEnabled = (Value >> 6) & 1;
+			UpdatePeriod (ID);
+			if (Value & 0x80)
+				Trigger (ID);
+			break;
+	}
+	
+	if (!Ch->Enabled)
+		Ch->NextEdge = APU_NEVER;
+	
+	UpdateOutput (ID);
+	Mix ();
+}
+
+void APU::UpdatePeriod (uint8_t ID) {
+	Channel* Ch = Channels + ID;
+	
+	if (ID < 2)
+		Ch->Period = (2048 - Ch->Frequency) * 4;
+	else if (ID == 2)
+		Ch->Period = (2048 - Ch->Frequency) * 2;
+	else {
+		uint8_t Polynomial = Registers [0x12];
+		uint8_t Divisor = Polynomial & 7;
+		uint8_t Shift = Polynomial >> 4;
+		Ch->Period = (Shift >= 14) ? 0 : (Divisor ? Divisor << 4 : 8) << Shift; // 0 - Not clocked
+	}
+}
+
+void APU::Trigger (uint8_t ID) {
+	Channel* Ch = Channels + ID;
+	
+	Ch->Enabled = Ch->DAC;
+	if (Ch->Length == 0)
+		Ch->Length = (ID == 2) ? 256 : 64;
+	
+	Ch->Steps = 1;
+	Ch->NextEdge = (Ch->Enabled && Ch->Period) ? Time + Ch->Period : APU_NEVER;
+	
+	if (ID == 2) {
+		Ch->Position = 0;
+		return;
+	}
+	
+	uint8_t Envelope = Registers [ID * 5 + 2];
+	Ch->Volume = Envelope >> 4;
+	Ch->EnvelopeIncrease = (Envelope >> 3) & 1;
+	Ch->EnvelopePeriod = Envelope & 7;
+	Ch->EnvelopeTimer = Ch->EnvelopePeriod;
+	
+	if (ID == 3)
+		Ch->LFSR = 0x7FFF;
+	
+	if (ID == 0) {
+		uint8_t Sweep = Registers [0x00];
+		uint8_t SweepPeriod = (Sweep >> 4) & 7;
+		SweepShadow = Ch->Frequency;
+		SweepTimer = SweepPeriod ? SweepPeriod : 8;
+		SweepEnabled = SweepPeriod || (Sweep & 7);
+		if (Sweep & 7) // Overflow check right away
+			SweepCalculate ();
+	}
+}
+
+uint16_t APU::SweepCalculate () {
+	uint8_t Sweep = Registers [0x00];
+	uint16_t Change = SweepShadow >> (Sweep & 7);
+	uint16_t Frequency = (Sweep & 0x08) ? SweepShadow - Change : SweepShadow + Change;
+	
+	if (Frequency > 2047) {
+		Channels [0].Enabled = 0;
+		Channels [0].NextEdge = APU_NEVER;
+	}
+	
+	return Frequency;
+}
+
+void APU::UpdateOutput (uint8_t ID) {
+	Channel* Ch = Channels + ID;
+	
+	if (!Ch->Enabled || !Ch->DAC) {
+		Ch->Output = 0;
+		return;
+	}
+	
+	if (ID < 2)
+		Ch->Output = DutyTable [Ch->Duty][Ch->Position] ? Ch->Volume : 0;
+	else if (ID == 2) {
+		uint8_t Sample = Registers [0x20 + (Ch->Position >> 1)];
+		Sample = (Ch->Position & 1) ? Sample & 0xF : Sample >> 4;
+		Ch->Output = Sample >> Ch->VolumeShift;
+	} else
+		Ch->Output = (~Ch->LFSR & 1) ? Ch->Volume : 0;
+}
+
+void APU::StepChannel (uint8_t ID) {
+	Channel* Ch = Channels + ID;
+	
+	if (ID < 2) {
+		Ch->Position = (Ch->Position + Ch->Steps) & 7;
+		Ch->Steps = RunLength [Ch->Duty][Ch->Position];
+		Ch->NextEdge += (uint64_t) Ch->Period * Ch->Steps;
+	} else if (ID == 2) {
+		Ch->Position = (Ch->Position + 1) & 31;
+		Ch->NextEdge += Ch->Period;
+	} else {
+		uint16_t Bit = (Ch->LFSR ^ (Ch->LFSR >> 1)) & 1;
+		Ch->LFSR = (Ch->LFSR >> 1) | (Bit << 14);
+		if (Registers [0x12] & 0x08) // 7 bit mode
+			Ch->LFSR = (Ch->LFSR & ~0x40) | (Bit << 6);
+		Ch->NextEdge = Ch->Period ? Ch->NextEdge + Ch->Period : APU_NEVER;
+	}
+	
+	UpdateOutput (ID);
+}
+
+void APU::ClockSequencer () {
+	if (!(SequencerStep & 1)) { // Length, 256 Hz
+		for (int i = 0; i < 4; i++) {
+			Channel* Ch = Channels + i;
+			if (Ch->LengthEnabled && Ch->Length > 0) {
+				Ch->Length--;
+				if (Ch->Length == 0) {
+					Ch->Enabled = 0;
+					Ch->NextEdge = APU_NEVER;
+					UpdateOutput (i);
+				}
+			}
+		}
+	}
+	
+	if (SequencerStep == 2 || SequencerStep == 6) { // Sweep, 128 Hz
+		if (SweepTimer && --SweepTimer == 0) {
+			uint8_t Sweep = Registers [0x00];
+			uint8_t SweepPeriod = (Sweep >> 4) & 7;
+			SweepTimer = SweepPeriod ? SweepPeriod : 8;
+			
+			if (SweepEnabled && SweepPeriod) {
+				uint16_t Frequency = SweepCalculate ();
+				if (Frequency <= 2047 && (Sweep & 7)) {
+					SweepShadow = Frequency;
+					Channels [0].Frequency = Frequency;
+					UpdatePeriod (0);
+					SweepCalculate ();
+				}
+				UpdateOutput (0);
+			}
+		}
+	}
+	
+	if (SequencerStep == 7) { // Envelope, 64 Hz
+		for (int i = 0; i < 4; i++) {
+			Channel* Ch = Channels + i;
+			if (i == 2 || Ch->EnvelopePeriod == 0)
+				continue;
+			
+			Ch->EnvelopeTimer--;
+			if (Ch->EnvelopeTimer == 0) {
+				Ch->EnvelopeTimer = Ch->EnvelopePeriod;
+				if (Ch->EnvelopeIncrease && Ch->Volume < 15)
+					Ch->Volume++;
+				else if (!Ch->EnvelopeIncrease && Ch->Volume > 0)
+					Ch->Volume--;
+				UpdateOutput (i);
+			}
+		}
+	}
+	
+	SequencerStep = (SequencerStep + 1) & 7;
+}
+
+void APU::Mix () {
+	uint8_t Panning = Registers [0x15]; // NR51
+	uint8_t Volume = Registers [0x14]; // NR50
+	int32_t Left = 0;
+	int32_t Right = 0;
+	
+	for (int i = 0; i < 4; i++) {
+		if (Panning & (0x10 << i))
+			Left += Channels [i].Output;
+		if (Panning & (0x01 << i))
+			Right += Channels [i].Output;
+	}
+	
+	Left *= ((Volume >> 4) & 7) + 1;
+	Right *= (Volume & 7) + 1;
+	
+	if (Left != LastLeft || Right != LastRight) {
+		AddDelta (Time, Left - LastLeft, Right - LastRight);
+		LastLeft = Left;
+		LastRight = Right;
+	}
+}
+
+void APU::AddDelta (uint64_t At, int32_t DeltaLeft, int32_t DeltaRight) {
+	double Position = (At - OriginTime) * ClocksToSamples + OriginPosition;
+	uint32_t Index = (uint32_t) Position;
+	uint32_t Phase = (uint32_t) ((Position - Index) * APU_BLIP_PHASES);
+	
+	if (Index >= APU_BUFFER_SIZE) // Can't happen with chunked updates
+		Index = APU_BUFFER_SIZE - 1;
+	
+	const float* Step = Kernel [Phase];
+	float* OutLeft = Delta [0] + Index;
+	float* OutRight = Delta [1] + Index;
+	
+	for (int k = 0; k < APU_BLIP_TAPS; k++) {
+		OutLeft [k] += Step [k] * DeltaLeft;
+		OutRight [k] += Step [k] * DeltaRight;
+	}
+}
+
+void APU::RunUntil (uint64_t Target) {
+	while (1) {
+		uint64_t Next = NextSequencer;
+		for (int i = 0; i < 4; i++)
+			if (Channels [i].NextEdge < Next)
+				Next = Channels [i].NextEdge;
+		
+		if (Next > Target)
+			break;
+		
+		Time = Next;
+		
+		if (Time == NextSequencer) {
+			ClockSequencer ();
+			NextSequencer += 8192; // 512 Hz
+		}
+		
+		for (int i = 0; i < 4; i++)
+			if (Channels [i].NextEdge == Time)
+				StepChannel (i);
+		
+		Mix ();
+	}
+	
+	Time = Target;
+}
+
+void APU::Update (uint32_t Clock) {
+	PROFILE_SCOPE (PROF_APU);
+	uint64_t Target = Time + (uint32_t) (Clock - LastClock);
+	LastClock = Clock;
+	
+	while (Time < Target) {
+		uint64_t ChunkEnd = Target - Time > APU_CHUNK_CLOCKS ? Time + APU_CHUNK_CLOCKS : Target;
+		RunUntil (ChunkEnd);
+		
+		if ((Time - OriginTime) * ClocksToSamples + OriginPosition >= APU_BUFFER_SIZE / 2)
+			GenerateSamples ();
+	}
+}
+
+void APU::Flush (uint32_t Clock) {
+	PROFILE_SCOPE (PROF_APU);
+	Update (Clock);
+	GenerateSamples ();
+}
+
+void APU::GenerateSamples () {
+	double Position = (Time - OriginTime) * ClocksToSamples + OriginPosition;
+	uint32_t Count = (uint32_t) Position; // Nothing can be added before this one anymore
+	if (Count == 0)
+		return;
+	
+	int16_t Samples [APU_BUFFER_SIZE * 2];
+	
+	for (int c = 0; c < 2; c++) {
+		float Level = Integrator [c];
+		float Charge = Capacitor [c];
+		
+		for (uint32_t i = 0; i < Count; i++) {
+			Level += Delta [c][i];
+			float Out = Level - Charge; // Remove DC, like the capacitor on the real output
+			Charge = Level - Out * HighPass;
+			
+			int32_t Sample = (int32_t) (Out * 60);
+			if (Sample > 32767)
+				Sample = 32767;
+			else if (Sample < -32768)
+				Sample = -32768;
+			Samples [i * 2 + c] = Sample;
+		}
+		
+		Integrator [c] = Level;
+		Capacitor [c] = Charge;
+		
+		memmove (Delta [c], Delta [c] + Count, (APU_BUFFER_SIZE + APU_BLIP_TAPS - Count) * sizeof (float));
+		memset (Delta [c] + APU_BUFFER_SIZE + APU_BLIP_TAPS - Count, 0, Count * sizeof (float));
+	}
+	
+	if (!Muted)
+		Output.Write (Samples, Count); // Dropped if nobody is listening
+	
+	OriginPosition = Position - Count;
+	OriginTime = Time;
+}
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "State.h"
+#include "Profiler.h"
+#ifndef APU_H
+#define APU_H
+
+#define APU_CLOCK_RATE 4194304
+#define APU_BLIP_TAPS 16
+#define APU_BLIP_PHASES 32
+#define APU_BUFFER_SIZE 2048 // Samples that can pile up before they have to be generated
+#define APU_MIN_SAMPLE_RATE 8000
+#define APU_MAX_SAMPLE_RATE 192000 // Half a buffer plus one chunk of samples still fits
+
+// Lock-free single producer / single consumer ring of stereo int16 frames
+class AudioRing {
+	public:
+		uint32_t Write (const int16_t* Samples, uint32_t Frames); // Returns the frames that fit
+		uint32_t Read (int16_t* Out, uint32_t Frames); // Returns the frames that were available
+		uint32_t Available ();
+		void Clear ();
+
+		static const uint32_t Size = 16384; // Frames, power of 2
+	private:
+		int16_t Buffer [Size * 2];
+		std::atomic <uint32_t> ReadIndex {0};
+		std::atomic <uint32_t> WriteIndex {0};
+};
+
+/* Sound, FF10 - FF3F.
+   Nothing runs per clock: channels are caught up in bulk, from edge to edge, whenever a register is
+   touched or samples are needed. Every change of the mixed output is added as a band-limited step
+   into a delta buffer, which is integrated into samples for the ring. */
+class APU {
+	public:
+		APU (uint32_t _SampleRate);
+		void Reset ();
+		uint8_t ReadRegister (uint16_t Address, uint32_t Clock);
+		void WriteRegister (uint16_t Address, uint8_t Value, uint32_t Clock);
+		void Update (uint32_t Clock); // Catch up to Clock
+		void Flush (uint32_t Clock); // Catch up and move every finished sample to the ring
+		void SetClockRate (double Rate); // Emulated clocks per second, for resampling
+		void SyncState (StateStream &State); // Not the output ring, it belongs to the host
+
+		AudioRing Output;
+		uint32_t SampleRate;
+		uint8_t Muted = 0; // Samples are still made, but not queued (run-ahead)
+	private:
+		struct Channel {
+			uint8_t Enabled;
+			uint8_t DAC;
+			uint16_t Length;
+			uint8_t LengthEnabled;
+			uint16_t Frequency;
+			uint32_t Period; // Clocks per step
+			uint64_t NextEdge; // APU time of the next step
+			uint8_t Position; // Duty / Wave step
+			uint8_t Steps; // Steps NextEdge is ahead of Position
+			uint8_t Output; // Digital level, 0 - 15
+
+			// Envelope (1, 2, 4)
+			uint8_t Volume;
+			uint8_t EnvelopeIncrease;
+			uint8_t EnvelopePeriod;
+			uint8_t EnvelopeTimer;
+
+			uint8_t Duty; // 1, 2
+			uint16_t LFSR; // 4
+			uint8_t VolumeShift; // 3
+		};
+
+		Channel Channels [4];
+		uint8_t Registers [0x30]; // FF10 - FF3F, as written
+		uint8_t Power = 1;
+
+		// Sweep (1)
+		uint8_t SweepEnabled = 0;
+		uint8_t SweepTimer = 0;
+		uint16_t SweepShadow = 0;
+
+		// Timing
+		uint64_t Time = 0; // Clocks since creation, never wraps
+		uint32_t LastClock = 0;
+		uint64_t NextSequencer = 8192;
+		uint8_t SequencerStep = 0;
+
+		// Mixer / Synthesis
+		int32_t LastLeft = 0;
+		int32_t LastRight = 0;
+		float Delta [2][APU_BUFFER_SIZE + APU_BLIP_TAPS];
+		float Integrator [2] = {0, 0};
+		float Capacitor [2] = {0, 0};
+		float HighPass = 0.999f;
+		double ClocksToSamples;
+		uint64_t OriginTime = 0; // Sample position of time T: (T - OriginTime) * ClocksToSamples + OriginPosition
+		double OriginPosition = 0;
+
+		void RunUntil (uint64_t Target);
+		void ClockSequencer ();
+		void StepChannel (uint8_t ID);
+		void Trigger (uint8_t ID);
+		void UpdatePeriod (uint8_t ID);
+		void UpdateOutput (uint8_t ID);
+		uint16_t SweepCalculate ();
+		void Mix ();
+		void AddDelta (uint64_t At, int32_t DeltaLeft, int32_t DeltaRight);
+		void GenerateSamples ();
+};
+
+#endif
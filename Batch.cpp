@@ -0,0 +1,111 @@
+#include "Batch.h"
+
+Batch::Batch (const uint8_t* ROMData, uint32_t Size, uint32_t _Count, uint32_t Threads) {
+	Count = _Count;
+	if (Count == 0)
+		return;
+	
+	for (uint32_t i = 0; i < Count; i++) {
+		GameBoy* gb = new GameBoy (48000, i ? Machines [0] : NULL);
+		if (i == 0 && !gb->LoadROM (ROMData, Size)) {
+			delete gb;
+			return;
+		}
+		
+		gb->mmu->EchoSerial = 0;
+		gb->apu->Muted = 1; // Nobody listens
+		Machines.push_back (gb);
+	}
+	Valid = 1;
+	
+	if (Threads == 0)
+		Threads = std::thread::hardware_concurrency ();
+	if (Threads > Count)
+		Threads = Count;
+	for (uint32_t i = 1; i < Threads; i++)
+		Workers.push_back (std::thread (&Batch::Worker, this));
+}
+
+Batch::~Batch () {
+	{
+		std::lock_guard <std::mutex> Guard (Lock);
+		Quit = 1;
+	}
+	Started.notify_all ();
+	for (uint32_t i = 0; i < Workers.size (); i++)
+		Workers [i].join ();
+	
+	for (uint32_t i = 0; i < Machines.size (); i++)
+		delete Machines [i];
+}
+
+void Batch::Watch (const uint16_t* Addresses, uint32_t _WatchCount) {
+	WatchCount = _WatchCount;
+	Watched.assign (Addresses, Addresses + WatchCount);
+}
+
+void Batch::Reset () {
+	for (uint32_t i = 0; i < Count; i++)
+		Machines [i]->Reset ();
+}
+
+void Batch::Step (const uint8_t* _Actions, uint32_t _Frames, uint8_t* _Screens, uint8_t* _RAM) {
+	if (!Valid)
+		return;
+	
+	Actions = _Actions;
+	Frames = _Frames;
+	Screens = _Screens;
+	RAM = _RAM;
+	Next = 0;
+	
+	{
+		std::lock_guard <std::mutex> Guard (Lock);
+		Busy = Workers.size ();
+		Generation++;
+	}
+	Started.notify_all ();
+	
+	RunMachines ();
+	
+	std::unique_lock <std::mutex> Guard (Lock);
+	Finished.wait (Guard, [this] { return Busy == 0; });
+}
+
+void Batch::Worker () {
+	uint32_t Seen = 0;
+	while (1) {
+		{
+			std::unique_lock <std::mutex> Guard (Lock);
+			Started.wait (Guard, [&] { return Quit || Generation != Seen; });
+			if (Quit)
+				return;
+			Seen = Generation;
+		}
+		
+		RunMachines ();
+		
+		std::lock_guard <std::mutex> Guard (Lock);
+		if (--Busy == 0)
+			Finished.notify_one ();
+	}
+}
+
+// Machines are taken one at a time, so a slow one doesn't hold up a whole share
+void Batch::RunMachines () {
+	uint32_t Index;
+	while ((Index = Next++) < Count) {
+		GameBoy* gb = Machines [Index];
+		if (gb->mmu->JoypadState != Actions [Index]) // Only changes can raise the interrupt
+			gb->mmu->SetJoypad (Actions [Index]);
+		
+		for (uint32_t i = 0; i < Frames; i++)
+			gb->RunFrame ();
+		
+		if (Screens)
+			memcpy (Screens + Index * BATCH_SCREEN_SIZE, gb->ppu->GetFrame (), BATCH_SCREEN_SIZE);
+		if (RAM)
+			for (uint32_t i = 0; i < WatchCount; i++)
+				RAM [Index * WatchCount + i] = gb->mmu->PeekByteAt (Watched [i]);
+	}
+}
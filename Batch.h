@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "GameBoy.h"
+#ifndef BATCH_H
+#define BATCH_H
+
+#define BATCH_SCREEN_SIZE (160 * 144)
+
+/* Many machines running the same game in lockstep (training workloads). They all read one ROM image,
+   and are stepped by a pool of threads that lives as long as the batch. Observations are written into
+   the caller's struct-of-arrays buffers; nothing is allocated after creation. */
+class Batch {
+	public:
+		Batch (const uint8_t* ROMData, uint32_t Size, uint32_t _Count, uint32_t Threads); // Threads = 0: One per core
+		~Batch ();
+		void Watch (const uint16_t* Addresses, uint32_t _WatchCount); // Bytes copied into RAM after every step
+		void Step (const uint8_t* _Actions, uint32_t _Frames, uint8_t* _Screens, uint8_t* _RAM); // See below
+		void Reset ();
+		GameBoy* Machine (uint32_t Index) { return Machines [Index]; } // States, memory, ... of one of them
+		
+		/* Step: Actions [Count] - JOYPAD_* held by each machine for the Frames it runs
+		         Screens [Count][BATCH_SCREEN_SIZE] - Shades of the last frame, NULL - Not needed
+		         RAM [Count][WatchCount] - The watched bytes, NULL - Not needed */
+		
+		uint8_t Valid = 0;
+		uint32_t Count;
+		uint32_t WatchCount = 0;
+	private:
+		std::vector <GameBoy*> Machines;
+		std::vector <uint16_t> Watched;
+		
+		// Pool, the caller's thread works too
+		std::vector <std::thread> Workers;
+		std::mutex Lock;
+		std::condition_variable Started;
+		std::condition_variable Finished;
+		uint32_t Generation = 0;
+		uint32_t Busy = 0; // Workers still in the current step
+		uint8_t Quit = 0;
+		std::atomic <uint32_t> Next {0}; // Next machine to take
+		
+		// Current step
+		const uint8_t* Actions = NULL;
+		uint32_t Frames = 0;
+		uint8_t* Screens = NULL;
+		uint8_t* RAM = NULL;
+		
+		void Worker ();
+		void RunMachines ();
+};
+
+#endif
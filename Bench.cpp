@@ -0,0 +1,356 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "GameBoy.h"
+#include "Batch.h"
+
+/* Throughput benchmark over the bundled test ROMs: every ROM runs headless for a fixed clock budget,
+   several times. Medians go to a JSON file and are compared with a stored baseline. */
+
+using namespace std::chrono;
+
+struct Result {
+	std::string ROM;
+	uint32_t Clocks; // Run, less than the budget when the ROM executed STOP
+	double MHz;
+	double InstructionsPerSecond;
+	double FramesPerSecond;
+	long PeakRSS; // KB, while this ROM ran
+};
+
+double Median (std::vector <double> Values) {
+	std::sort (Values.begin (), Values.end ());
+	uint32_t Count = Values.size ();
+	return (Count & 1) ? Values [Count / 2] : (Values [Count / 2 - 1] + Values [Count / 2]) / 2;
+}
+
+void ResetPeakRSS () { // Linux only, VmHWM starts again from the current RSS
+	FILE* File = fopen ("/proc/self/clear_refs", "w");
+	if (File) {
+		fputs ("5", File);
+		fclose (File);
+	}
+}
+
+long PeakRSS () { // KB since the last ResetPeakRSS
+	long Peak = 0;
+	FILE* File = fopen ("/proc/self/status", "r");
+	if (File) {
+		char Line [256];
+		while (fgets (Line, sizeof (Line), File))
+			if (sscanf (Line, "VmHWM: %ld", &Peak) == 1)
+				break;
+		fclose (File);
+	}
+	if (Peak == 0) { // No procfs, the peak of the whole process
+		rusage Usage;
+		getrusage (RUSAGE_SELF, &Usage);
+		Peak = Usage.ru_maxrss;
+	}
+	return Peak;
+}
+
+// ROMs that STOP early run again until a repetition has taken MinSeconds, one short run is mostly timer noise
+uint8_t Run (const char* Filename, uint32_t Clocks, uint32_t Frames, uint32_t Repetitions, double MinSeconds, Result &Out) {
+	std::vector <double> MHz, Instructions, FramesPerSecond;
+	
+	ResetPeakRSS ();
+	for (uint32_t Rep = 0; Rep < Repetitions; Rep++) {
+		double Seconds = 0, RunClocks = 0, RunInstructions = 0, RunFrames = 0;
+		do {
+			GameBoy* gb = new GameBoy (48000);
+			if (!gb->LoadROM (Filename)) {
+				delete gb;
+				return 0;
+			}
+			gb->mmu->Muted = 1; // No serial output
+			gb->apu->Muted = 1;
+			
+			CPU* cpu = gb->cpu;
+			PPU* ppu = gb->ppu;
+			uint32_t LastFlushClock = 0;
+			
+			auto StartTime = high_resolution_clock::now ();
+			while (cpu->ClockCount < Clocks && (Frames == 0 || ppu->FrameCount < Frames)) {
+				uint32_t Before = cpu->ClockCount;
+				gb->Step ();
+				if (cpu->ClockCount == Before) // STOP, nothing moves anymore
+					break;
+				
+				if (cpu->ClockCount - LastFlushClock >= 8192) { // Sound is generated as in the emulator
+					LastFlushClock = cpu->ClockCount;
+					gb->apu->Flush (cpu->ClockCount);
+				}
+			}
+			Seconds += duration_cast <nanoseconds> (high_resolution_clock::now () - StartTime).count () / 1e9;
+			
+			Out.Clocks = cpu->ClockCount; // Same on every run
+			RunClocks += cpu->ClockCount;
+			RunInstructions += cpu->InstructionCount;
+			RunFrames += ppu->FrameCount;
+			delete gb;
+		} while (Seconds < MinSeconds);
+		
+		MHz.push_back (RunClocks / Seconds / 1e6);
+		Instructions.push_back (RunInstructions / Seconds);
+		FramesPerSecond.push_back (RunFrames / Seconds);
+	}
+	
+	Out.ROM = Filename;
+	Out.MHz = Median (MHz);
+	Out.InstructionsPerSecond = Median (Instructions);
+	Out.FramesPerSecond = Median (FramesPerSecond);
+	Out.PeakRSS = PeakRSS ();
+	return 1;
+}
+
+// Aggregate frames/s of a batch of Count machines on 1, 2, 4... threads, up to one per core
+int BatchScaling (const char* Filename, uint32_t Count, uint32_t Frames) {
+	FILE* File = fopen (Filename, "rb");
+	if (File == NULL) {
+		printf ("[ERR] Can't open %s\n", Filename);
+		return 1;
+	}
+	std::vector <uint8_t> ROM (MMU_ROM_SIZE);
+	ROM.resize (fread (ROM.data (), 1, ROM.size (), File));
+	fclose (File);
+	
+	std::vector <uint8_t> Actions (Count, 0);
+	std::vector <uint8_t> Screens (Count * BATCH_SCREEN_SIZE);
+	uint32_t Cores = std::thread::hardware_concurrency ();
+	double Single = 0;
+	
+	printf ("%s, %u machines, %u frames each\n%8s %14s %10s %10s\n", Filename, Count, Frames, "Threads", "Frames/s", "Speedup", "RSS KB");
+	for (uint32_t Threads = 1; ; Threads = (Threads * 2 > Cores && Threads < Cores) ? Cores : Threads * 2) {
+		Batch Machines (ROM.data (), ROM.size (), Count, Threads);
+		if (!Machines.Valid) {
+			printf ("[ERR] %s isn't a ROM\n", Filename);
+			return 1;
+		}
+		
+		auto StartTime = high_resolution_clock::now ();
+		for (uint32_t i = 0; i < Frames; i++) {
+			Actions.assign (Count, (i & 0x40) ? JOYPAD_START : 0);
+			Machines.Step (Actions.data (), 1, Screens.data (), NULL);
+		}
+		double Seconds = duration_cast <nanoseconds> (high_resolution_clock::now () - StartTime).count () / 1e9;
+		
+		rusage Usage;
+		getrusage (RUSAGE_SELF, &Usage);
+		double FramesPerSecond = (double) Count * Frames / Seconds;
+		if (Threads == 1)
+			Single = FramesPerSecond;
+		printf ("%8u %14.0f %9.2fx %10ld\n", Threads, FramesPerSecond, FramesPerSecond / Single, Usage.ru_maxrss);
+		
+		if (Threads >= Cores)
+			break;
+	}
+	return 0;
+}
+
+long CurrentRSS () { // KB, unlike ru_maxrss it goes down again
+	long Pages = 0;
+	FILE* File = fopen ("/proc/self/statm", "r");
+	if (File) {
+		if (fscanf (File, "%*s %ld", &Pages) != 1)
+			Pages = 0;
+		fclose (File);
+	}
+	return Pages * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+// Forks Count machines off one that ran Frames frames, then runs every fork for a frame with its own input
+int ForkCost (const char* Filename, uint32_t Count, uint32_t Frames) {
+	GameBoy* Root = new GameBoy (48000);
+	if (!Root->LoadROM (Filename)) {
+		printf ("[ERR] Can't load %s\n", Filename);
+		delete Root;
+		return 1;
+	}
+	Root->mmu->Muted = 1;
+	Root->apu->Muted = 1;
+	for (uint32_t i = 0; i < Frames; i++)
+		Root->RunFrame ();
+	
+	std::vector <GameBoy*> Forks (Count);
+	long Before = CurrentRSS ();
+	auto StartTime = high_resolution_clock::now ();
+	for (uint32_t i = 0; i < Count; i++)
+		Forks [i] = Root->Fork ();
+	double Seconds = duration_cast <nanoseconds> (high_resolution_clock::now () - StartTime).count () / 1e9;
+	long Forked = CurrentRSS ();
+	
+	StartTime = high_resolution_clock::now ();
+	for (uint32_t i = 0; i < Count; i++) {
+		Forks [i]->mmu->SetJoypad (1 << (i & 7));
+		Forks [i]->RunFrame ();
+	}
+	double RunSeconds = duration_cast <nanoseconds> (high_resolution_clock::now () - StartTime).count () / 1e9;
+	long Ran = CurrentRSS ();
+	
+	printf ("%s after %u frames, %u forks, state %u bytes\n", Filename, Frames, Count, Root->StateSize ());
+	printf ("%-24s %14.0f\n", "Forks/s", Count / Seconds);
+	printf ("%-24s %14.2f\n", "us/fork", Seconds * 1e6 / Count);
+	printf ("%-24s %14.1f\n", "KB/fork", (double) (Forked - Before) / Count);
+	printf ("%-24s %14.1f\n", "KB/fork after 1 frame", (double) (Ran - Before) / Count);
+	printf ("%-24s %14.0f\n", "Forked frames/s", Count / RunSeconds);
+	
+	for (uint32_t i = 0; i < Count; i++)
+		delete Forks [i];
+	delete Root;
+	return 0;
+}
+
+// One result per line, so the baseline can be read back without a JSON parser
+void WriteResults (const char* Filename, const std::vector <Result> &Results, uint32_t Clocks, uint32_t Repetitions) {
+	FILE* File = fopen (Filename, "w");
+	if (File == NULL) {
+		printf ("[ERR] Can't write %s\n", Filename);
+		return;
+	}
+	
+	fprintf (File, "{\"clocks\": %u, \"repetitions\": %u, \"results\": [\n", Clocks, Repetitions);
+	for (uint32_t i = 0; i < Results.size (); i++)
+		fprintf (File, "\t{\"rom\": \"%s\", \"clocks\": %u, \"mhz\": %.3f, \"instructions_per_s\": %.0f, \"frames_per_s\": %.1f, \"peak_rss_kb\": %ld}%s\n",
+			Results [i].ROM.c_str (), Results [i].Clocks, Results [i].MHz, Results [i].InstructionsPerSecond, Results [i].FramesPerSecond,
+			Results [i].PeakRSS, i + 1 < Results.size () ? "," : "");
+	fprintf (File, "]}\n");
+	fclose (File);
+}
+
+std::vector <Result> ReadResults (const char* Filename) {
+	std::vector <Result> Results;
+	FILE* File = fopen (Filename, "r");
+	if (File == NULL)
+		return Results;
+	
+	char Line [1024];
+	while (fgets (Line, sizeof (Line), File)) {
+		char ROM [512];
+		Result Entry;
+		if (sscanf (Line, " {\"rom\": \"%511[^\"]\", \"clocks\": %u, \"mhz\": %lf, \"instructions_per_s\": %lf, \"frames_per_s\": %lf, \"peak_rss_kb\": %ld",
+			ROM, &Entry.Clocks, &Entry.MHz, &Entry.InstructionsPerSecond, &Entry.FramesPerSecond, &Entry.PeakRSS) == 6) {
+			Entry.ROM = ROM;
+			Results.push_back (Entry);
+		}
+	}
+	fclose (File);
+	return Results;
+}
+
+int main (int argc, char** argv) {
+	uint32_t Clocks = 4194304 * 20; // 20 emulated seconds
+	uint32_t Frames = 0;
+	uint32_t Repetitions = 5;
+	double Tolerance = 10; // % slower than the baseline that fails
+	double MinSeconds = 0.25; // Per repetition
+	const char* OutFilename = "bench_results.json";
+	const char* BaselineFilename = NULL;
+	uint8_t UpdateBaseline = 0;
+	uint32_t BatchCount = 0;
+	uint32_t ForkCount = 0;
+	const char* BatchROM = "TestROMs/bgbtest.gb";
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "-clocks") == 0 && i + 1 < argc)
+			Clocks = strtoul (argv[++i], NULL, 10);
+		else if (strcmp (argv[i], "-frames") == 0 && i + 1 < argc)
+			Frames = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-reps") == 0 && i + 1 < argc)
+			Repetitions = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-tolerance") == 0 && i + 1 < argc)
+			Tolerance = atof (argv[++i]);
+		else if (strcmp (argv[i], "-mintime") == 0 && i + 1 < argc)
+			MinSeconds = atof (argv[++i]);
+		else if (strcmp (argv[i], "-out") == 0 && i + 1 < argc)
+			OutFilename = argv[++i];
+		else if (strcmp (argv[i], "-baseline") == 0 && i + 1 < argc)
+			BaselineFilename = argv[++i];
+		else if (strcmp (argv[i], "-update") == 0)
+			UpdateBaseline = 1;
+		else if (strcmp (argv[i], "-batch") == 0 && i + 1 < argc)
+			BatchCount = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-fork") == 0 && i + 1 < argc)
+			ForkCount = atoi (argv[++i]);
+		else if ((BatchCount || ForkCount) && argv[i][0] != '-')
+			BatchROM = argv[i];
+		else {
+			printf ("Usage: %s [-clocks N] [-frames N] [-reps N] [-mintime S] [-out FILE] [-baseline FILE [-update]] [-tolerance %%]\n", argv[0]);
+			printf ("       %s -batch N [-frames N] [ROM]\n", argv[0]);
+			printf ("       %s -fork N [-frames N] [ROM]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	if (BatchCount)
+		return BatchScaling (BatchROM, BatchCount, Frames ? Frames : 600);
+	if (ForkCount)
+		return ForkCost (BatchROM, ForkCount, Frames ? Frames : 600);
+	if (Repetitions < 1)
+		Repetitions = 1;
+	
+	std::vector <std::string> ROMs = {"TestROMs/cpu_instrs.gb", "TestROMs/bgbtest.gb"};
+	std::vector <std::string> Individual;
+	DIR* Directory = opendir ("TestROMs/individual");
+	if (Directory) {
+		while (dirent* Entry = readdir (Directory))
+			if (strstr (Entry->d_name, ".gb"))
+				Individual.push_back (std::string ("TestROMs/individual/") + Entry->d_name);
+		closedir (Directory);
+	}
+	std::sort (Individual.begin (), Individual.end ());
+	ROMs.insert (ROMs.end (), Individual.begin (), Individual.end ());
+	
+	std::vector <Result> Results;
+	printf ("%-44s %10s %10s %14s %10s %10s\n", "ROM", "Clocks", "MHz", "Instr/s", "Frames/s", "RSS KB");
+	for (uint32_t i = 0; i < ROMs.size (); i++) {
+		Result Entry;
+		if (!Run (ROMs [i].c_str (), Clocks, Frames, Repetitions, MinSeconds, Entry)) {
+			printf ("[WARN] Can't load %s\n", ROMs [i].c_str ());
+			continue;
+		}
+		printf ("%-44s %10u %10.3f %14.0f %10.1f %10ld\n", Entry.ROM.c_str (), Entry.Clocks, Entry.MHz, Entry.InstructionsPerSecond, Entry.FramesPerSecond, Entry.PeakRSS);
+		Results.push_back (Entry);
+	}
+	WriteResults (OutFilename, Results, Clocks, Repetitions);
+	
+	if (BaselineFilename == NULL)
+		return 0;
+	
+	std::vector <Result> Baseline = ReadResults (BaselineFilename);
+	if (Baseline.empty () || UpdateBaseline) {
+		WriteResults (BaselineFilename, Results, Clocks, Repetitions);
+		printf ("[INFO] Baseline written to %s\n", BaselineFilename);
+		return 0;
+	}
+	
+	uint32_t Regressions = 0;
+	for (uint32_t i = 0; i < Results.size (); i++)
+		for (uint32_t j = 0; j < Baseline.size (); j++) {
+			if (Results [i].ROM != Baseline [j].ROM)
+				continue;
+			
+			double Change = (Results [i].MHz / Baseline [j].MHz - 1) * 100;
+			if (Change < -Tolerance) {
+				printf ("[ERR] REGRESSION %s: %.3f MHz, baseline %.3f MHz (%+.1f%%)\n", Results [i].ROM.c_str (), Results [i].MHz, Baseline [j].MHz, Change);
+				Regressions++;
+			}
+		}
+	
+	if (Regressions) {
+		printf ("[ERR] %d of %d ROMs are more than %.0f%% slower than %s\n", Regressions, (uint32_t) Results.size (), Tolerance, BaselineFilename);
+		return 1;
+	}
+	
+	printf ("[INFO] No ROM more than %.0f%% slower than %s\n", Tolerance, BaselineFilename);
+	return 0;
+}
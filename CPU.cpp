@@ -1,4 +1,5 @@
 #include "CPU.h"
+#include "Debugger.h"
 
 using namespace Utils;
 
@@ -24,6 +25,23 @@ const uint8_t ClocksPerInstruction[] = {
 
 CPU::CPU (MMU* _mmu) {
 	mmu = _mmu;
+	mmu->ClockCount = &ClockCount;
+	mmu->IF = &IF;
+	mmu->IE = &IE;
+	Reset ();
+}
+
+void CPU::Reset () {
+	ClockCount = 0;
+	InstructionCount = 0;
+	
+	flag_Z = flag_N = flag_H = flag_C = 0;
+	Halt = 0;
+	Stopped = 0;
+	EnableInterruptsFlag = 0;
+	InterruptsEnabled = 0;
+	IF = 0;
+	IE = 0;
 	
 	// Simulate Boot ROM
 	reg_AF = 0x11B0;
@@ -67,7 +85,38 @@ void CPU::Debug () {
 	printf ("\n");
 }
 
-void CPU::Interrupt (uint8_t ID) {
+CPURegisters CPU::GetRegisters () {
+	CPURegisters Registers;
+	Registers.AF = reg_AF;
+	Registers.BC = reg_BC;
+	Registers.DE = reg_DE;
+	Registers.HL = reg_HL;
+	Registers.SP = SP;
+	Registers.PC = PC;
+	Registers.InterruptsEnabled = InterruptsEnabled;
+	Registers.Halt = Halt;
+	return Registers;
+}
+
+void CPU::Record () {
+	TraceRecord* Entry = Trace->Next ();
+	Entry->Clock = ClockCount;
+	Entry->PC = PC;
+	Entry->Bank = (PC >= 0x4000 && PC < 0x8000) ? mmu->CurrentROMBank : 0;
+	Entry->Flags = (InterruptsEnabled ? TRACE_IME : 0) | (EnableInterruptsFlag ? TRACE_EI : 0);
+	for (int i = 0; i < 4; i++)
+		Entry->Memory [i] = mmu->PeekByteAt (PC + i);
+	Entry->AF = reg_AF;
+	Entry->BC = reg_BC;
+	Entry->DE = reg_DE;
+	Entry->HL = reg_HL;
+	Entry->SP = SP;
+	Entry->IF = IF;
+	Entry->IE = IE;
+	Trace->Commit ();
+}
+
+void CPU::ServiceInterrupt () {
 	/*
 		0x0040 VBlank Handler
 		0x0048 LCDC Handler
@@ -76,24 +125,51 @@ void CPU::Interrupt (uint8_t ID) {
 		0x0060 Joypad Input Handler
 	*/
 	
-	uint8_t reg_IF = 0;
-	SetBit (reg_IF, ID, 1);
+	uint8_t Pending = IF & IE & 0x1F;
 	
-	if (InterruptsEnabled) {
-		uint8_t reg_IE = mmu->GetByteAt (0xFFFF);
-		
-		if (GetBit (reg_IE, ID)) { // Interrupt Enabled in IE
-			ClockCount += 20;
-			InterruptsEnabled = 0;
-			if (Halt)
-				ClockCount += 4;
-			Halt = 0;
-			StackPush (PC);
-			PC = 0x0040 + (ID << 3); // Jump to interrupt handler
-		}
+	if (Halt) { // Any enabled request wakes the CPU, even with interrupts disabled
+		Halt = 0;
+		if (InterruptsEnabled)
+			ClockCount += 4;
 	}
 	
-	mmu->SetByteAt (0xFF0F, reg_IF);
+	if (!InterruptsEnabled)
+		return;
+	
+	uint8_t ID = 0;
+	while (!GetBit (Pending, ID)) // Lowest bit first
+		ID++;
+	
+	SetBit (IF, ID, 0);
+	ClockCount += 20;
+	InterruptsEnabled = 0;
+	StackPush (PC);
+	PC = 0x0040 + (ID << 3); // Jump to interrupt handler
+	HOTSPOT_CALL (PC, SP);
+}
+
+void CPU::SyncState (StateStream &State) {
+	State.Sync (reg_AF);
+	State.Sync (reg_BC);
+	State.Sync (reg_DE);
+	State.Sync (reg_HL);
+	State.Sync (SP);
+	State.Sync (PC);
+	
+	State.Sync (flag_Z);
+	State.Sync (flag_N);
+	State.Sync (flag_H);
+	State.Sync (flag_C);
+	
+	State.Sync (Halt);
+	State.Sync (Stopped);
+	State.Sync (EnableInterruptsFlag);
+	State.Sync (InterruptsEnabled);
+	State.Sync (IF);
+	State.Sync (IE);
+	
+	State.Sync (ClockCount);
+	State.Sync (InstructionCount);
 }
 
 inline uint8_t CPU::GetM () {
@@ -173,22 +249,34 @@ void CPU::Clock () {
 	if (Stopped)
 		return;
 	
+	if (IF & IE & 0x1F) // Instruction boundary, nothing pending almost every time
+		ServiceInterrupt ();
+	
+	HOTSPOT_STEP (PC);
+	
 	if (Halt) {
 		ClockCount += ClocksPerInstruction [0x00]; // Execute NOP
 		InstructionCount++;
 		return;
 	}
 	
+	if (Breaks && Breaks->Instruction (PC)) // Stop before it
+		return;
+	
+	if (Trace)
+		Record ();
+	
 	uint8_t Instruction = mmu->GetByteAt (PC++);
+	HOTSPOT_SAVE_SP (SP);
 	Execute (Instruction);
+	HOTSPOT_FLOW (Instruction, SP, PC);
 }
 
 void CPU::Execute (uint8_t Instruction) {
 	ClockCount += ClocksPerInstruction [Instruction];
 	InstructionCount++;
+	PROFILE_OPCODE (Instruction);
 	
-	//printf ("0x%04x: Executing 0x%02x\n", PC - 1, Instruction);
-
 	flag_Z = GetBit (*reg_F, 7);
 	flag_N = GetBit (*reg_F, 6);
 	flag_H = GetBit (*reg_F, 5);
@@ -203,11 +291,12 @@ void CPU::Execute (uint8_t Instruction) {
 		// Misc / Control
 		case 0x00: break; // NOP
 		case 0x10: printf ("[INFO] CPU Stopped\n"); Stopped = 1; break; // STOP
-		case 0x76: if (InterruptsEnabled) Halt = 1; break; // HALT
+		case 0x76: if (InterruptsEnabled || !(IF & IE & 0x1F)) Halt = 1; break; // HALT - Falls through if a request is already pending with interrupts disabled
 		case 0xF3: InterruptsEnabled = 0; break; // DI
 		case 0xFB: EnableInterruptsFlag = 1; break; // EI - Delay of one instruction
 		case 0xCB: u8 = mmu->GetByteAt (PC++); // CB
 			ClockCount += 8;
+			PROFILE_CB_OPCODE (u8);
 			switch (u8) {
 				case 0x00: SetN (0); SetH (0); u8 = *reg_B >> 7; *reg_B <<= 1; *reg_B |= u8; SetC (u8); SetZ (*reg_B == 0); break; // RLC
 				case 0x01: SetN (0); SetH (0); u8 = *reg_C >> 7; *reg_C <<= 1; *reg_C |= u8; SetC (u8); SetZ (*reg_C == 0); break; // RLC
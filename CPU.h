@@ -1,24 +1,45 @@
 #include <stdint.h>
 #include <stdio.h>
-#include <SDL2/SDL.h>
 #include "MMU.h"
 #include "utils.h"
+#include "State.h"
+#include "Profiler.h"
+#include "HotSpots.h"
+#include "Trace.h"
 #ifndef CPU_H
 #define CPU_H
 
+class Debugger;
+
+// Register snapshot, for debuggers and tools outside the CPU
+struct CPURegisters {
+	uint16_t AF, BC, DE, HL, SP, PC;
+	uint8_t InterruptsEnabled;
+	uint8_t Halt;
+};
+
 class CPU {
 	public:
 		CPU (MMU* _mmu);
+		void Reset (); // Registers as the boot ROM leaves them, and the I/O it sets up
 		void Clock ();
 		void Debug ();
-		void Interrupt (uint8_t ID);
+		CPURegisters GetRegisters ();
+		inline void Interrupt (uint8_t ID) { IF |= 1 << ID; } // Request only, taken at the next instruction boundary
+		void SyncState (StateStream &State);
 	
 		uint32_t ClockCount = 0;
 		uint32_t InstructionCount = 0;
 		uint8_t Debugging = 0;
+		Debugger* Breaks = NULL; // Asked before every instruction, only set while breakpoints or steps are pending
+		Tracer* Trace = NULL; // Gets a record before every instruction
+#ifdef HOTSPOTS
+		HotSpots* Spots = NULL;
+#endif
 	private:
 		MMU* mmu;
 		void Execute (uint8_t Instruction);
+		void Record (); // Trace the state before the instruction at PC
 	
 		// Registers
 		uint16_t reg_AF = 0;
@@ -54,6 +75,10 @@ class CPU {
 		uint8_t Stopped = 0;
 		uint8_t EnableInterruptsFlag = 0;
 		uint8_t InterruptsEnabled = 0;
+		uint8_t IF = 0; // FF0F, requests
+		uint8_t IE = 0; // FFFF, enabled
+		
+		void ServiceInterrupt (); // Highest priority request in IF & IE
 	
 		// Functions - Convenience
 		uint8_t GetM (); // M = Value in memory pointed by reg_HL
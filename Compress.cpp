@@ -0,0 +1,153 @@
+#include "Compress.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_LAST_LITERALS 5 // The end is always literals, so matching can read 4 bytes without checks
+
+static inline uint32_t Read32 (const uint8_t* Data) {
+	uint32_t Value;
+	memcpy (&Value, Data, 4);
+	return Value;
+}
+
+static inline uint32_t Hash (uint32_t Value) {
+	return (Value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t* WriteLength (uint8_t* Out, uint32_t Length) { // Continuation of a length that was >= 15
+	while (Length >= 255) {
+		*Out++ = 255;
+		Length -= 255;
+	}
+	*Out++ = Length;
+	return Out;
+}
+
+uint32_t Compression::Bound (uint32_t Size) {
+	return Size + Size / 255 + 16;
+}
+
+uint32_t Compression::Compress (const uint8_t* In, uint32_t Size, uint8_t* Out, uint32_t Capacity) {
+	if (Capacity < Bound (Size)) // Not checked while writing
+		return 0;
+	
+	uint32_t Table [1 << LZ_HASH_BITS];
+	memset (Table, 0, sizeof (Table));
+	
+	uint8_t* Output = Out;
+	uint32_t Anchor = 0; // First literal not written yet
+	uint32_t Position = 1;
+	uint32_t Limit = Size > LZ_LAST_LITERALS + LZ_MIN_MATCH ? Size - LZ_LAST_LITERALS - LZ_MIN_MATCH : 0;
+	
+	while (Position < Limit) {
+		uint32_t Sequence = Read32 (In + Position);
+		uint32_t Bucket = Hash (Sequence);
+		uint32_t Candidate = Table [Bucket];
+		Table [Bucket] = Position;
+		
+		if (Position - Candidate > LZ_MAX_OFFSET || Read32 (In + Candidate) != Sequence) {
+			Position++;
+			continue;
+		}
+		
+		uint32_t MatchLength = LZ_MIN_MATCH;
+		while (Position + MatchLength < Size - LZ_LAST_LITERALS && In [Candidate + MatchLength] == In [Position + MatchLength])
+			MatchLength++;
+		
+		uint32_t Literals = Position - Anchor;
+		uint8_t* Token = Output++;
+		*Token = ((Literals >= 15 ? 15 : Literals) << 4) | (MatchLength - LZ_MIN_MATCH >= 15 ? 15 : MatchLength - LZ_MIN_MATCH);
+		
+		if (Literals >= 15)
+			Output = WriteLength (Output, Literals - 15);
+		memcpy (Output, In + Anchor, Literals);
+		Output += Literals;
+		
+		uint32_t Offset = Position - Candidate;
+		*Output++ = Offset & 0xFF;
+		*Output++ = Offset >> 8;
+		
+		if (MatchLength - LZ_MIN_MATCH >= 15)
+			Output = WriteLength (Output, MatchLength - LZ_MIN_MATCH - 15);
+		
+		Position += MatchLength;
+		Anchor = Position;
+	}
+	
+	// Trailing literals
+	uint32_t Literals = Size - Anchor;
+	*Output++ = (Literals >= 15 ? 15 : Literals) << 4;
+	if (Literals >= 15)
+		Output = WriteLength (Output, Literals - 15);
+	memcpy (Output, In + Anchor, Literals);
+	Output += Literals;
+	
+	return Output - Out;
+}
+
+uint32_t Compression::Decompress (const uint8_t* In, uint32_t Size, uint8_t* Out, uint32_t Capacity) {
+	const uint8_t* Input = In;
+	const uint8_t* InputEnd = In + Size;
+	uint32_t Position = 0;
+	
+	while (Input < InputEnd) {
+		uint8_t Token = *Input++;
+		
+		uint32_t Literals = Token >> 4;
+		if (Literals == 15) {
+			uint8_t Byte;
+			do {
+				if (Input >= InputEnd)
+					return 0;
+				Byte = *Input++;
+				Literals += Byte;
+			} while (Byte == 255);
+		}
+		
+		if (Literals > (uint32_t) (InputEnd - Input) || Literals > Capacity - Position)
+			return 0;
+		memcpy (Out + Position, Input, Literals);
+		Input += Literals;
+		Position += Literals;
+		
+		if (Input == InputEnd) // Last sequence has no match
+			break;
+		
+		if (InputEnd - Input < 2)
+			return 0;
+		uint32_t Offset = Input [0] | (Input [1] << 8);
+		Input += 2;
+		
+		uint32_t MatchLength = (Token & 0x0F) + LZ_MIN_MATCH;
+		if ((Token & 0x0F) == 15) {
+			uint8_t Byte;
+			do {
+				if (Input >= InputEnd)
+					return 0;
+				Byte = *Input++;
+				MatchLength += Byte;
+			} while (Byte == 255);
+		}
+		
+		if (Offset == 0 || Offset > Position || MatchLength > Capacity - Position)
+			return 0;
+		
+		if (Offset == 1) // Runs, the common case in deltas
+			memset (Out + Position, Out [Position - 1], MatchLength);
+		else { // The match may overlap itself: copy whole periods, doubling every time
+			uint8_t* Source = Out + Position - Offset;
+			uint32_t Copied = 0;
+			while (Copied < MatchLength) {
+				uint32_t Chunk = Offset + Copied;
+				if (Chunk > MatchLength - Copied)
+					Chunk = MatchLength - Copied;
+				memcpy (Out + Position + Copied, Source, Chunk);
+				Copied += Chunk;
+			}
+		}
+		Position += MatchLength;
+	}
+	
+	return Position;
+}
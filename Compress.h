@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <string.h>
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+/* LZ4-style block compression: sequences of [Token][Literal length][Literals][Offset][Match length].
+   Token: upper 4 bits literal count, lower 4 bits match length - 4, 15 = continued in bytes of up to 255. */
+namespace Compression {
+	uint32_t Bound (uint32_t Size); // Worst case output for Size input bytes
+	uint32_t Compress (const uint8_t* In, uint32_t Size, uint8_t* Out, uint32_t Capacity); // 0 - Didn't fit
+	uint32_t Decompress (const uint8_t* In, uint32_t Size, uint8_t* Out, uint32_t Capacity); // 0 - Corrupt / didn't fit
+}
+
+#endif
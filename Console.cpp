@@ -0,0 +1,27 @@
+#include "Console.h"
+
+Console::Console () {
+	Reader = std::thread (&Console::ReaderLoop, this);
+}
+
+Console::~Console () {
+	Reader.detach (); // Blocked in fgets, it goes with the process
+}
+
+void Console::ReaderLoop () {
+	char Line [256];
+	while (fgets (Line, sizeof (Line), stdin)) {
+		std::lock_guard <std::mutex> Guard (Lock);
+		Lines.push_back (Line);
+	}
+}
+
+uint8_t Console::Poll (char* Line, uint32_t Size) {
+	std::lock_guard <std::mutex> Guard (Lock);
+	if (Lines.empty ())
+		return 0;
+	
+	snprintf (Line, Size, "%s", Lines.front ().c_str ());
+	Lines.pop_front ();
+	return 1;
+}
@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+/* Debugger commands typed on stdin. A thread waits for whole lines, the emulator takes them
+   whenever it pumps input, so it never blocks on the terminal. */
+class Console {
+	public:
+		Console ();
+		~Console ();
+		uint8_t Poll (char* Line, uint32_t Size); // 1 - A line was waiting
+	private:
+		std::deque <std::string> Lines;
+		std::mutex Lock;
+		std::thread Reader;
+		
+		void ReaderLoop ();
+};
+
+#endif
@@ -0,0 +1,437 @@
+#include "Debugger.h"
+#include "Disassembler.h"
+#include <strings.h>
+
+static const char* RegisterNames [] = {"", "A", "F", "B", "C", "D", "E", "H", "L", "AF", "BC", "DE", "HL", "SP", "PC"};
+static const char* OpNames [] = {"==", "!=", "<", "<=", ">", ">="};
+
+Debugger::Debugger (GameBoy* _gb) {
+	gb = _gb;
+	Update ();
+}
+
+Debugger::~Debugger () {
+	gb->cpu->Breaks = NULL;
+	gb->mmu->Watcher = NULL;
+	memset (gb->mmu->WatchPages, 0, sizeof (gb->mmu->WatchPages));
+}
+
+uint32_t Debugger::Add (Breakpoint Point) {
+	Point.ID = NextID++;
+	Point.Hits = 0;
+	Points.push_back (Point);
+	Update ();
+	return Point.ID;
+}
+
+uint32_t Debugger::AddBreakpoint (uint16_t Address, int16_t Bank, Condition If) {
+	Breakpoint Point = {0, BREAK_PC, Address, Address, Bank, 0, -1, If, 0};
+	return Add (Point);
+}
+
+uint32_t Debugger::AddCondition (Condition If) {
+	Breakpoint Point = {0, BREAK_CONDITION, 0, 0xFFFF, -1, 0, -1, If, 0};
+	return Add (Point);
+}
+
+uint32_t Debugger::AddWatchpoint (uint16_t Start, uint16_t End, uint8_t Access, int16_t Value, Condition If) {
+	if (End < Start)
+		End = Start;
+	Breakpoint Point = {0, BREAK_WATCH, Start, End, -1, Access, Value, If, 0};
+	return Add (Point);
+}
+
+uint8_t Debugger::Remove (uint32_t ID) {
+	for (uint32_t i = 0; i < Points.size (); i++)
+		if (Points [i].ID == ID) {
+			Points.erase (Points.begin () + i);
+			Update ();
+			return 1;
+		}
+	return 0;
+}
+
+void Debugger::Clear () {
+	Points.clear ();
+	Update ();
+}
+
+void Debugger::Update () {
+	uint8_t* Pages = gb->mmu->WatchPages;
+	memset (PCTable, 0, sizeof (PCTable));
+	memset (Pages, 0, sizeof (gb->mmu->WatchPages));
+	Conditions = 0;
+	uint32_t Addresses = 0;
+	
+	if (Suspended) {
+		gb->cpu->Breaks = NULL;
+		return;
+	}
+	
+	for (uint32_t i = 0; i < Points.size (); i++) {
+		Breakpoint &Point = Points [i];
+		if (Point.Type == BREAK_PC) {
+			PCTable [Point.Start] = 1;
+			Addresses++;
+		} else if (Point.Type == BREAK_CONDITION)
+			Conditions++;
+		else
+			for (uint32_t Page = Point.Start >> 8; Page <= (uint32_t) (Point.End >> 8); Page++)
+				Pages [Page] |= Point.Access;
+	}
+	
+	// Unhooked, the machine runs exactly as without a debugger
+	gb->cpu->Breaks = (Addresses || Conditions || Stepping) ? this : NULL;
+	gb->mmu->Watcher = this;
+}
+
+void Debugger::Suspend (uint8_t On) {
+	Suspended = On;
+	Update ();
+}
+
+// Running
+void Debugger::Continue () {
+	SkipOnce = HeldBefore;
+	HeldBefore = 0;
+	LastHit = 0;
+	gb->cpu->Debugging = 0;
+	Update ();
+}
+
+void Debugger::Step (uint32_t Count) {
+	Stepping = 1;
+	StepsLeft = Count;
+	Continue ();
+}
+
+void Debugger::Hold (const Breakpoint* Hit, const char* Reason) {
+	Stepping = 0;
+	LastHit = Hit ? Hit->ID : 0;
+	gb->cpu->Debugging = 1;
+	Update ();
+	
+	printf ("[DEBUG] %s\n", Reason);
+	PrintRegisters ();
+	if (gb->cpu->Trace) // What led here
+		gb->cpu->Trace->Dump ();
+}
+
+uint8_t Debugger::Instruction (uint16_t PC) {
+	if (Stepping) {
+		if (StepsLeft == 0) {
+			HeldBefore = 1;
+			Hold (NULL, "Step");
+			return 1;
+		}
+		StepsLeft--;
+	}
+	
+	if (SkipOnce) {
+		SkipOnce = 0;
+		return 0;
+	}
+	
+	char Reason [64];
+	if (PCTable [PC]) {
+		uint8_t Bank = gb->mmu->CurrentROMBank;
+		for (uint32_t i = 0; i < Points.size (); i++) {
+			Breakpoint &Point = Points [i];
+			if (Point.Type != BREAK_PC || Point.Start != PC || !Holds (Point.If))
+				continue;
+			if (Point.Bank >= 0 && PC >= 0x4000 && PC < 0x8000 && Point.Bank != Bank)
+				continue;
+			
+			Point.Hits++;
+			snprintf (Reason, sizeof (Reason), "Breakpoint %d", Point.ID);
+			HeldBefore = 1;
+			Hold (&Point, Reason);
+			return 1;
+		}
+	}
+	
+	if (Conditions)
+		for (uint32_t i = 0; i < Points.size (); i++) {
+			Breakpoint &Point = Points [i];
+			if (Point.Type != BREAK_CONDITION || !Holds (Point.If))
+				continue;
+			
+			Point.Hits++;
+			snprintf (Reason, sizeof (Reason), "Condition %d", Point.ID);
+			HeldBefore = 1;
+			Hold (&Point, Reason);
+			return 1;
+		}
+	
+	return 0;
+}
+
+void Debugger::Access (uint16_t Address, uint8_t Value, uint8_t Kind) {
+	if (gb->cpu->Debugging) // Already holding, only the first access counts
+		return;
+	
+	for (uint32_t i = 0; i < Points.size (); i++) {
+		Breakpoint &Point = Points [i];
+		if (Point.Type != BREAK_WATCH || !(Point.Access & Kind) || Address < Point.Start || Address > Point.End)
+			continue;
+		if ((Point.Value >= 0 && Point.Value != Value) || !Holds (Point.If))
+			continue;
+		
+		// The instruction finishes, the machine holds before the next one
+		Point.Hits++;
+		char Reason [64];
+		snprintf (Reason, sizeof (Reason), "Watchpoint %d: %s %02X at %04X", Point.ID, Kind == WATCH_READ ? "Read" : "Write", Value, Address);
+		HeldBefore = 0;
+		Hold (&Point, Reason);
+		return;
+	}
+}
+
+// Conditions
+uint16_t Debugger::Register (uint8_t ID) {
+	CPURegisters Registers = gb->cpu->GetRegisters ();
+	switch (ID) {
+		case REG_A: return Registers.AF >> 8;
+		case REG_F: return Registers.AF & 0xFF;
+		case REG_B: return Registers.BC >> 8;
+		case REG_C: return Registers.BC & 0xFF;
+		case REG_D: return Registers.DE >> 8;
+		case REG_E: return Registers.DE & 0xFF;
+		case REG_H: return Registers.HL >> 8;
+		case REG_L: return Registers.HL & 0xFF;
+		case REG_AF: return Registers.AF;
+		case REG_BC: return Registers.BC;
+		case REG_DE: return Registers.DE;
+		case REG_HL: return Registers.HL;
+		case REG_SP: return Registers.SP;
+		case REG_PC: return Registers.PC;
+		default: return 0;
+	}
+}
+
+uint8_t Debugger::Holds (const Condition &If) {
+	if (If.Register == REG_NONE)
+		return 1;
+	
+	uint16_t Value = Register (If.Register);
+	switch (If.Op) {
+		case OP_EQUAL: return Value == If.Value;
+		case OP_NOT_EQUAL: return Value != If.Value;
+		case OP_LESS: return Value < If.Value;
+		case OP_LESS_EQUAL: return Value <= If.Value;
+		case OP_GREATER: return Value > If.Value;
+		case OP_GREATER_EQUAL: return Value >= If.Value;
+		case OP_AND: return (Value & If.Value) != 0;
+		default: return 0;
+	}
+}
+
+uint8_t Debugger::ParseCondition (const char* Text, Condition &Out) {
+	char Name [4], Op [3];
+	unsigned int Value;
+	if (sscanf (Text, " %3[A-Za-z] %2[=!<>&] %x", Name, Op, &Value) != 3 || Value > 0xFFFF)
+		return 0;
+	
+	Out.Register = REG_NONE;
+	for (uint8_t i = REG_A; i <= REG_PC; i++)
+		if (strcasecmp (Name, RegisterNames [i]) == 0)
+			Out.Register = i;
+	
+	if (strcmp (Op, "==") == 0 || strcmp (Op, "=") == 0)
+		Out.Op = OP_EQUAL;
+	else if (strcmp (Op, "&") == 0)
+		Out.Op = OP_AND;
+	else {
+		Out.Op = 0xFF;
+		for (uint8_t i = OP_NOT_EQUAL; i <= OP_GREATER_EQUAL; i++)
+			if (strcmp (Op, OpNames [i]) == 0)
+				Out.Op = i;
+	}
+	
+	Out.Value = Value;
+	return Out.Register != REG_NONE && Out.Op != 0xFF;
+}
+
+// Console
+void Debugger::PrintRegisters () {
+	CPURegisters Registers = gb->cpu->GetRegisters ();
+	MMU* mmu = gb->mmu;
+	uint8_t F = Registers.AF & 0xFF;
+	uint16_t PC = Registers.PC;
+	uint8_t Bytes [3] = {mmu->PeekByteAt (PC), mmu->PeekByteAt (PC + 1), mmu->PeekByteAt (PC + 2)};
+	char Text [32];
+	Disassembler::Disassemble (Bytes, PC, Text, sizeof (Text));
+	
+	printf ("AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X PC=%02X:%04X [%c%c%c%c] IME=%d%s | %02X %02X %02X %s | Clock %u\n",
+		Registers.AF, Registers.BC, Registers.DE, Registers.HL, Registers.SP, (PC >= 0x4000 && PC < 0x8000) ? mmu->CurrentROMBank : 0, PC,
+		(F & 0x80) ? 'Z' : '-', (F & 0x40) ? 'N' : '-', (F & 0x20) ? 'H' : '-', (F & 0x10) ? 'C' : '-',
+		Registers.InterruptsEnabled, Registers.Halt ? " HALT" : "",
+		Bytes [0], Bytes [1], Bytes [2], Text, gb->cpu->ClockCount);
+}
+
+void Debugger::Describe (const Breakpoint &Point, char* Out, uint32_t Size) {
+	int Length;
+	if (Point.Type == BREAK_PC) {
+		if (Point.Bank >= 0)
+			Length = snprintf (Out, Size, "PC %02X:%04X", Point.Bank, Point.Start);
+		else
+			Length = snprintf (Out, Size, "PC %04X", Point.Start);
+	} else if (Point.Type == BREAK_CONDITION)
+		Length = snprintf (Out, Size, "Anywhere");
+	else {
+		const char* Kinds [] = {"", "Read", "Write", "Access"};
+		Length = snprintf (Out, Size, "%s %04X", Kinds [Point.Access & 3], Point.Start);
+		if (Point.End != Point.Start)
+			Length += snprintf (Out + Length, Size - Length, "-%04X", Point.End);
+		if (Point.Value >= 0)
+			Length += snprintf (Out + Length, Size - Length, " = %02X", Point.Value);
+	}
+	
+	if (Point.If.Register != REG_NONE)
+		Length += snprintf (Out + Length, Size - Length, " if %s %s %X", RegisterNames [Point.If.Register], Point.If.Op == OP_AND ? "&" : OpNames [Point.If.Op], Point.If.Value);
+	snprintf (Out + Length, Size - Length, " (%d hits)", Point.Hits);
+}
+
+static uint8_t ParseHex (const char* Text, uint32_t &Value, uint32_t Max) {
+	if (*Text == '$')
+		Text++;
+	char* End;
+	Value = strtoul (Text, &End, 16);
+	return End != Text && *End == 0 && Value <= Max;
+}
+
+uint8_t Debugger::Command (const char* Line) {
+	// Words before "if", the condition is the rest of the line
+	char Buffer [256];
+	snprintf (Buffer, sizeof (Buffer), "%s", Line);
+	char* Words [8];
+	uint32_t Count = 0;
+	const char* ConditionText = NULL;
+	for (char* Word = strtok (Buffer, " \t\r\n"); Word && Count < 8; Word = strtok (NULL, " \t\r\n")) {
+		if (strcmp (Word, "if") == 0) {
+			ConditionText = Line + (Word + 2 - Buffer);
+			break;
+		}
+		Words [Count++] = Word;
+	}
+	if (Count == 0)
+		return 1;
+	
+	Condition If;
+	if (ConditionText && !ParseCondition (ConditionText, If)) {
+		printf ("[DEBUG] Bad condition, e.g. \"A == 3F\", \"HL >= C000\", \"F & 80\"\n");
+		return 1;
+	}
+	
+	const char* Name = Words [0];
+	uint32_t Value;
+	if (strcmp (Name, "b") == 0 || strcmp (Name, "break") == 0) { // b [BANK:]ADDRESS [if COND], b if COND
+		if (Count == 1) {
+			if (!ConditionText) {
+				printf ("[DEBUG] b [BANK:]ADDRESS [if CONDITION], b if CONDITION\n");
+				return 1;
+			}
+			printf ("[DEBUG] Condition %d set\n", AddCondition (If));
+			return 1;
+		}
+		
+		int32_t Bank = -1;
+		char* Colon = strchr (Words [1], ':');
+		if (Colon) {
+			*Colon = 0;
+			if (!ParseHex (Words [1], Value, 0x1FF)) {
+				printf ("[DEBUG] Bad bank %s\n", Words [1]);
+				return 1;
+			}
+			Bank = Value;
+			Words [1] = Colon + 1;
+		}
+		if (!ParseHex (Words [1], Value, 0xFFFF)) {
+			printf ("[DEBUG] Bad address %s\n", Words [1]);
+			return 1;
+		}
+		printf ("[DEBUG] Breakpoint %d set\n", AddBreakpoint (Value, Bank, If));
+	} else if (strcmp (Name, "w") == 0 || strcmp (Name, "watch") == 0) { // w START[-END] [r|w|rw] [=VALUE] [if COND]
+		uint32_t Start, End;
+		char* Dash = Count > 1 ? strchr (Words [1], '-') : NULL;
+		if (Dash)
+			*Dash = 0;
+		if (Count < 2 || !ParseHex (Words [1], Start, 0xFFFF) || (Dash && !ParseHex (Dash + 1, End, 0xFFFF))) {
+			printf ("[DEBUG] w START[-END] [r|w|rw] [=VALUE] [if CONDITION]\n");
+			return 1;
+		}
+		if (!Dash)
+			End = Start;
+		
+		uint8_t Access = WATCH_WRITE;
+		int32_t Match = -1;
+		for (uint32_t i = 2; i < Count; i++) {
+			if (strcmp (Words [i], "r") == 0)
+				Access = WATCH_READ;
+			else if (strcmp (Words [i], "w") == 0)
+				Access = WATCH_WRITE;
+			else if (strcmp (Words [i], "rw") == 0)
+				Access = WATCH_READ | WATCH_WRITE;
+			else if (Words [i][0] == '=' && (Words [i][1] ? ParseHex (Words [i] + 1, Value, 0xFF) : (i + 1 < Count && ParseHex (Words [++i], Value, 0xFF))))
+				Match = Value;
+			else {
+				printf ("[DEBUG] Unknown watch option %s\n", Words [i]);
+				return 1;
+			}
+		}
+		printf ("[DEBUG] Watchpoint %d set\n", AddWatchpoint (Start, End, Access, Match, If));
+	} else if (strcmp (Name, "d") == 0 || strcmp (Name, "delete") == 0) { // d [ID]
+		if (Count == 1) {
+			Clear ();
+			printf ("[DEBUG] Everything deleted\n");
+		} else if (Remove (atoi (Words [1])))
+			printf ("[DEBUG] Deleted %s\n", Words [1]);
+		else
+			printf ("[DEBUG] No breakpoint %s\n", Words [1]);
+	} else if (strcmp (Name, "l") == 0 || strcmp (Name, "list") == 0) {
+		char Text [128];
+		for (uint32_t i = 0; i < Points.size (); i++) {
+			Describe (Points [i], Text, sizeof (Text));
+			printf ("[DEBUG] %3d %s\n", Points [i].ID, Text);
+		}
+		if (Points.empty ())
+			printf ("[DEBUG] Nothing set\n");
+	} else if (strcmp (Name, "c") == 0 || strcmp (Name, "continue") == 0)
+		Continue ();
+	else if (strcmp (Name, "s") == 0 || strcmp (Name, "step") == 0)
+		Step (Count > 1 ? atoi (Words [1]) : 1);
+	else if (strcmp (Name, "p") == 0 || strcmp (Name, "pause") == 0) {
+		HeldBefore = 1;
+		Hold (NULL, "Paused");
+	} else if (strcmp (Name, "r") == 0 || strcmp (Name, "registers") == 0)
+		PrintRegisters ();
+	else if (strcmp (Name, "x") == 0) { // x ADDRESS [LENGTH]
+		uint32_t Length = 0x10;
+		if (Count < 2 || !ParseHex (Words [1], Value, 0xFFFF) || (Count > 2 && !ParseHex (Words [2], Length, 0x10000))) {
+			printf ("[DEBUG] x ADDRESS [LENGTH]\n");
+			return 1;
+		}
+		for (uint32_t Offset = 0; Offset < Length; Offset += 16) {
+			printf ("%04X:", (Value + Offset) & 0xFFFF);
+			for (uint32_t i = Offset; i < Offset + 16 && i < Length; i++)
+				printf (" %02X", gb->mmu->PeekByteAt (Value + i));
+			printf ("\n");
+		}
+	} else if (strcmp (Name, "q") == 0 || strcmp (Name, "quit") == 0)
+		return 0;
+	else {
+		printf ("[DEBUG] Commands (numbers in hex):\n");
+		printf ("\tb [BANK:]ADDRESS [if COND]\tBreak before the instruction at ADDRESS (in ROM BANK)\n");
+		printf ("\tb if COND\t\t\tBreak before any instruction where COND holds, e.g. \"A == 3F\", \"HL >= C000\", \"F & 80\"\n");
+		printf ("\tw START[-END] [r|w|rw] [=VALUE] [if COND]\tBreak after reads / writes (default) in the range\n");
+		printf ("\td [ID]\t\t\t\tDelete one, or everything\n");
+		printf ("\tl\t\t\t\tList\n");
+		printf ("\tc\t\t\t\tContinue\n");
+		printf ("\ts [N]\t\t\t\tStep N instructions\n");
+		printf ("\tp\t\t\t\tPause\n");
+		printf ("\tr\t\t\t\tRegisters\n");
+		printf ("\tx ADDRESS [LENGTH]\t\tMemory, as the CPU sees it\n");
+		printf ("\tq\t\t\t\tQuit\n");
+	}
+	return 1;
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "GameBoy.h"
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+// Breakpoint kinds
+#define BREAK_PC 0 // Before the instruction at an address
+#define BREAK_CONDITION 1 // Before any instruction, when the condition holds
+#define BREAK_WATCH 2 // After the instruction that accessed the range
+
+// Condition registers and operators
+enum { REG_NONE, REG_A, REG_F, REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, REG_AF, REG_BC, REG_DE, REG_HL, REG_SP, REG_PC };
+enum { OP_EQUAL, OP_NOT_EQUAL, OP_LESS, OP_LESS_EQUAL, OP_GREATER, OP_GREATER_EQUAL, OP_AND };
+
+struct Condition {
+	uint8_t Register = REG_NONE; // REG_NONE - Always holds
+	uint8_t Op = OP_EQUAL;
+	uint16_t Value = 0;
+};
+
+struct Breakpoint {
+	uint32_t ID;
+	uint8_t Type; // BREAK_*
+	uint16_t Start; // Inclusive range, a single address for BREAK_PC
+	uint16_t End;
+	int16_t Bank; // ROM bank for 0x4000 - 0x7FFF, -1 - Any
+	uint8_t Access; // WATCH_*
+	int16_t Value; // Only watch accesses of this value, -1 - Any
+	Condition If;
+	uint32_t Hits;
+};
+
+/* Breakpoints and watchpoints on one machine. Nothing is checked while nothing is set: the CPU only asks
+   before an instruction while PC breakpoints, conditions or steps are pending, and the MMU only reports
+   accesses to the 256 byte pages a watchpoint covers. A hit sets cpu->Debugging, which holds the machine. */
+class Debugger {
+	public:
+		Debugger (GameBoy* _gb);
+		~Debugger (); // Detaches from the machine
+		uint32_t AddBreakpoint (uint16_t Address, int16_t Bank, Condition If); // Returns the ID
+		uint32_t AddCondition (Condition If);
+		uint32_t AddWatchpoint (uint16_t Start, uint16_t End, uint8_t Access, int16_t Value, Condition If);
+		uint8_t Remove (uint32_t ID); // 0 - No such ID
+		void Clear ();
+		void Continue (); // Release the machine, past a breakpoint at the current PC
+		void Step (uint32_t Count); // Run Count instructions, then hold again
+		uint8_t Command (const char* Line); // One console command, prints its result. 0 - Quit
+		void PrintRegisters ();
+		void Suspend (uint8_t On); // Off the real timeline (run-ahead): nothing is checked or counted
+		
+		static uint8_t ParseCondition (const char* Text, Condition &Out); // "A == 3F", "HL >= C000", "F & 80". 0 - Invalid
+		
+		// Hooks
+		uint8_t Instruction (uint16_t PC); // 1 - Hold before it
+		void Access (uint16_t Address, uint8_t Value, uint8_t Kind);
+		
+		uint32_t LastHit = 0; // ID of the breakpoint holding the machine, 0 - None / Step
+	private:
+		GameBoy* gb;
+		std::vector <Breakpoint> Points;
+		uint32_t NextID = 1;
+		uint8_t PCTable [0x10000]; // PC breakpoints per address
+		uint32_t Conditions = 0; // BREAK_CONDITION count
+		uint8_t Stepping = 0;
+		uint32_t StepsLeft = 0;
+		uint8_t HeldBefore = 0; // Held before an instruction, not after an access
+		uint8_t SkipOnce = 0; // Don't stop again before the instruction we held at
+		uint8_t Suspended = 0;
+		
+		uint32_t Add (Breakpoint Point);
+		void Update (); // PC table, watched pages and hooks, after any change
+		void Hold (const Breakpoint* Hit, const char* Reason);
+		uint8_t Holds (const Condition &If);
+		uint16_t Register (uint8_t ID);
+		void Describe (const Breakpoint &Point, char* Out, uint32_t Size);
+};
+
+#endif
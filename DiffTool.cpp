@@ -0,0 +1,463 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "GameBoy.h"
+#include "Movie.h"
+#include "Disassembler.h"
+
+/* Differential testing between two builds of the core. Every ROM is run by two worker processes,
+   `CORE -emit ...`, one per build, each streaming its state after every N instructions through a pipe;
+   they are compared in lockstep and the first divergence is reported with the instructions before it.
+   CORE is a gbdiff binary built from the variant to check (e.g. in a git worktree), this one by default. */
+
+using namespace std::chrono;
+
+#define DIFF_MAGIC 0x46444247 // "GBDF"
+#define DIFF_VERSION 1
+
+// Record flags
+#define DIFF_HASHED 0x01 // MemoryHash is set
+#define DIFF_IME 0x02
+#define DIFF_HALT 0x04
+#define DIFF_END 0x08 // Last record: stopped, out of clocks or the movie ended
+#define DIFF_DESYNC 0x10 // Movie input landed late, the run isn't the recorded one anymore
+
+struct DiffHeader {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t RecordSize;
+	uint32_t ROMID;
+	uint32_t Every;
+	uint32_t HashEvery;
+	uint32_t MaxClocks;
+};
+
+// State after a step
+struct DiffRecord {
+	uint64_t Step; // GameBoy::Step calls so far
+	uint64_t MemoryHash; // FNV-1a of 0x8000 - 0xFFFF as the CPU sees it
+	uint32_t Clock;
+	uint16_t AF, BC, DE, HL, SP, PC;
+	uint8_t Memory [3]; // Next instruction
+	uint8_t Flags; // DIFF_*
+};
+
+struct DiffOptions {
+	uint32_t Every = 1;
+	uint32_t HashEvery = 1024;
+	uint32_t MaxClocks = 4194304 * 10; // 10 emulated seconds
+	const char* MovieFilename = NULL;
+	uint32_t Context = 8;
+};
+
+// Results
+#define DIFF_SAME 0
+#define DIFF_DIVERGED 1
+#define DIFF_BROKEN 2 // A worker didn't start or died
+
+const char* ResultNames [] = {"SAME", "DIVERGED", "ERROR"};
+
+struct DiffTest {
+	std::string ROM;
+	uint8_t Result;
+	uint64_t Steps;
+	uint32_t Clocks;
+	double WallTime; // ms
+	std::string Report;
+};
+
+uint64_t HashMemory (MMU* mmu) {
+	uint64_t Hash = 0xCBF29CE484222325;
+	for (uint32_t Address = 0x8000; Address <= 0xFFFF; Address++) {
+		Hash ^= mmu->PeekByteAt (Address);
+		Hash *= 0x100000001B3;
+	}
+	return Hash;
+}
+
+// Worker: run the ROM, records go to stdout and everything printed goes to stderr
+int Emit (const char* ROM, const DiffOptions &Options) {
+	FILE* Output = fdopen (dup (STDOUT_FILENO), "wb");
+	dup2 (STDERR_FILENO, STDOUT_FILENO);
+	
+	GameBoy* gb = new GameBoy (48000);
+	if (!gb->LoadROM (ROM)) {
+		fprintf (stderr, "[ERR] Can't load %s\n", ROM);
+		return 1;
+	}
+	CPU* cpu = gb->cpu;
+	MMU* mmu = gb->mmu;
+	mmu->EchoSerial = 0;
+	gb->apu->Muted = 1;
+	
+	Movie* InputMovie = NULL;
+	if (Options.MovieFilename) {
+		InputMovie = new Movie (Options.MovieFilename, MOVIE_PLAY, gb, 0);
+		if (!InputMovie->Valid)
+			return 1;
+	}
+	
+	DiffHeader Header;
+	memset (&Header, 0, sizeof (Header));
+	Header.Magic = DIFF_MAGIC;
+	Header.Version = DIFF_VERSION;
+	Header.RecordSize = sizeof (DiffRecord);
+	Header.ROMID = gb->ROMID ();
+	Header.Every = Options.Every;
+	Header.HashEvery = Options.HashEvery;
+	Header.MaxClocks = Options.MaxClocks;
+	fwrite (&Header, sizeof (Header), 1, Output);
+	
+	uint64_t Steps = 0;
+	uint32_t LastFlushClock = 0;
+	uint32_t LastFrameCount = gb->ppu->FrameCount;
+	uint8_t End = 0;
+	while (!End) {
+		uint8_t Buttons;
+		if (InputMovie && InputMovie->Poll (Buttons))
+			mmu->SetJoypad (Buttons);
+		
+		uint32_t Before = cpu->ClockCount;
+		gb->Step ();
+		Steps++;
+		End = cpu->ClockCount == Before || cpu->ClockCount >= Options.MaxClocks;
+		
+		if (InputMovie && gb->ppu->FrameCount != LastFrameCount) { // Checks the hashes, and moves past them to the next input
+			LastFrameCount = gb->ppu->FrameCount;
+			InputMovie->FrameDone ();
+			if (InputMovie->Finished)
+				End = 1;
+		}
+		
+		if (cpu->ClockCount - LastFlushClock >= 8192) {
+			LastFlushClock = cpu->ClockCount;
+			gb->apu->Flush (cpu->ClockCount);
+		}
+		
+		if (Steps % Options.Every && !End)
+			continue;
+		
+		CPURegisters Registers = cpu->GetRegisters ();
+		DiffRecord Record;
+		Record.Step = Steps;
+		Record.Clock = cpu->ClockCount;
+		Record.AF = Registers.AF;
+		Record.BC = Registers.BC;
+		Record.DE = Registers.DE;
+		Record.HL = Registers.HL;
+		Record.SP = Registers.SP;
+		Record.PC = Registers.PC;
+		for (int i = 0; i < 3; i++)
+			Record.Memory [i] = mmu->PeekByteAt (Registers.PC + i);
+		Record.Flags = (Registers.InterruptsEnabled ? DIFF_IME : 0) | (Registers.Halt ? DIFF_HALT : 0) | (End ? DIFF_END : 0);
+		if (InputMovie && InputMovie->Desyncs)
+			Record.Flags |= DIFF_DESYNC;
+		Record.MemoryHash = 0;
+		if (Steps % Options.HashEvery == 0 || End) {
+			Record.MemoryHash = HashMemory (mmu);
+			Record.Flags |= DIFF_HASHED;
+		}
+		if (fwrite (&Record, sizeof (Record), 1, Output) != 1) // The driver has what it needs
+			break;
+	}
+	
+	fclose (Output);
+	uint8_t Desynced = InputMovie && InputMovie->Desyncs;
+	if (Desynced)
+		fprintf (stderr, "[ERR] %s: %d movie inputs out of sync\n", ROM, InputMovie->Desyncs);
+	delete InputMovie;
+	delete gb;
+	return Desynced;
+}
+
+// Driver side of one worker
+struct Worker {
+	pid_t Process = -1;
+	FILE* Input = NULL;
+	
+	uint8_t Start (const char* Core, const char* ROM, const DiffOptions &Options) {
+		int Pipe [2];
+		if (pipe2 (Pipe, O_CLOEXEC) != 0) // Not inherited by the workers of other ROMs, so EOF / EPIPE still arrive
+			return 0;
+		
+		std::string Every = std::to_string (Options.Every);
+		std::string HashEvery = std::to_string (Options.HashEvery);
+		std::string Clocks = std::to_string (Options.MaxClocks);
+		std::vector <const char*> Arguments = {Core, "-emit", "-every", Every.c_str (), "-hashevery", HashEvery.c_str (), "-clocks", Clocks.c_str ()};
+		if (Options.MovieFilename) {
+			Arguments.push_back ("-movie");
+			Arguments.push_back (Options.MovieFilename);
+		}
+		Arguments.push_back (ROM);
+		Arguments.push_back (NULL);
+		
+		Process = fork ();
+		if (Process == 0) {
+			dup2 (Pipe [1], STDOUT_FILENO);
+			close (Pipe [0]);
+			close (Pipe [1]);
+			execv (Core, (char* const*) Arguments.data ());
+			_exit (127);
+		}
+		close (Pipe [1]);
+		if (Process < 0) {
+			close (Pipe [0]);
+			return 0;
+		}
+		Input = fdopen (Pipe [0], "rb");
+		return 1;
+	}
+	
+	void Stop () {
+		if (Input)
+			fclose (Input); // A worker still running gets EPIPE / SIGPIPE
+		if (Process > 0)
+			waitpid (Process, NULL, 0);
+		Input = NULL;
+		Process = -1;
+	}
+};
+
+void Describe (const DiffRecord &Record, char* Out, uint32_t Size) {
+	char Text [32];
+	Disassembler::Disassemble (Record.Memory, Record.PC, Text, sizeof (Text));
+	uint8_t F = Record.AF & 0xFF;
+	int Length = snprintf (Out, Size, "%10llu %10u AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X PC=%04X [%c%c%c%c] IME=%d%s | %-18s",
+		(unsigned long long) Record.Step, Record.Clock, Record.AF, Record.BC, Record.DE, Record.HL, Record.SP, Record.PC,
+		(F & 0x80) ? 'Z' : '-', (F & 0x40) ? 'N' : '-', (F & 0x20) ? 'H' : '-', (F & 0x10) ? 'C' : '-',
+		(Record.Flags & DIFF_IME) ? 1 : 0, (Record.Flags & DIFF_HALT) ? " HALT" : "     ", Text);
+	if ((Record.Flags & DIFF_HASHED) && Length > 0 && (uint32_t) Length < Size)
+		snprintf (Out + Length, Size - Length, " mem %016llX", (unsigned long long) Record.MemoryHash);
+}
+
+// Fields that differ, "" - None
+std::string Differences (const DiffRecord &A, const DiffRecord &B) {
+	std::string Out;
+	if (A.Step != B.Step) Out += "Step ";
+	if (A.Clock != B.Clock) Out += "ClockCount ";
+	if ((A.AF >> 8) != (B.AF >> 8)) Out += "A ";
+	if ((A.AF & 0xF0) != (B.AF & 0xF0)) Out += "F ";
+	if (A.BC != B.BC) Out += "BC ";
+	if (A.DE != B.DE) Out += "DE ";
+	if (A.HL != B.HL) Out += "HL ";
+	if (A.SP != B.SP) Out += "SP ";
+	if (A.PC != B.PC) Out += "PC ";
+	if ((A.Flags & DIFF_IME) != (B.Flags & DIFF_IME)) Out += "IME ";
+	if ((A.Flags & DIFF_HALT) != (B.Flags & DIFF_HALT)) Out += "HALT ";
+	if (memcmp (A.Memory, B.Memory, 3)) Out += "Code ";
+	if ((A.Flags & DIFF_HASHED) && (B.Flags & DIFF_HASHED) && A.MemoryHash != B.MemoryHash) Out += "Memory ";
+	if ((A.Flags & DIFF_END) != (B.Flags & DIFF_END)) Out += "End ";
+	return Out;
+}
+
+void Run (DiffTest &T, const char* CoreA, const char* CoreB, const DiffOptions &Options) {
+	auto StartTime = high_resolution_clock::now ();
+	T.Result = DIFF_SAME;
+	T.Steps = 0;
+	T.Clocks = 0;
+	
+	Worker A, B;
+	DiffHeader HeaderA, HeaderB;
+	if (!A.Start (CoreA, T.ROM.c_str (), Options) || !B.Start (CoreB, T.ROM.c_str (), Options) ||
+		fread (&HeaderA, sizeof (HeaderA), 1, A.Input) != 1 || fread (&HeaderB, sizeof (HeaderB), 1, B.Input) != 1 ||
+		HeaderA.Magic != DIFF_MAGIC || HeaderB.Magic != DIFF_MAGIC || memcmp (&HeaderA, &HeaderB, sizeof (HeaderA)) != 0) {
+		T.Result = DIFF_BROKEN;
+		T.Report = "Workers didn't start, or don't speak the same version\n";
+		A.Stop ();
+		B.Stop ();
+		T.WallTime = duration_cast <microseconds> (high_resolution_clock::now () - StartTime).count () / 1000.0;
+		return;
+	}
+	
+	// Context: the last matching records, oldest first once full
+	std::vector <DiffRecord> History (Options.Context ? Options.Context : 1);
+	uint32_t Kept = 0;
+	
+	DiffRecord RecordA, RecordB;
+	while (1) {
+		size_t ReadA = fread (&RecordA, sizeof (RecordA), 1, A.Input);
+		size_t ReadB = fread (&RecordB, sizeof (RecordB), 1, B.Input);
+		if (ReadA != 1 || ReadB != 1) {
+			if (ReadA != ReadB || !(RecordA.Flags & DIFF_END)) {
+				T.Result = DIFF_BROKEN;
+				T.Report = std::string ("Core ") + (ReadA != 1 ? "A" : "B") + " ended early (crashed?)\n";
+			}
+			break;
+		}
+		
+		if ((RecordA.Flags | RecordB.Flags) & DIFF_DESYNC) {
+			T.Result = DIFF_BROKEN;
+			T.Report = std::string ("Movie input out of sync in core ") + ((RecordA.Flags & DIFF_DESYNC) ? "A" : "B") + " at instruction " + std::to_string (RecordA.Step) + "\n";
+			break;
+		}
+		
+		std::string Fields = Differences (RecordA, RecordB);
+		if (!Fields.empty ()) {
+			T.Result = DIFF_DIVERGED;
+			char Line [256];
+			Fields.pop_back ();
+			T.Report = "First divergence: " + Fields + "\n";
+			uint32_t Count = std::min (Kept, (uint32_t) History.size ());
+			for (uint32_t i = 0; i < Count; i++) {
+				Describe (History [(Kept - Count + i) % History.size ()], Line, sizeof (Line));
+				T.Report += std::string ("     ") + Line + "\n";
+			}
+			Describe (RecordA, Line, sizeof (Line));
+			T.Report += std::string ("  A  ") + Line + "\n";
+			Describe (RecordB, Line, sizeof (Line));
+			T.Report += std::string ("  B  ") + Line + "\n";
+			break;
+		}
+		
+		History [Kept++ % History.size ()] = RecordA;
+		T.Steps = RecordA.Step;
+		T.Clocks = RecordA.Clock;
+		if (RecordA.Flags & DIFF_END)
+			break;
+	}
+	
+	A.Stop ();
+	B.Stop ();
+	T.WallTime = duration_cast <microseconds> (high_resolution_clock::now () - StartTime).count () / 1000.0;
+}
+
+void AddROMs (std::vector <std::string> &ROMs, const std::string &Path) {
+	DIR* Directory = opendir (Path.c_str ());
+	if (Directory == NULL) {
+		ROMs.push_back (Path);
+		return;
+	}
+	
+	std::vector <std::string> Found;
+	while (dirent* Entry = readdir (Directory)) {
+		const char* Extension = strrchr (Entry->d_name, '.');
+		if (Extension && (strcmp (Extension, ".gb") == 0 || strcmp (Extension, ".gbc") == 0))
+			Found.push_back (Path + "/" + Entry->d_name);
+	}
+	closedir (Directory);
+	std::sort (Found.begin (), Found.end ());
+	ROMs.insert (ROMs.end (), Found.begin (), Found.end ());
+}
+
+int main (int argc, char** argv) {
+	DiffOptions Options;
+	const char* CoreA = NULL;
+	const char* CoreB = NULL;
+	uint32_t Threads = std::thread::hardware_concurrency ();
+	uint8_t EmitMode = 0;
+	std::vector <std::string> ROMs;
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "-a") == 0 && i + 1 < argc)
+			CoreA = argv[++i];
+		else if (strcmp (argv[i], "-b") == 0 && i + 1 < argc)
+			CoreB = argv[++i];
+		else if (strcmp (argv[i], "-every") == 0 && i + 1 < argc)
+			Options.Every = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-hashevery") == 0 && i + 1 < argc)
+			Options.HashEvery = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-clocks") == 0 && i + 1 < argc)
+			Options.MaxClocks = strtoul (argv[++i], NULL, 10);
+		else if (strcmp (argv[i], "-movie") == 0 && i + 1 < argc)
+			Options.MovieFilename = argv[++i];
+		else if (strcmp (argv[i], "-context") == 0 && i + 1 < argc)
+			Options.Context = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-threads") == 0 && i + 1 < argc)
+			Threads = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-emit") == 0)
+			EmitMode = 1;
+		else if (argv[i][0] == '-') {
+			printf ("Usage: %s [-a CORE] [-b CORE] [-every N] [-hashevery N] [-clocks N] [-movie FILE] [-context N] [-threads N] [ROM|DIR...]\n", argv[0]);
+			printf ("\t-a / -b CORE\tgbdiff binaries built from the cores to compare (Default: this one)\n");
+			printf ("\t-every N\tCompare registers and ClockCount every N instructions (Default 1)\n");
+			printf ("\t-hashevery N\tCompare memory every N instructions (Default 1024, a multiple of -every)\n");
+			printf ("\t-clocks N\tStop each ROM after N clocks (Default 10 emulated seconds)\n");
+			printf ("\t-movie FILE\tJoypad input for every ROM\n");
+			printf ("\t-context N\tInstructions shown before a divergence (Default 8)\n");
+			return 1;
+		} else
+			AddROMs (ROMs, argv[i]);
+	}
+	if (Options.Every < 1)
+		Options.Every = 1;
+	if (Options.HashEvery < Options.Every)
+		Options.HashEvery = Options.Every;
+	Options.HashEvery -= Options.HashEvery % Options.Every; // Only emitted records are hashed
+	
+	if (EmitMode) {
+		if (ROMs.size () != 1) {
+			fprintf (stderr, "[ERR] -emit takes one ROM\n");
+			return 1;
+		}
+		return Emit (ROMs [0].c_str (), Options);
+	}
+	
+	// Both default to this binary: the core against itself, which only checks it's deterministic
+	std::string Self = "/proc/self/exe";
+	char Path [4096];
+	ssize_t Length = readlink ("/proc/self/exe", Path, sizeof (Path) - 1);
+	if (Length > 0) {
+		Path [Length] = 0;
+		Self = Path;
+	}
+	if (CoreA == NULL)
+		CoreA = Self.c_str ();
+	if (CoreB == NULL)
+		CoreB = Self.c_str ();
+	
+	if (ROMs.empty ()) { // The bundled ones
+		ROMs.push_back ("TestROMs/cpu_instrs.gb");
+		ROMs.push_back ("TestROMs/bgbtest.gb");
+		AddROMs (ROMs, "TestROMs/individual");
+	}
+	
+	std::vector <DiffTest> Tests (ROMs.size ());
+	for (uint32_t i = 0; i < ROMs.size (); i++)
+		Tests [i].ROM = ROMs [i];
+	
+	if (Threads < 1)
+		Threads = 1;
+	if (Threads > Tests.size ())
+		Threads = Tests.size ();
+	
+	signal (SIGPIPE, SIG_IGN);
+	auto StartTime = high_resolution_clock::now ();
+	std::atomic <uint32_t> Next {0};
+	std::vector <std::thread> Workers;
+	for (uint32_t i = 0; i < Threads; i++)
+		Workers.push_back (std::thread ([&] () {
+			uint32_t Index;
+			while ((Index = Next++) < Tests.size ())
+				Run (Tests [Index], CoreA, CoreB, Options);
+		}));
+	for (uint32_t i = 0; i < Workers.size (); i++)
+		Workers [i].join ();
+	double WallTime = duration_cast <microseconds> (high_resolution_clock::now () - StartTime).count () / 1000.0;
+	
+	printf ("A: %s\nB: %s\n", CoreA, CoreB);
+	uint32_t Same = 0;
+	printf ("%-44s %-8s %14s %12s %10s\n", "ROM", "Result", "Instructions", "Emulated s", "Wall ms");
+	for (uint32_t i = 0; i < Tests.size (); i++) {
+		DiffTest &T = Tests [i];
+		printf ("%-44s %-8s %14llu %12.2f %10.1f\n", T.ROM.c_str (), ResultNames [T.Result], (unsigned long long) T.Steps, T.Clocks / 4194304.0, T.WallTime);
+		if (T.Result == DIFF_SAME)
+			Same++;
+		else
+			printf ("%s", T.Report.c_str ());
+	}
+	printf ("%d / %d identical, %.1f ms on %d threads\n", Same, (uint32_t) Tests.size (), WallTime, Threads);
+	
+	return Same == Tests.size () ? 0 : 1;
+}
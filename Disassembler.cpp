@@ -0,0 +1,85 @@
+#include "Disassembler.h"
+#include <string.h>
+
+/* Operands: #8 - Byte, #16 - Word, #s8 - Signed byte, @r - Relative jump target.
+   0x40 - 0xBF and the CB table follow a pattern and are built from it */
+static const char* Low [0x40] = {
+	"NOP", "LD BC,#16", "LD (BC),A", "INC BC", "INC B", "DEC B", "LD B,#8", "RLCA", "LD (#16),SP", "ADD HL,BC", "LD A,(BC)", "DEC BC", "INC C", "DEC C", "LD C,#8", "RRCA",
+	"STOP", "LD DE,#16", "LD (DE),A", "INC DE", "INC D", "DEC D", "LD D,#8", "RLA", "JR @r", "ADD HL,DE", "LD A,(DE)", "DEC DE", "INC E", "DEC E", "LD E,#8", "RRA",
+	"JR NZ,@r", "LD HL,#16", "LD (HL+),A", "INC HL", "INC H", "DEC H", "LD H,#8", "DAA", "JR Z,@r", "ADD HL,HL", "LD A,(HL+)", "DEC HL", "INC L", "DEC L", "LD L,#8", "CPL",
+	"JR NC,@r", "LD SP,#16", "LD (HL-),A", "INC SP", "INC (HL)", "DEC (HL)", "LD (HL),#8", "SCF", "JR C,@r", "ADD HL,SP", "LD A,(HL-)", "DEC SP", "INC A", "DEC A", "LD A,#8", "CCF"
+};
+
+static const char* High [0x40] = {
+	"RET NZ", "POP BC", "JP NZ,#16", "JP #16", "CALL NZ,#16", "PUSH BC", "ADD A,#8", "RST 00", "RET Z", "RET", "JP Z,#16", "PREFIX CB", "CALL Z,#16", "CALL #16", "ADC A,#8", "RST 08",
+	"RET NC", "POP DE", "JP NC,#16", "DB $D3", "CALL NC,#16", "PUSH DE", "SUB #8", "RST 10", "RET C", "RETI", "JP C,#16", "DB $DB", "CALL C,#16", "DB $DD", "SBC A,#8", "RST 18",
+	"LDH ($FF00+#8),A", "POP HL", "LD ($FF00+C),A", "DB $E3", "DB $E4", "PUSH HL", "AND #8", "RST 20", "ADD SP,#s8", "JP HL", "LD (#16),A", "DB $EB", "DB $EC", "DB $ED", "XOR #8", "RST 28",
+	"LDH A,($FF00+#8)", "POP AF", "LD A,($FF00+C)", "DI", "DB $F4", "PUSH AF", "OR #8", "RST 30", "LD HL,SP+#s8", "LD SP,HL", "LD A,(#16)", "EI", "DB $FC", "DB $FD", "CP #8", "RST 38"
+};
+
+static const char* Registers [8] = {"B", "C", "D", "E", "H", "L", "(HL)", "A"};
+static const char* Arithmetic [8] = {"ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP "};
+static const char* Shifts [8] = {"RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL"};
+static const char* Bits [4] = {"", "BIT", "RES", "SET"};
+
+uint8_t Disassembler::Length (uint8_t Opcode) {
+	if (Opcode == 0xCB)
+		return 2;
+	if (Opcode >= 0x40 && Opcode < 0xC0)
+		return 1;
+	const char* Text = Opcode < 0x40 ? Low [Opcode] : High [Opcode - 0xC0];
+	if (strstr (Text, "#16"))
+		return 3;
+	if (strchr (Text, '#') || strchr (Text, '@'))
+		return 2;
+	return 1;
+}
+
+uint8_t Disassembler::Disassemble (const uint8_t* Bytes, uint16_t PC, char* Out, uint32_t Size) {
+	uint8_t Opcode = Bytes [0];
+	
+	if (Opcode == 0xCB) {
+		uint8_t Op = Bytes [1];
+		if (Op < 0x40)
+			snprintf (Out, Size, "%s %s", Shifts [Op >> 3], Registers [Op & 7]);
+		else
+			snprintf (Out, Size, "%s %d,%s", Bits [Op >> 6], (Op >> 3) & 7, Registers [Op & 7]);
+		return 2;
+	}
+	
+	if (Opcode == 0x76) {
+		snprintf (Out, Size, "HALT");
+		return 1;
+	}
+	if (Opcode >= 0x40 && Opcode < 0x80) {
+		snprintf (Out, Size, "LD %s,%s", Registers [(Opcode >> 3) & 7], Registers [Opcode & 7]);
+		return 1;
+	}
+	if (Opcode >= 0x80 && Opcode < 0xC0) {
+		snprintf (Out, Size, "%s%s", Arithmetic [(Opcode >> 3) & 7], Registers [Opcode & 7]);
+		return 1;
+	}
+	
+	// Copy the template, filling in the operand
+	const char* Text = Opcode < 0x40 ? Low [Opcode] : High [Opcode - 0xC0];
+	uint32_t Length = 0;
+	while (*Text && Length + 8 < Size) {
+		if (strncmp (Text, "#16", 3) == 0) {
+			Length += snprintf (Out + Length, Size - Length, "$%04X", Bytes [1] | (Bytes [2] << 8));
+			Text += 3;
+		} else if (strncmp (Text, "#s8", 3) == 0) {
+			int8_t Offset = Bytes [1];
+			Length += snprintf (Out + Length, Size - Length, "%c$%02X", Offset < 0 ? '-' : '+', Offset < 0 ? -Offset : Offset);
+			Text += 3;
+		} else if (strncmp (Text, "#8", 2) == 0) {
+			Length += snprintf (Out + Length, Size - Length, "$%02X", Bytes [1]);
+			Text += 2;
+		} else if (strncmp (Text, "@r", 2) == 0) {
+			Length += snprintf (Out + Length, Size - Length, "$%04X", (uint16_t) (PC + 2 + (int8_t) Bytes [1]));
+			Text += 2;
+		} else
+			Out [Length++] = *Text++;
+	}
+	Out [Length] = 0;
+	return Disassembler::Length (Opcode);
+}
@@ -0,0 +1,13 @@
+#include <stdint.h>
+#include <stdio.h>
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+/* SM83 mnemonics, for the debugger and the trace tool. Bytes are the instruction and up to 2 bytes
+   after it, PC is where it is, for relative jumps. Returns its length. */
+namespace Disassembler {
+	uint8_t Disassemble (const uint8_t* Bytes, uint16_t PC, char* Out, uint32_t Size);
+	uint8_t Length (uint8_t Opcode);
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "FrameSync.h"
+
+static uint64_t MonotonicNow () {
+	struct timespec Now;
+	clock_gettime (CLOCK_MONOTONIC, &Now);
+	return (uint64_t) Now.tv_sec * 1000000000 + Now.tv_nsec;
+}
+
+FrameSync::FrameSync (uint8_t _Mode, APU* _apu, uint32_t _TargetQueue) {
+	Mode = _Mode;
+	apu = _apu;
+	TargetQueue = _TargetQueue ? _TargetQueue : 1;
+	
+	if (Mode == SYNC_AUDIO && apu == NULL)
+		Mode = SYNC_VIDEO;
+	
+	Reset ();
+}
+
+void FrameSync::Reset () {
+	Deadline = MonotonicNow ();
+	LastFrameTime = 0;
+	AverageQueue = TargetQueue;
+	Rate = APU_CLOCK_RATE;
+	
+	if (Mode == SYNC_AUDIO)
+		apu->SetClockRate (Rate);
+}
+
+void FrameSync::SleepUntil (uint64_t Time) {
+	struct timespec Wakeup = {(time_t) (Time / 1000000000), (long) (Time % 1000000000)};
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &Wakeup, NULL) != 0) {} // Interrupted, same deadline
+	
+	uint64_t Overshoot = MonotonicNow () - Time;
+	PROFILE_OVERSHOOT (Overshoot);
+	OvershootTotal += Overshoot;
+	if (Overshoot > OvershootMax)
+		OvershootMax = Overshoot;
+	Sleeps++;
+}
+
+void FrameSync::Frame (uint8_t Slowdown) {
+	if (Mode == SYNC_NONE)
+		return;
+	
+	PROFILE_SCOPE (PROF_SLEEP);
+	uint64_t Period = (uint64_t) SYNC_FRAME_NS * (Slowdown ? Slowdown : 1);
+	uint64_t Now = MonotonicNow ();
+	
+	if (Slowdown == 0 || Slowdown != LastSlowdown) { // Fast forward, or speed changed: start over from here
+		Deadline = Now;
+		LastFrameTime = 0;
+		LastSlowdown = Slowdown;
+		if (Slowdown == 0)
+			return;
+	}
+	
+	if (Mode == SYNC_AUDIO && Slowdown == 1) {
+		uint32_t Queued = apu->Output.Available ();
+		
+		// Steer the average queue depth to the target with the resampling ratio, so sleeping alone never drifts
+		AverageQueue += (Queued - AverageQueue) * 0.05;
+		double Error = (AverageQueue - TargetQueue) / TargetQueue;
+		if (Error > 1)
+			Error = 1;
+		else if (Error < -1)
+			Error = -1;
+		Rate = APU_CLOCK_RATE * (1 + SYNC_MAX_RATE_CHANGE * Error); // Queue too deep: fewer samples per clock
+		apu->SetClockRate (Rate);
+		
+		if (Queued > TargetQueue) { // Ahead of the device, wait until it played the excess
+			uint64_t Wait = (uint64_t) (Queued - TargetQueue) * 1000000000 / apu->SampleRate;
+			if (Wait > Period * 2) // Device stalled, don't freeze with it
+				Wait = Period * 2;
+			SleepUntil (Now + Wait);
+		} else if (Queued < TargetQueue / 2) // Close to an underrun
+			LateFrames++;
+	} else { // Video pacing, also used for slow motion with audio
+		Deadline += Period;
+		
+		if (Deadline > Now)
+			SleepUntil (Deadline);
+		else {
+			LateFrames++;
+			if (Now - Deadline > Period * 4) { // Can't catch up, drop the backlog
+				Deadline = Now;
+				Resyncs++;
+			}
+		}
+	}
+	
+	uint64_t FrameTime = MonotonicNow ();
+	if (LastFrameTime) {
+		double Deviation = (double) (FrameTime - LastFrameTime) - Period;
+		JitterSquares += Deviation * Deviation;
+		JitterSamples++;
+	}
+	LastFrameTime = FrameTime;
+	Frames++;
+}
+
+void FrameSync::Report () {
+	if (Mode == SYNC_NONE || Frames == 0)
+		return;
+	
+	printf ("[INFO] Sync (%s): %d frames, %d sleeps, jitter %.3f ms RMS, overshoot %.3f ms avg / %.3f ms max, %d late, %d resyncs",
+		Mode == SYNC_AUDIO ? "audio" : "video", Frames, Sleeps,
+		JitterSamples ? sqrt (JitterSquares / JitterSamples) / 1000000 : 0.0,
+		Sleeps ? (double) OvershootTotal / Sleeps / 1000000 : 0.0, (double) OvershootMax / 1000000,
+		LateFrames, Resyncs);
+	
+	if (Mode == SYNC_AUDIO)
+		printf (", queue %.0f / %d, rate %+.3f%%", AverageQueue, TargetQueue, (Rate / APU_CLOCK_RATE - 1) * 100);
+	printf ("\n");
+	
+	Frames = Sleeps = LateFrames = Resyncs = 0;
+	OvershootTotal = OvershootMax = 0;
+	JitterSquares = 0;
+	JitterSamples = 0;
+}
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include "APU.h"
+#include "Profiler.h"
+#ifndef FRAMESYNC_H
+#define FRAMESYNC_H
+
+// Modes
+#define SYNC_NONE 0 // Run as fast as possible
+#define SYNC_VIDEO 1 // Sleep to an absolute deadline once per frame
+#define SYNC_AUDIO 2 // Sleep while the audio queue is above its target, resample slightly to stay there
+
+#define SYNC_FRAME_CLOCKS 70224
+#define SYNC_FRAME_NS 16742706 // SYNC_FRAME_CLOCKS / 4194304 Hz
+#define SYNC_MAX_RATE_CHANGE 0.005 // Resampling stays within +-0.5%, not audible
+
+/* Paces emulation once per emulated frame (70224 clocks), replacing sleeps every few ms.
+   Statistics are kept between reports. */
+class FrameSync {
+	public:
+		FrameSync (uint8_t _Mode, APU* _apu, uint32_t _TargetQueue);
+		void Reset ();
+		void Frame (uint8_t Slowdown); // 0 - Unthrottled, 1 - Normal, N - N times slower
+		void Report ();
+		
+		uint8_t Mode;
+		
+		// Statistics since last Report
+		uint32_t Frames = 0;
+		uint32_t Sleeps = 0;
+		uint32_t LateFrames = 0; // Deadline already passed
+		uint32_t Resyncs = 0; // Too far behind, gave up catching up
+		uint64_t OvershootTotal = 0; // ns slept past the requested wakeup
+		uint64_t OvershootMax = 0;
+		double JitterSquares = 0; // Frame interval - nominal, ns^2
+		uint32_t JitterSamples = 0;
+	private:
+		APU* apu;
+		uint32_t TargetQueue; // Audio frames
+		double AverageQueue;
+		double Rate;
+		uint64_t Deadline = 0; // Video mode, CLOCK_MONOTONIC ns
+		uint64_t LastFrameTime = 0;
+		uint8_t LastSlowdown = 1;
+		
+		void SleepUntil (uint64_t Time);
+};
+
+#endif
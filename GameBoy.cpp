@@ -0,0 +1,205 @@
+#include "GameBoy.h"
+
+using namespace Utils;
+
+GameBoy::GameBoy (uint32_t SampleRate, GameBoy* Source) {
+	apu = new APU (SampleRate);
+	timer = new Timer (&Events);
+	mmu = new MMU (Source ? Source->mmu : NULL);
+	mmu->apu = apu;
+	mmu->timer = timer;
+	ppu = new PPU (&Events);
+	mmu->ppu = ppu;
+	cpu = new CPU (mmu); // Turns the LCD on
+}
+
+GameBoy::~GameBoy () {
+	delete cpu;
+	delete mmu;
+	delete ppu;
+	delete apu;
+	delete timer;
+}
+
+uint8_t GameBoy::LoadROM (const char* Filename) {
+	FILE* ROMfd = fopen (Filename, "rb");
+	if (ROMfd == NULL)
+		return 0;
+	
+	size_t Size = fread (mmu->ROM, 1, MMU_ROM_SIZE, ROMfd);
+	fclose (ROMfd);
+	if (Size < 0x150) // No header
+		return 0;
+	
+	mmu->ParseHeader ();
+	return 1;
+}
+
+uint8_t GameBoy::LoadROM (const uint8_t* Data, uint32_t Size) {
+	if (Size < 0x150 || Size > MMU_ROM_SIZE) // No header, or too big for any MBC
+		return 0;
+	
+	memcpy (mmu->ROM, Data, Size);
+	mmu->ParseHeader ();
+	return 1;
+}
+
+void GameBoy::Reset () {
+	apu->Reset ();
+	mmu->Reset ();
+	Events.Reset (0);
+	timer->Reset (0);
+	ppu->Reset ();
+	cpu->Reset (); // Writes the boot I/O values through the MMU, APU, timer and PPU
+}
+
+// Clock Speed: 4.194304 MHz
+void GameBoy::Step () {
+	PROFILE_SCOPE (PROF_TIMERS);
+	uint8_t* IOMap = mmu->IOMap;
+	
+	// Scheduled events (LCD lines, STAT, timer), one compare when nothing is due
+	if (Events.Due (cpu->ClockCount)) {
+		int Event;
+		while ((Event = Events.Pop (cpu->ClockCount)) >= 0) {
+			if (Event == EVENT_TIMER) {
+				timer->Overflow ();
+				cpu->Interrupt (2);
+				continue;
+			}
+			
+			uint8_t Interrupts;
+			{
+				PROFILE_SCOPE (PROF_PPU);
+				Interrupts = ppu->Event (Event, mmu->VRAM (), mmu->OAM, mmu->IOMap);
+			}
+			if (Interrupts & LCD_INT_VBLANK)
+				cpu->Interrupt (0);
+			if (Interrupts & LCD_INT_STAT)
+				cpu->Interrupt (1);
+		}
+	}
+	
+	if (!cpu->Debugging) {
+		PROFILE_SCOPE (PROF_CPU);
+		uint8_t OldDMA = IOMap [0x46];
+		cpu->Clock ();
+		if (IOMap [0x46] != OldDMA) // DMA Write
+			cpu->ClockCount += (160 << 2) + 4;
+	}
+}
+
+uint32_t GameBoy::RunClocks (uint32_t Clocks) {
+	uint32_t StartClock = cpu->ClockCount;
+	while (cpu->ClockCount - StartClock < Clocks) {
+		uint32_t Before = cpu->ClockCount;
+		Step ();
+		if (cpu->ClockCount == Before) // STOP / debugging, nothing moves anymore
+			break;
+	}
+	return cpu->ClockCount - StartClock;
+}
+
+uint32_t GameBoy::RunFrame () {
+	uint32_t StartClock = cpu->ClockCount;
+	uint32_t Frame = ppu->FrameCount;
+	while (ppu->FrameCount == Frame && cpu->ClockCount - StartClock < LCD_LINE_CLOCKS * LCD_LINES * 2) { // LCD may be off
+		uint32_t Before = cpu->ClockCount;
+		Step ();
+		if (cpu->ClockCount == Before)
+			break;
+	}
+	return cpu->ClockCount - StartClock;
+}
+
+// States
+uint32_t GameBoy::ROMID () {
+	return HashFrame (mmu->ROM + 0x134, 0x150 - 0x134); // Title to global checksum
+}
+
+void GameBoy::SyncState (StateStream &State) {
+	cpu->SyncState (State);
+	mmu->SyncState (State);
+	ppu->SyncState (State);
+	apu->SyncState (State);
+	
+	timer->SyncState (State);
+	Events.SyncState (State);
+}
+
+uint32_t GameBoy::StateSize () {
+	StateStream Counter (NULL, 0, 0);
+	SyncState (Counter);
+	return sizeof (StateHeader) + Counter.Position;
+}
+
+uint32_t GameBoy::SaveState (uint8_t* Buffer, uint32_t Capacity) {
+	if (Capacity < sizeof (StateHeader))
+		return 0;
+	
+	StateStream State (Buffer + sizeof (StateHeader), Capacity - sizeof (StateHeader), 0);
+	SyncState (State);
+	if (State.Overflow)
+		return 0;
+	
+	StateHeader Header;
+	Header.Magic = STATE_MAGIC;
+	Header.Version = STATE_VERSION;
+	Header.Flags = 0;
+	Header.ROMID = ROMID ();
+	Header.Size = State.Position;
+	Header.StoredSize = State.Position;
+	memcpy (Buffer, &Header, sizeof (Header));
+	
+	return sizeof (Header) + State.Position;
+}
+
+uint8_t GameBoy::LoadState (const uint8_t* Buffer, uint32_t Size) {
+	StateHeader Header;
+	if (Size < sizeof (Header))
+		return 0;
+	memcpy (&Header, Buffer, sizeof (Header));
+	
+	if (Header.Magic != STATE_MAGIC || Header.Version != STATE_VERSION || Header.Flags != 0) {
+		printf ("[ERR] Not a state, or from another version\n");
+		return 0;
+	}
+	
+	if (Header.ROMID != ROMID ()) {
+		printf ("[ERR] State belongs to another game\n");
+		return 0;
+	}
+	
+	if (Header.Size != StateSize () - sizeof (Header) || Size < sizeof (Header) + Header.Size) {
+		printf ("[ERR] State size doesn't match\n");
+		return 0;
+	}
+	
+	StateStream State ((uint8_t*) Buffer + sizeof (Header), Header.Size, 1);
+	SyncState (State);
+	return 1;
+}
+
+GameBoy* GameBoy::Fork () {
+	GameBoy* Child = new GameBoy (apu->SampleRate, this);
+	Child->mmu->ShareRAM (mmu);
+	Child->mmu->EchoSerial = mmu->EchoSerial;
+	Child->mmu->Muted = mmu->Muted;
+	Child->apu->Muted = apu->Muted;
+	
+	// Everything else is small, it goes through the state code
+	StateStream Counter (NULL, 0, 0);
+	Counter.SkipRAM = 1;
+	SyncState (Counter);
+	
+	uint8_t* Buffer = (uint8_t*) malloc (Counter.Position);
+	StateStream Saver (Buffer, Counter.Position, 0);
+	Saver.SkipRAM = 1;
+	SyncState (Saver);
+	StateStream Loader (Buffer, Counter.Position, 1);
+	Loader.SkipRAM = 1;
+	Child->SyncState (Loader);
+	free (Buffer);
+	
+	return Child;
+}
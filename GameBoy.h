@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <stdio.h>
+#include "CPU.h"
+#include "MMU.h"
+#include "PPU.h"
+#include "APU.h"
+#include "Timer.h"
+#include "Scheduler.h"
+#include "State.h"
+#ifndef GAMEBOY_H
+#define GAMEBOY_H
+
+/* The emulated machine: the components and the scheduled events between them (LCD lines, timer).
+   Everything that depends on the host (wall clock, input devices, output) stays with the caller. */
+class GameBoy {
+	public:
+		GameBoy (uint32_t SampleRate, GameBoy* Source = NULL); // Source: Share its ROM, instead of loading one
+		~GameBoy ();
+		uint8_t LoadROM (const char* Filename); // Quiet, no save file. 1 - Loaded
+		uint8_t LoadROM (const uint8_t* Data, uint32_t Size); // From memory, copied
+		void Reset (); // Power cycle in place: keeps the ROM and battery RAM
+		void Step (); // One instruction, and everything clocked along with it
+		uint32_t RunClocks (uint32_t Clocks); // At least Clocks, returns the clocks run (fewer once stopped)
+		uint32_t RunFrame (); // Until a frame completes, or 2 frames of clocks with the LCD off. Returns the clocks run
+		
+		// States - header + payload, the ROM itself is never included
+		uint32_t StateSize ();
+		uint32_t SaveState (uint8_t* Buffer, uint32_t Capacity); // Bytes written, 0 - Didn't fit
+		uint8_t LoadState (const uint8_t* Buffer, uint32_t Size); // 1 - Loaded, untouched otherwise
+		uint32_t ROMID (); // Hash of the cartridge header
+		
+		GameBoy* Fork (); // A copy that goes on independently: ROM and RAM are shared until one of them writes to a block
+		
+		MMU* mmu;
+		CPU* cpu;
+		PPU* ppu;
+		APU* apu;
+		Timer* timer;
+		Scheduler Events;
+	private:
+		void SyncState (StateStream &State);
+};
+
+#endif
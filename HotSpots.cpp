@@ -0,0 +1,214 @@
+#include "HotSpots.h"
+#include <algorithm>
+
+// Control flow kinds
+#define FLOW_CALL 1
+#define FLOW_RET 2
+
+static uint8_t FlowKinds [256];
+
+static void BuildFlowKinds () {
+	const uint8_t Calls [] = {0xCD, 0xC4, 0xD4, 0xCC, 0xDC, 0xC7, 0xCF, 0xD7, 0xDF, 0xE7, 0xEF, 0xF7, 0xFF};
+	const uint8_t Returns [] = {0xC9, 0xD9, 0xC0, 0xD0, 0xC8, 0xD8};
+	for (uint32_t i = 0; i < sizeof (Calls); i++)
+		FlowKinds [Calls [i]] = FLOW_CALL;
+	for (uint32_t i = 0; i < sizeof (Returns); i++)
+		FlowKinds [Returns [i]] = FLOW_RET;
+}
+
+HotSpots::HotSpots (MMU* _mmu, const uint32_t* _ClockCount, uint32_t _SampleEvery) {
+	static uint8_t Built = (BuildFlowKinds (), 1);
+	(void) Built;
+	
+	mmu = _mmu;
+	ClockCount = _ClockCount;
+	SampleEvery = Countdown = _SampleEvery ? _SampleEvery : 1;
+	LastClock = *ClockCount;
+	
+	memset (Pages, 0, sizeof (Pages));
+	memset (Coverage, 0, sizeof (Coverage));
+	
+	Node Root = {0, 0x0100, 0};
+	Nodes.push_back (Root);
+}
+
+HotSpots::~HotSpots () {
+	for (uint32_t i = 0; i < HOTSPOT_PAGES; i++) {
+		free (Pages [i]);
+		free (Coverage [i]);
+	}
+}
+
+uint32_t* HotSpots::AllocatePage (uint16_t Index) {
+	Pages [Index] = (uint32_t*) calloc (0x4000, sizeof (uint32_t));
+	Coverage [Index] = (uint8_t*) calloc (0x4000 / 8, 1);
+	return Pages [Index];
+}
+
+uint32_t HotSpots::Key (uint16_t PC) {
+	if (PC >= 0x4000 && PC < 0x8000)
+		return (mmu->CurrentROMBank << 16) | PC;
+	return PC;
+}
+
+void HotSpots::Flow (uint8_t Instruction, uint16_t OldSP, uint16_t SP, uint16_t PC) {
+	uint8_t Kind = FlowKinds [Instruction];
+	if (Kind == FLOW_CALL && SP == (uint16_t) (OldSP - 2)) // Taken
+		Call (PC, SP);
+	else if (Kind == FLOW_RET && SP == (uint16_t) (OldSP + 2)) {
+		Charge ();
+		while (!Stack.empty () && Stack.back ().SP < SP) // Also drops frames that were unwound by hand
+			Stack.pop_back ();
+	}
+}
+
+void HotSpots::Call (uint16_t Target, uint16_t SP) {
+	Charge ();
+	if (Stack.size () >= HOTSPOT_MAX_DEPTH)
+		return;
+	
+	uint32_t Parent = Stack.empty () ? 0 : Stack.back ().Node;
+	uint32_t Function = Key (Target);
+	uint64_t ChildKey = ((uint64_t) Parent << 32) | Function;
+	
+	auto Found = Children.find (ChildKey);
+	uint32_t Child;
+	if (Found == Children.end ()) {
+		Child = Nodes.size ();
+		Node New = {Parent, Function, 0};
+		Nodes.push_back (New);
+		Children [ChildKey] = Child;
+	} else
+		Child = Found->second;
+	
+	Frame New = {Child, SP};
+	Stack.push_back (New);
+}
+
+uint32_t HotSpots::LoadSymbols (const char* Filename) {
+	FILE* File = fopen (Filename, "r");
+	if (File == NULL)
+		return 0;
+	
+	char Line [512];
+	uint32_t Count = 0;
+	while (fgets (Line, sizeof (Line), File)) {
+		unsigned int Bank, Address;
+		char Symbol [256];
+		if (Line [0] == ';' || sscanf (Line, "%x:%x %255s", &Bank, &Address, Symbol) != 3)
+			continue;
+		
+		Symbols [(Bank << 16) | (Address & 0xFFFF)] = Symbol;
+		Count++;
+	}
+	
+	fclose (File);
+	return Count;
+}
+
+// Nearest symbol at or before the address, in the same bank and 16 KB region
+std::string HotSpots::Name (uint32_t Key, uint8_t Exact) {
+	char Text [300];
+	auto Found = Symbols.upper_bound (Key);
+	if (Found != Symbols.begin ()) {
+		--Found;
+		if ((Found->first >> 14) == (Key >> 14)) {
+			if (Found->first == Key)
+				return Found->second;
+			if (!Exact) {
+				snprintf (Text, sizeof (Text), "%s+0x%X", Found->second.c_str (), Key - Found->first);
+				return Text;
+			}
+		}
+	}
+	
+	snprintf (Text, sizeof (Text), "%02X:%04X", Key >> 16, Key & 0xFFFF);
+	return Text;
+}
+
+void HotSpots::Write (const char* Prefix) {
+	Charge ();
+	std::string Base = Prefix;
+	
+	// Histogram: hottest addresses and totals per page
+	struct Spot {
+		uint32_t Count;
+		uint32_t Key;
+	};
+	std::vector <Spot> Spots;
+	uint64_t Total = 0;
+	for (uint32_t Index = 0; Index < HOTSPOT_PAGES; Index++) {
+		if (Pages [Index] == NULL)
+			continue;
+		
+		uint32_t Bank = Index < 512 ? Index : 0;
+		uint16_t Origin = Index == 0 ? 0x0000 : Index < 512 ? 0x4000 : Index == 512 ? 0x8000 : 0xC000;
+		for (uint32_t Offset = 0; Offset < 0x4000; Offset++)
+			if (Pages [Index][Offset]) {
+				Spot New = {Pages [Index][Offset], (Bank << 16) | (uint32_t) (Origin + Offset)};
+				Spots.push_back (New);
+				Total += New.Count;
+			}
+	}
+	std::sort (Spots.begin (), Spots.end (), [] (const Spot &A, const Spot &B) { return A.Count > B.Count; });
+	
+	FILE* File = fopen ((Base + ".hotspots.txt").c_str (), "w");
+	if (File == NULL) {
+		printf ("[ERR] Can't write %s.hotspots.txt\n", Prefix);
+		return;
+	}
+	
+	fprintf (File, "# %s, %llu %s\n", SampleEvery == 1 ? "Executions" : "Samples",
+		(unsigned long long) Total, SampleEvery == 1 ? "instructions" : "taken");
+	for (uint32_t i = 0; i < Spots.size () && i < 200; i++)
+		fprintf (File, "%10u %6.2f%%  %02X:%04X  %s\n", Spots [i].Count, 100.0 * Spots [i].Count / Total,
+			Spots [i].Key >> 16, Spots [i].Key & 0xFFFF, Name (Spots [i].Key, 0).c_str ());
+	fclose (File);
+	
+	// Coverage: executed ranges per page
+	File = fopen ((Base + ".coverage.txt").c_str (), "w");
+	if (File) {
+		for (uint32_t Index = 0; Index < HOTSPOT_PAGES; Index++) {
+			if (Coverage [Index] == NULL)
+				continue;
+			
+			uint32_t Bank = Index < 512 ? Index : 0;
+			uint16_t Origin = Index == 0 ? 0x0000 : Index < 512 ? 0x4000 : Index == 512 ? 0x8000 : 0xC000;
+			uint32_t Executed = 0;
+			int32_t Start = -1;
+			for (uint32_t Offset = 0; Offset <= 0x4000; Offset++) {
+				uint8_t Set = Offset < 0x4000 && (Coverage [Index][Offset >> 3] & (1 << (Offset & 7)));
+				Executed += Set;
+				if (Set && Start < 0)
+					Start = Offset;
+				else if (!Set && Start >= 0) {
+					fprintf (File, "%02X:%04X-%04X %s\n", Bank, Origin + Start, Origin + Offset - 1, Name ((Bank << 16) | (Origin + Start), 0).c_str ());
+					Start = -1;
+				}
+			}
+			fprintf (File, "# %02X:%04X: %u instruction addresses executed\n", Bank, Origin, Executed);
+		}
+		fclose (File);
+	}
+	
+	// Folded stacks, cycles spent in each call path
+	File = fopen ((Base + ".folded").c_str (), "w");
+	if (File) {
+		for (uint32_t i = 0; i < Nodes.size (); i++) {
+			if (Nodes [i].Cycles == 0)
+				continue;
+			
+			std::string Path;
+			for (uint32_t At = i; ; At = Nodes [At].Parent) {
+				std::string Frame = At ? Name (Nodes [At].Function, 1) : "root";
+				Path = Path.empty () ? Frame : Frame + ";" + Path;
+				if (At == 0)
+					break;
+			}
+			fprintf (File, "%s %llu\n", Path.c_str (), (unsigned long long) Nodes [i].Cycles);
+		}
+		fclose (File);
+	}
+	
+	printf ("[INFO] Hot spots written to %s.hotspots.txt, .coverage.txt and .folded\n", Prefix);
+}
@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "MMU.h"
+#ifndef HOTSPOTS_H
+#define HOTSPOTS_H
+
+#define HOTSPOT_PAGES 514 // 512 ROM banks, 0x8000 - 0xBFFF, 0xC000 - 0xFFFF
+#define HOTSPOT_MAX_DEPTH 256
+
+/* Where the emulated CPU spends its time, in ROM terms: executions per address and bank, which
+   addresses ever ran, and cycles per call stack (shadowed from CALL / RST / interrupts and RET).
+   Compiled in with `make HOTSPOTS=1`; without it the hooks in the CPU are empty. */
+class HotSpots {
+	public:
+		HotSpots (MMU* _mmu, const uint32_t* _ClockCount, uint32_t _SampleEvery); // 1 - Exact histogram
+		~HotSpots ();
+		
+		uint32_t LoadSymbols (const char* Filename); // RGBDS / no$gmb .sym, returns how many
+		void Write (const char* Prefix); // .hotspots.txt, .coverage.txt, .folded
+		
+		// CPU hooks
+		inline void Step (uint16_t PC) {
+			Charge ();
+			
+			uint16_t Index = PageIndex (PC);
+			uint32_t* Counts = Pages [Index];
+			if (Counts == NULL)
+				Counts = AllocatePage (Index);
+			
+			uint16_t Offset = PC & 0x3FFF;
+			Coverage [Index][Offset >> 3] |= 1 << (Offset & 7);
+			if (--Countdown == 0) {
+				Countdown = SampleEvery;
+				Counts [Offset]++;
+			}
+		}
+		void Flow (uint8_t Instruction, uint16_t OldSP, uint16_t SP, uint16_t PC); // After an instruction, for calls and returns
+		void Call (uint16_t Target, uint16_t SP); // SP - Where the return address is
+		
+	private:
+		struct Node {
+			uint32_t Parent;
+			uint32_t Function; // Bank << 16 | Address, as in .sym files
+			uint64_t Cycles; // Spent in the function itself
+		};
+		struct Frame {
+			uint32_t Node;
+			uint16_t SP;
+		};
+		
+		MMU* mmu;
+		const uint32_t* ClockCount;
+		uint32_t SampleEvery;
+		uint32_t Countdown;
+		uint32_t LastClock;
+		
+		uint32_t* Pages [HOTSPOT_PAGES]; // Executions (or samples) per address
+		uint8_t* Coverage [HOTSPOT_PAGES]; // 1 bit per address
+		
+		std::vector <Node> Nodes; // 0 - Root, outside any tracked call
+		std::unordered_map <uint64_t, uint32_t> Children; // Parent << 32 | Function -> Node
+		std::vector <Frame> Stack;
+		std::map <uint32_t, std::string> Symbols;
+		
+		inline void Charge () {
+			uint32_t Now = *ClockCount;
+			Nodes [Stack.empty () ? 0 : Stack.back ().Node].Cycles += Now - LastClock;
+			LastClock = Now;
+		}
+		inline uint16_t PageIndex (uint16_t PC) {
+			if (PC < 0x4000)
+				return 0;
+			if (PC < 0x8000)
+				return mmu->CurrentROMBank & 0x1FF;
+			return 512 + ((PC >> 14) & 1);
+		}
+		uint32_t Key (uint16_t PC); // Symbol bank << 16 | PC
+		uint32_t* AllocatePage (uint16_t Index);
+		std::string Name (uint32_t Key, uint8_t Exact);
+};
+
+#ifdef HOTSPOTS
+#define HOTSPOT_STEP(PC) if (Spots) Spots->Step (PC)
+#define HOTSPOT_SAVE_SP(SP) uint16_t HotSpotSP = SP
+#define HOTSPOT_FLOW(Instruction, SP, PC) if (Spots) Spots->Flow (Instruction, HotSpotSP, SP, PC)
+#define HOTSPOT_CALL(Target, SP) if (Spots) Spots->Call (Target, SP)
+#else
+#define HOTSPOT_STEP(PC)
+#define HOTSPOT_SAVE_SP(SP)
+#define HOTSPOT_FLOW(Instruction, SP, PC)
+#define HOTSPOT_CALL(Target, SP)
+#endif
+
+#endif
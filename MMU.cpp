@@ -1,63 +1,280 @@
 #include "MMU.h"
+#include "Debugger.h"
 
-MMU::MMU () {
-	memset (Memory, 0, sizeof(Memory));
+uint8_t ROMwBattery [] = {0x03, 0x06, 0x09, 0x0D, 0x0F, 0x10, 0x1B, 0x1E, 0x20, 0xFF};
+uint8_t ROMwRAM [] = {0x02, 0x03, 0x06, 0x08, 0x09, 0x0C, 0x0D, 0x10, 0x12, 0x13, 0x1A, 0x1B, 0x1D, 0x1E, 0x20, 0x22, 0xFF};
+
+// Released blocks point at this one, it reads as zeros and is copied on the first write
+static RAMBlock ZeroBlock = {{2}, {0}};
+
+MMU::MMU (MMU* Source) {
+	if (Source) { // Same game
+		ROM = Source->ROM;
+		ROMReferences = Source->ROMReferences;
+		(*ROMReferences)++;
+	} else {
+		ROM = (uint8_t*) calloc (MMU_ROM_SIZE, 1); // Pages past the file are never touched, they cost nothing
+		ROMReferences = new std::atomic <uint32_t> (1);
+	}
+	
+	for (uint8_t ID = 0; ID < MMU_BLOCKS; ID++)
+		Blocks [ID] = &ZeroBlock;
+	Reset ();
+	if (Source)
+		ParseHeader ();
+}
+
+MMU::~MMU () {
+	ReleaseROM ();
+	for (uint8_t ID = 0; ID < MMU_BLOCKS; ID++)
+		Release (ID);
+}
+
+void MMU::ReleaseROM () {
+	if (--(*ROMReferences) == 0) {
+		free (ROM);
+		delete ROMReferences;
+	}
+}
+
+void MMU::ShareRAM (MMU* Source) {
+	for (uint8_t ID = 0; ID < MMU_BLOCKS; ID++) {
+		Release (ID);
+		Blocks [ID] = Source->Blocks [ID];
+		if (Blocks [ID] != &ZeroBlock)
+			Blocks [ID]->References++;
+	}
+}
+
+void MMU::Unshare (uint8_t ID) {
+	RAMBlock* Shared = Blocks [ID];
+	RAMBlock* Copy = new RAMBlock;
+	Copy->References = 1;
+	memcpy (Copy->Data, Shared->Data, MMU_BLOCK_SIZE);
+	Blocks [ID] = Copy;
+	
+	if (Shared != &ZeroBlock && --Shared->References == 0) // Releases after the copy. 0 - The other owner made its own copy at the same time
+		delete Shared;
+}
+
+void MMU::Release (uint8_t ID) {
+	if (Blocks [ID] != &ZeroBlock && --Blocks [ID]->References == 0)
+		delete Blocks [ID];
+	Blocks [ID] = &ZeroBlock;
+}
+
+void MMU::Clear (uint8_t ID) {
+	if (Blocks [ID] != &ZeroBlock && Blocks [ID]->References.load (std::memory_order_acquire) == 1) {
+		memset (Blocks [ID]->Data, 0, MMU_BLOCK_SIZE); // Ours alone, no allocation
+		return;
+	}
+	
+	Release (ID);
+	RAMBlock* Owned = new RAMBlock;
+	Owned->References = 1;
+	memset (Owned->Data, 0, MMU_BLOCK_SIZE);
+	Blocks [ID] = Owned;
+}
+
+void MMU::Reset () {
+	Clear (MMU_BLOCK_VRAM);
+	Clear (MMU_BLOCK_WRAM);
+	memset (High, 0, sizeof (High));
+	
+	ExternalRAMEnabled = 0;
+	CurrentRAMBank = 0;
+	CurrentROMBank = 1;
+	SelectRAMBank = 0;
+	SerialLength = 0;
+	SerialOutput [0] = 0;
+}
+
+void MMU::ParseHeader () {
+	uint8_t CartridgeROMType = ROM [0x0147];
+	
+	ROMType = 0; // Actual ROM Type
+	if (CartridgeROMType == 0x00)
+		ROMType = 0; // ROM Only
+	else if (CartridgeROMType < 0x04)
+		ROMType = 1; // MBC1
+	else if (CartridgeROMType < 0x07)
+		ROMType = 2; // MBC2
+	else if (CartridgeROMType < 0x0A)
+		ROMType = 0; // ROM + RAM
+	else if (CartridgeROMType < 0x0E)
+		ROMType = 4; // MMM01, there's no MBC4
+	else if (CartridgeROMType < 0x18)
+		ROMType = 3; // MBC3
+	else if (CartridgeROMType < 0x1F)
+		ROMType = 5; // MBC5
+	else if (CartridgeROMType < 0x21)
+		ROMType = 6; // MBC6
+	else if (CartridgeROMType < 0x23)
+		ROMType = 7; // MBC7
+	
+	switch (ROM [0x0149]) {
+		case 0: ExternalRAMSize = 0; break;
+		case 1: ExternalRAMSize = 1; break;
+		case 2: ExternalRAMSize = 1; break;
+		case 3: ExternalRAMSize = 4; break;
+		case 4: ExternalRAMSize = 16; break;
+		case 5: ExternalRAMSize = 8; break;
+		default: break;
+	}
+	
+	uint8_t Banks = ExternalRAMSize ? ExternalRAMSize : 1; // MBC2 RAM isn't in the header
+	for (uint8_t ID = MMU_BLOCK_EXTERNAL; ID < MMU_BLOCK_EXTERNAL + Banks; ID++)
+		if (Blocks [ID] == &ZeroBlock) // Allocated now so saving to it or loading a state doesn't
+			Clear (ID);
+	
+	ROMBattery = 0;
+	for (uint32_t i = 0; i < sizeof (ROMwBattery); i++)
+		if (CartridgeROMType == ROMwBattery [i])
+			ROMBattery = 1;
+	
+	ROMRAM = 0;
+	for (uint32_t i = 0; i < sizeof (ROMwRAM); i++)
+		if (CartridgeROMType == ROMwRAM [i])
+			ROMRAM = 1;
 }
 
 uint8_t MMU::GetByteAt (uint16_t Address) {
+	PROFILE_SCOPE_IF (Address >= 0xFF00 && Address < 0xFF80, PROF_IO);
+	
+	if (WatchPages [Address >> 8] & WATCH_READ)
+		Watcher->Access (Address, PeekByteAt (Address), WATCH_READ);
+	
 	if (Address < 0x4000)
 		return ROM [Address]; // ROM Bank 0
 	else if (Address < 0x8000)
 		return ROM [0x4000 * CurrentROMBank + (Address - 0x4000)]; // ROM Bank n
+	else if (Address < 0xA000)
+		return Block (MMU_BLOCK_VRAM) [Address - 0x8000];
+	else if (Address < 0xC000) { // External RAM / RTC
+		if ((ROMType == 1 || ROMType == 2) && !ExternalRAMEnabled)
+			return 0xFF;
+		if (ROMType == 3 && CurrentRAMBank > 0x07) // TODO RTC
+			return RTCRegister [CurrentRAMBank];
+		return Block (MMU_BLOCK_EXTERNAL + (CurrentRAMBank & 0x0F)) [Address - 0xA000];
+	} else if (Address < 0xFE00) // 8KB Internal RAM, and its echo at 0xE000
+		return Block (MMU_BLOCK_WRAM) [(Address - 0xC000) & 0x1FFF];
 	
-	if (Address >= 0xE000 && Address < 0xFE00) // 8KB Internal RAM Echo
-		Address -= 0x2000;
+	if (Address == 0xFF00) // JOYP
+		return 0xC0 | (IOMap [0x00] & 0x30) | JoypadLines ();
+	
+	if (Address == 0xFF0F) // IF, the upper bits always read 1
+		return 0xE0 | *IF;
+	if (Address == 0xFFFF) // IE
+		return *IE;
+	
+	if (Address >= 0xFF04 && Address < 0xFF08 && timer) // DIV, TIMA, TMA, TAC
+		return timer->Read (Address, *ClockCount);
+	
+	if (Address >= 0xFF10 && Address < 0xFF40 && apu) // Sound
+		return apu->ReadRegister (Address, *ClockCount);
+	
+	if ((Address == 0xFF41 || Address == 0xFF44) && ppu) // STAT, LY
+		return ppu->ReadRegister (Address, IOMap, *ClockCount);
 	
 	if (Address >= 0xFE00 && Address < 0xFEA0) { // OAM
-		if (CurrentPPUMode >= 2) { // Inaccessible
+		if (PPUMode () >= 2) { // Inaccessible
 			printf ("[WARN] Blocked OAM Read\n");
 			return 0xFF;
 		}
 	}
 	
-	if (ROMType == 1 || ROMType == 2) {
-		if (ExternalRAMEnabled) {
-			if (Address >= 0xA000 && Address < 0xC000) // Read from External RAM
-				return ExternalRAM [0x2000 * CurrentRAMBank + (Address - 0xA000)];
-		}
-	} else if (ROMType == 3) {
-		if (Address >= 0xA000 && Address < 0xC000) { // Read from External RAM / RTC
-			if (CurrentRAMBank <= 0x07)
-				return ExternalRAM [0x2000 * CurrentRAMBank + (Address - 0xA000)];
-			else { // TODO RTC
-				return RTCRegister [CurrentRAMBank];
-			}
-		}
-	}
+	return High [Address - 0xFE00];
+}
+
+uint8_t MMU::PeekByteAt (uint16_t Address) {
+	if (Address < 0x4000)
+		return ROM [Address];
+	else if (Address < 0x8000)
+		return ROM [0x4000 * CurrentROMBank + (Address - 0x4000)];
+	else if (Address < 0xA000)
+		return Block (MMU_BLOCK_VRAM) [Address - 0x8000];
+	else if (Address < 0xC000)
+		return Block (MMU_BLOCK_EXTERNAL + (CurrentRAMBank & 0x0F)) [Address - 0xA000];
+	else if (Address < 0xFE00)
+		return Block (MMU_BLOCK_WRAM) [(Address - 0xC000) & 0x1FFF];
 	
-	return Memory [Address];
+	if (Address == 0xFF0F)
+		return 0xE0 | *IF;
+	if (Address >= 0xFF04 && Address < 0xFF08 && timer)
+		return timer->Read (Address, *ClockCount);
+	if ((Address == 0xFF41 || Address == 0xFF44) && ppu)
+		return ppu->ReadRegister (Address, IOMap, *ClockCount);
+	return High [Address - 0xFE00];
 }
 
 void MMU::SetByteAt (uint16_t Address, uint8_t Value) {
+	PROFILE_SCOPE_IF (Address >= 0xFF00 && Address < 0xFF80, PROF_IO);
+	
+	if (WatchPages [Address >> 8] & WATCH_WRITE)
+		Watcher->Access (Address, Value, WATCH_WRITE);
+	
 	switch (Address) {
-		case 0xFF01: printf ("%c", Value); fflush (stdout); return; // SB
-		case 0xFF04: Value = 0; return; // DIV Register, Always write 0
-		case 0xFF46: if (CurrentPPUMode < 2) memcpy (Memory + 0xFE00, Memory + (Value << 8), 0xA0); return; // DMA
+		case 0xFF00: { // JOYP, only the selection is writable. Selecting a held button is a transition too
+			uint8_t OldLines = JoypadLines ();
+			IOMap [0x00] = 0xC0 | (Value & 0x30);
+			uint8_t Lines = JoypadLines ();
+			IOMap [0x00] |= Lines; // Kept up to date for anything looking at IOMap directly
+			if (OldLines & ~Lines)
+				*IF |= 0x10;
+			return;
+		}
+		case 0xFF01: // SB
+			if (Muted)
+				return;
+			
+			if (SerialLength == sizeof (SerialOutput) - 1) { // Full, keep the newer half
+				memmove (SerialOutput, SerialOutput + sizeof (SerialOutput) / 2, SerialLength - sizeof (SerialOutput) / 2);
+				SerialLength -= sizeof (SerialOutput) / 2;
+			}
+			SerialOutput [SerialLength++] = Value;
+			SerialOutput [SerialLength] = 0;
+			
+			if (EchoSerial) {
+				printf ("%c", Value);
+				fflush (stdout);
+			}
+			return;
+		case 0xFF04: case 0xFF05: case 0xFF06: case 0xFF07: // Timer, DIV is reset by any write
+			if (timer)
+				timer->Write (Address, Value, *ClockCount);
+			return;
+		case 0xFF0F: *IF = Value & 0x1F; return;
+		case 0xFFFF: *IE = IOMap [0xFF] = Value; return; // Mirrored for anything looking at IOMap directly
+		case 0xFF40: case 0xFF41: case 0xFF45: // LCDC, STAT, LYC, the LCD timing depends on them
+			if (ppu)
+				ppu->WriteRegister (Address, Value, OAM, IOMap, *ClockCount);
+			else
+				IOMap [Address - 0xFF00] = Value;
+			return;
+		case 0xFF44: return; // LY, read only
+		case 0xFF46: // DMA
+			if (PPUMode () < 2)
+				for (uint16_t i = 0; i < 0xA0; i++)
+					OAM [i] = PeekByteAt ((Value << 8) + i);
+			return;
 		default: break;
 	}
 	
+	if (Address >= 0xFF10 && Address < 0xFF40 && apu) // Sound, mirrored below for debugging
+		apu->WriteRegister (Address, Value, *ClockCount);
+	
 	if (Address >= 0xE000 && Address < 0xFE00) // 8KB Internal RAM Echo
 		Address -= 0x2000;
 	
 	if (Address >= 0xFE00 && Address < 0xFEA0) { // OAM
-		if (CurrentPPUMode >= 2) { // Inaccessible
+		if (PPUMode () >= 2) { // Inaccessible
 			printf ("[WARN] Blocked OAM Write\n");
 			return;
 		}
 	}
 	
 	if (Address >= 0x8000 && Address < 0xA000) { // VRAM
-		if (CurrentPPUMode >= 3) { // Inaccessible
+		if (PPUMode () >= 3) { // Inaccessible
 			printf ("[WARN] Blocked VRAM Write\n");
 			return;
 		}
@@ -101,7 +318,7 @@ void MMU::SetByteAt (uint16_t Address, uint8_t Value) {
 			return;
 		} else if (Address >= 0xA000 && Address < 0xC000) { // Write to External RAM
 			if (ExternalRAMEnabled)
-				ExternalRAM [0x2000 * CurrentRAMBank + (Address - 0xA000)] = Value;
+				WritableBlock (MMU_BLOCK_EXTERNAL + CurrentRAMBank) [Address - 0xA000] = Value;
 			return;
 		}
 	} else if (ROMType == 2) {
@@ -127,7 +344,7 @@ void MMU::SetByteAt (uint16_t Address, uint8_t Value) {
 			return;
 		} else if (Address >= 0xA000 && Address < 0xC000) { // Write to External RAM / RTC
 			if (CurrentRAMBank <= 0x07) {
-				ExternalRAM [0x2000 * CurrentRAMBank + (Address - 0xA000)] = Value;
+				WritableBlock (MMU_BLOCK_EXTERNAL + CurrentRAMBank) [Address - 0xA000] = Value;
 			} else
 				RTCRegister [CurrentRAMBank] = Value;
 			return;
@@ -136,7 +353,16 @@ void MMU::SetByteAt (uint16_t Address, uint8_t Value) {
 		}
 	}
 	
-	Memory [Address] = Value;
+	if (Address < 0x8000) // Unsupported MBC
+		return;
+	else if (Address < 0xA000)
+		WritableBlock (MMU_BLOCK_VRAM) [Address - 0x8000] = Value;
+	else if (Address < 0xC000)
+		WritableBlock (MMU_BLOCK_EXTERNAL + (CurrentRAMBank & 0x0F)) [Address - 0xA000] = Value;
+	else if (Address < 0xE000)
+		WritableBlock (MMU_BLOCK_WRAM) [Address - 0xC000] = Value;
+	else
+		High [Address - 0xFE00] = Value;
 }
 
 uint16_t MMU::GetWordAt (uint16_t Address) {
@@ -146,4 +372,51 @@ uint16_t MMU::GetWordAt (uint16_t Address) {
 void MMU::SetWordAt (uint16_t Address, uint16_t Value) {
 	SetByteAt (Address + 1, Value >> 8);
 	SetByteAt (Address, Value & 0xFF);
-}
\ No newline at end of file
+}
+
+void MMU::SetJoypad (uint8_t State) {
+	uint8_t OldLines = JoypadLines ();
+	JoypadState = State;
+	uint8_t Lines = JoypadLines ();
+	IOMap [0x00] = (IOMap [0x00] & 0xF0) | Lines;
+	if (OldLines & ~Lines) // Interrupt on high to low only
+		*IF |= 0x10;
+}
+
+uint8_t MMU::JoypadLines () {
+	uint8_t Lines = 0x0F;
+	if (!(IOMap [0x00] & 0x10)) // Direction keys
+		Lines &= ~(JoypadState & 0x0F);
+	if (!(IOMap [0x00] & 0x20)) // Buttons
+		Lines &= ~(JoypadState >> 4);
+	return Lines;
+}
+
+void MMU::CopyExternalRAM (uint8_t* Out, uint32_t Size) {
+	for (uint32_t Offset = 0; Offset < Size; Offset += MMU_BLOCK_SIZE) {
+		uint32_t Length = Size - Offset < MMU_BLOCK_SIZE ? Size - Offset : MMU_BLOCK_SIZE;
+		memcpy (Out + Offset, Block (MMU_BLOCK_EXTERNAL + Offset / MMU_BLOCK_SIZE), Length);
+	}
+}
+
+void MMU::SetExternalRAM (const uint8_t* In, uint32_t Size) {
+	for (uint32_t Offset = 0; Offset < Size; Offset += MMU_BLOCK_SIZE) {
+		uint32_t Length = Size - Offset < MMU_BLOCK_SIZE ? Size - Offset : MMU_BLOCK_SIZE;
+		memcpy (WritableBlock (MMU_BLOCK_EXTERNAL + Offset / MMU_BLOCK_SIZE), In + Offset, Length);
+	}
+}
+
+void MMU::SyncState (StateStream &State) {
+	uint8_t Banks = ExternalRAMSize ? ExternalRAMSize : 1; // MBC2 RAM isn't in the header
+	for (uint8_t ID = 0; ID < MMU_BLOCK_EXTERNAL + Banks && !State.SkipRAM; ID++) // VRAM, WRAM, External RAM, 0x0000 - 0x7FFF is always read from ROM
+		State.Bytes (State.Loading ? WritableBlock (ID) : Blocks [ID]->Data, MMU_BLOCK_SIZE);
+	State.Bytes (High, sizeof (High));
+	
+	State.Sync (ExternalRAMEnabled);
+	State.Sync (CurrentRAMBank);
+	State.Sync (CurrentROMBank);
+	State.Sync (SelectRAMBank);
+	State.Bytes (RTCRegister, sizeof (RTCRegister));
+	
+	State.Sync (JoypadState);
+}
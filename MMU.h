@@ -3,18 +3,65 @@
 #include <stdlib.h>
 #include <cstring>
 #include <time.h>
+#include <atomic>
+#include "APU.h"
+#include "Timer.h"
+#include "PPU.h"
+#include "State.h"
+#include "Profiler.h"
 #ifndef MMU_H
 #define MMU_H
 
+// Joypad Buttons (bit set = pressed)
+#define JOYPAD_RIGHT 0x01
+#define JOYPAD_LEFT 0x02
+#define JOYPAD_UP 0x04
+#define JOYPAD_DOWN 0x08
+#define JOYPAD_A 0x10
+#define JOYPAD_B 0x20
+#define JOYPAD_SELECT 0x40
+#define JOYPAD_START 0x80
+
+#define MMU_ROM_SIZE (8 * 1024 * 1024) // 8MB Max
+
+// Watched accesses, per 256 byte page
+#define WATCH_READ 0x01
+#define WATCH_WRITE 0x02
+
+class Debugger;
+
+// RAM Blocks
+#define MMU_BLOCK_SIZE 0x2000
+#define MMU_BLOCK_VRAM 0
+#define MMU_BLOCK_WRAM 1
+#define MMU_BLOCK_EXTERNAL 2 // + RAM Bank, 16 Banks Max
+#define MMU_BLOCKS 18
+
+/* 8KB of RAM, shared by forked machines until one of them writes to it */
+struct RAMBlock {
+	std::atomic <uint32_t> References;
+	uint8_t Data [MMU_BLOCK_SIZE];
+};
+
 class MMU {
 	public:
-		MMU ();
+		MMU (MMU* Source = NULL); // Source: Use its ROM (same game), the last machine using it frees it
+		~MMU ();
+		void Reset (); // RAM and banking, the ROM and battery RAM stay as they are
 		uint8_t GetByteAt (uint16_t Address);
 		void SetByteAt (uint16_t Address, uint8_t Value);
 		
 		uint16_t GetWordAt (uint16_t Address);
 		void SetWordAt (uint16_t Address, uint16_t Value);
 		
+		void ParseHeader (); // Cartridge type and RAM size from the ROM header
+		void ShareRAM (MMU* Source); // Take Source's RAM blocks, whoever writes to one first gets a copy
+		uint8_t PeekByteAt (uint16_t Address); // What the CPU would read, without side effects or blocking
+		void CopyExternalRAM (uint8_t* Out, uint32_t Size); // Battery RAM, banks one after the other
+		void SetExternalRAM (const uint8_t* In, uint32_t Size);
+		void SetJoypad (uint8_t State); // JOYPAD_* bits, only call when they change
+		void SyncState (StateStream &State); // RAM and banking, not the ROM
+		
 		/* Memory Layout:
 			Interrupt Register:			0xFFFF
 			Internal RAM:				0xFF80
@@ -31,8 +78,7 @@ class MMU {
 		*/
 	
 		// ROM Config
-		uint8_t ROM [8 * 1024 * 1024]; // 8MB Max
-		uint8_t ExternalRAM [16 * 0x2000]; // 16 RAM Banks Max
+		uint8_t* ROM; // MMU_ROM_SIZE, zeroed past the file. Never written while running, so machines can share it
 		uint8_t ROMType = 0;
 		uint8_t ROMBattery = 0;
 		uint8_t ROMRAM = 0;
@@ -42,16 +88,51 @@ class MMU {
 		uint8_t CurrentRAMBank = 0;
 		uint8_t CurrentROMBank = 1; // Default
 		uint8_t SelectRAMBank = 0;
-		uint8_t RTCRegister [0x0D];
+		uint8_t RTCRegister [0x0D] = {0};
 		uint8_t ExternalRAMSize = 0;
 	
-		// VRAM Status
-		uint8_t CurrentPPUMode = 1;
+		uint8_t Muted = 0; // No serial output, for frames that will be thrown away (run-ahead)
+		
+		// Serial, bytes written to SB are collected here (test ROMs report through it)
+		char SerialOutput [4096]; // Zero terminated, the newest bytes when it fills up
+		uint32_t SerialLength = 0;
+		uint8_t EchoSerial = 1; // Also print them
+	
+		// Sound, FF10 - FF3F go through the APU when one is attached
+		APU* apu = NULL;
+		uint32_t* ClockCount = NULL; // CPU clock, so the APU can catch up before an access
+		uint8_t* IF = NULL; // FF0F, held by the CPU
+		uint8_t* IE = NULL; // FFFF, held by the CPU
+		Timer* timer = NULL; // FF04 - FF07, computed from the clock
+		PPU* ppu = NULL; // LCDC, STAT, LY, LYC, and the mode blocking OAM / VRAM
+	
+		// Debugger, told about accesses to pages a watchpoint covers. All zero otherwise
+		uint8_t WatchPages [0x100] = {0};
+		Debugger* Watcher = NULL;
 	
-		// Convenience Pointers
-		uint8_t* IOMap = Memory + 0xFF00;
+		// Joypad, JOYP is resolved from this on every read. A selected line going high to low requests the interrupt
+		uint8_t JoypadState = 0;
 	
-		uint8_t Memory[0x10000];
+		// VRAM, WRAM and External RAM are copy-on-write blocks, 0xFE00 - 0xFFFF belongs to every machine
+		inline const uint8_t* Block (uint8_t ID) { return Blocks [ID]->Data; }
+		inline uint8_t* WritableBlock (uint8_t ID) { // Call before every write
+			if (Blocks [ID]->References.load (std::memory_order_acquire) > 1) // Acquire: sees the other owner's copy finished reading before it let go
+				Unshare (ID);
+			return Blocks [ID]->Data;
+		}
+		const uint8_t* VRAM () { return Block (MMU_BLOCK_VRAM); }
+		uint8_t High [0x200]; // OAM, I/O, HRAM, IE
+		uint8_t* OAM = High;
+		uint8_t* IOMap = High + 0x100;
+	private:
+		std::atomic <uint32_t>* ROMReferences; // Machines sharing ROM
+		RAMBlock* Blocks [MMU_BLOCKS];
+		void ReleaseROM ();
+		void Unshare (uint8_t ID);
+		void Release (uint8_t ID);
+		void Clear (uint8_t ID); // Zeros the block, in place unless another machine shares it
+		uint8_t JoypadLines (); // P10 - P13 for the current selection, 0 - Pressed
+		inline uint8_t PPUMode () { return ppu ? ppu->Mode (*ClockCount) : 1; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "Movie.h"
+#include "Compress.h"
+
+Movie::Movie (const char* Filename, uint8_t _Mode, GameBoy* _gb, uint32_t _HashEvery) {
+	Mode = _Mode;
+	gb = _gb;
+	uint32_t SRAMSize = 0x2000 * (gb->mmu->ExternalRAMSize ? gb->mmu->ExternalRAMSize : 1);
+	
+	if (Mode == MOVIE_RECORD) {
+		File = fopen (Filename, "wb");
+		if (File == NULL) {
+			printf ("[ERR] Can't write movie %s\n", Filename);
+			return;
+		}
+		
+		HashEvery = _HashEvery ? _HashEvery : 60;
+		
+		uint8_t* Battery = (uint8_t*) malloc (SRAMSize);
+		gb->mmu->CopyExternalRAM (Battery, SRAMSize);
+		uint8_t* SRAM = (uint8_t*) malloc (Compression::Bound (SRAMSize));
+		MovieHeader Header;
+		Header.Magic = MOVIE_MAGIC;
+		Header.Version = MOVIE_VERSION;
+		Header.Flags = 0;
+		Header.ROMID = gb->ROMID ();
+		Header.HashEvery = HashEvery;
+		Header.SRAMSize = SRAMSize;
+		Header.SRAMStored = Compression::Compress (Battery, SRAMSize, SRAM, Compression::Bound (SRAMSize));
+		
+		fwrite (&Header, sizeof (Header), 1, File);
+		fwrite (SRAM, 1, Header.SRAMStored, File);
+		free (SRAM);
+		free (Battery);
+		
+		Valid = 1;
+		return;
+	}
+	
+	// Play: read it all
+	File = fopen (Filename, "rb");
+	if (File == NULL) {
+		printf ("[ERR] Can't open movie %s\n", Filename);
+		return;
+	}
+	
+	MovieHeader Header;
+	if (fread (&Header, sizeof (Header), 1, File) != 1 || Header.Magic != MOVIE_MAGIC || Header.Version != MOVIE_VERSION) {
+		printf ("[ERR] %s is not a movie, or from another version\n", Filename);
+		return;
+	}
+	
+	if (Header.ROMID != gb->ROMID ())
+		printf ("[WARN] Movie was recorded on another game\n");
+	
+	HashEvery = Header.HashEvery;
+	
+	uint8_t* SRAM = (uint8_t*) malloc (Header.SRAMStored);
+	uint8_t* Battery = (uint8_t*) malloc (SRAMSize);
+	if (Header.SRAMSize != SRAMSize || fread (SRAM, 1, Header.SRAMStored, File) != Header.SRAMStored ||
+		Compression::Decompress (SRAM, Header.SRAMStored, Battery, SRAMSize) != SRAMSize) {
+		printf ("[ERR] Movie battery RAM doesn't match the game\n");
+		free (SRAM);
+		free (Battery);
+		return;
+	}
+	gb->mmu->SetExternalRAM (Battery, SRAMSize);
+	free (SRAM);
+	free (Battery);
+	
+	long Start = ftell (File);
+	fseek (File, 0, SEEK_END);
+	RecordCount = (ftell (File) - Start) / sizeof (MovieRecord);
+	fseek (File, Start, SEEK_SET);
+	
+	Records = (MovieRecord*) malloc ((RecordCount + 1) * sizeof (MovieRecord));
+	RecordCount = fread (Records, sizeof (MovieRecord), RecordCount, File);
+	fclose (File);
+	File = NULL;
+	
+	Valid = 1;
+	printf ("[INFO] Playing movie %s (%d records)\n", Filename, RecordCount);
+}
+
+Movie::~Movie () {
+	if (File) { // Recording
+		Write (MOVIE_END, 0, 0);
+		fclose (File);
+	}
+	free (Records);
+}
+
+uint32_t Movie::FrameHash () {
+	return (uint32_t) Utils::HashFrame (gb->ppu->GetFrame (), 160 * 144);
+}
+
+void Movie::Write (uint8_t Type, uint8_t Buttons, uint32_t Data) {
+	MovieRecord Record;
+	Record.Type = Type;
+	Record.Buttons = Buttons;
+	Record.Reserved = 0;
+	Record.Frame = gb->ppu->FrameCount;
+	Record.Clock = gb->cpu->ClockCount;
+	Record.Data = Data;
+	fwrite (&Record, sizeof (Record), 1, File);
+}
+
+void Movie::RecordInput (uint8_t Buttons) {
+	if (Mode == MOVIE_RECORD && Valid)
+		Write (MOVIE_INPUT, Buttons, 0);
+}
+
+uint8_t Movie::Poll (uint8_t &Buttons) {
+	if (Cursor >= RecordCount)
+		return 0;
+	
+	MovieRecord* Record = Records + Cursor;
+	if (Record->Type != MOVIE_INPUT)
+		return 0; // Hashes and the end wait for their frame
+	
+	uint32_t Frame = gb->ppu->FrameCount;
+	if (Frame < Record->Frame || (Frame == Record->Frame && gb->cpu->ClockCount != Record->Clock))
+		return 0;
+	
+	if (Frame > Record->Frame) // Went past it, not the same run anymore
+		Desyncs++;
+	
+	Cursor++;
+	Buttons = Record->Buttons;
+	return 1;
+}
+
+void Movie::FrameDone () {
+	if (!Valid)
+		return;
+	
+	uint32_t Frame = gb->ppu->FrameCount;
+	
+	if (Mode == MOVIE_RECORD) {
+		if (Frame % HashEvery == 0)
+			Write (MOVIE_HASH, 0, FrameHash ());
+		return;
+	}
+	
+	while (Cursor < RecordCount && Records [Cursor].Type == MOVIE_HASH && Records [Cursor].Frame <= Frame) {
+		if (Records [Cursor].Frame == Frame) {
+			HashesChecked++;
+			if (Records [Cursor].Data != FrameHash ()) {
+				if (Mismatches == 0)
+					printf ("[ERR] Movie frame %d doesn't match the recording\n", Frame);
+				Mismatches++;
+			}
+		}
+		Cursor++;
+	}
+	
+	if (Cursor >= RecordCount || (Records [Cursor].Type == MOVIE_END && Frame >= Records [Cursor].Frame))
+		Finished = 1;
+}
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "GameBoy.h"
+#include "utils.h"
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#define MOVIE_MAGIC 0x564D4247 // "GBMV"
+#define MOVIE_VERSION 1
+
+// Modes
+#define MOVIE_RECORD 0
+#define MOVIE_PLAY 1
+
+// Record types
+#define MOVIE_INPUT 1 // Buttons = new joypad state
+#define MOVIE_HASH 2 // Data = frame hash
+#define MOVIE_END 3
+
+struct MovieHeader {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t Flags;
+	uint32_t ROMID;
+	uint32_t HashEvery;
+	uint32_t SRAMSize; // Battery RAM at power on, compressed after the header
+	uint32_t SRAMStored;
+};
+
+// Everything is keyed by emulated frame and clock, never by host time
+struct MovieRecord {
+	uint8_t Type;
+	uint8_t Buttons;
+	uint16_t Reserved;
+	uint32_t Frame; // PPU frame count
+	uint32_t Clock; // CPU clock count, exact
+	uint32_t Data;
+};
+
+/* Joypad movie, from power on. Recording appends records as they happen;
+   playing applies them at the same frame and clock and checks the frame hashes.
+   A movie is one uninterrupted run: no resets, state loads or rewinding. */
+class Movie {
+	public:
+		Movie (const char* Filename, uint8_t _Mode, GameBoy* _gb, uint32_t _HashEvery); // _HashEvery only when recording
+		~Movie ();
+		
+		void RecordInput (uint8_t Buttons);
+		uint8_t Poll (uint8_t &Buttons); // Playing, call before every step. 1 - Buttons changed now
+		
+		void FrameDone (); // Hash every N frames, writes or checks them
+		
+		uint8_t Mode;
+		uint8_t Valid = 0;
+		uint8_t Finished = 0; // Played to the end
+		uint32_t HashesChecked = 0;
+		uint32_t Mismatches = 0;
+		uint32_t Desyncs = 0; // Inputs applied late because their clock never came
+	private:
+		GameBoy* gb;
+		FILE* File = NULL;
+		uint32_t HashEvery;
+		
+		MovieRecord* Records = NULL;
+		uint32_t RecordCount = 0;
+		uint32_t Cursor = 0;
+		
+		void Write (uint8_t Type, uint8_t Buttons, uint32_t Data);
+		uint32_t FrameHash ();
+};
+
+#endif
@@ -1,42 +1,55 @@
 #include "PPU.h"
 
-const uint16_t Colors [4] = {0xffff, 0xaaaa, 0x5555, 0x0000};
-
-uint8_t BGPalette [4];
-uint8_t SpritePalette0 [4];
-uint8_t SpritePalette1 [4];
+// Output palettes (ARGB8888), indexed by shade: 0 - Lightest, 3 - Darkest
+const uint32_t Palettes [][4] = {
+	{0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000}, // PALETTE_GRAYSCALE
+	{0xFF9BBC0F, 0xFF8BAC0F, 0xFF306230, 0xFF0F380F}, // PALETTE_DMG_GREEN
+	{0xFFE0F8D0, 0xFF88C070, 0xFF346856, 0xFF081820}  // PALETTE_POCKET
+};
 
 using namespace Utils;
 
-PPU::PPU (const char* Title, const uint16_t _PixelSize) {
-	PixelSize = _PixelSize;
-	
-	MainWindow = SDL_CreateWindow (Title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, Width * PixelSize, Height * PixelSize, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-	MainRenderer = SDL_CreateRenderer(MainWindow, -1, SDL_RENDERER_ACCELERATED);
-	MainTexture = SDL_CreateTexture (MainRenderer, SDL_PIXELFORMAT_ARGB4444, SDL_TEXTUREACCESS_STREAMING, Width, Height);
-	SDL_SetRenderDrawColor(MainRenderer, 0x00, 0x00, 0x00, 0x00);
-	SDL_RenderClear(MainRenderer);
+PPU::PPU (Scheduler* _Events) {
+	Events = _Events;
+	Reset ();
+	SetPalette (PALETTE_GRAYSCALE);
 }
 
-PPU::~PPU () {
-	SDL_DestroyTexture (MainTexture);
-	SDL_DestroyRenderer (MainRenderer);
-	SDL_DestroyWindow (MainWindow);
+void PPU::Reset () {
+	CurrentY = 0;
+	LCDOn = 0;
+	LineStart = 0;
+	TransferClocks = 0;
+	SpriteCount = 0;
+	FrameCount = 0;
+	SkipRendering = 0;
+	ShowAhead = 0;
+	
+	memset (OAMQueue, 0, sizeof (OAMQueue));
+	memset (BGPalette, 0, sizeof (BGPalette));
+	memset (SpritePalette0, 0, sizeof (SpritePalette0));
+	memset (SpritePalette1, 0, sizeof (SpritePalette1));
+	memset (Pixels, 0, sizeof (Pixels));
+	memset (PixelsReady, 0, sizeof (PixelsReady));
+	
+	Events->Cancel (EVENT_LCD_LINE);
+	Events->Cancel (EVENT_LCD_HBLANK);
+	Events->Cancel (EVENT_LCD_STAT);
 }
 
-inline void PPU::SetPixel (uint32_t CoordX, uint32_t CoordY, uint32_t Color) {
+inline void PPU::SetPixel (uint32_t CoordX, uint32_t CoordY, uint8_t Color) {
 	uint32_t PixelNo = CoordY * Width + CoordX;
 	Pixels [PixelNo] = Color;
 }
 
-void PPU::OAMSearch (uint8_t* Memory, uint8_t* IOMap) {
+void PPU::OAMSearch (const uint8_t* OAM, uint8_t* IOMap) {
 	uint8_t SpriteSize = 8 + (GetBit (IOMap [0x40], 2) << 3); // 8x8 or 8x16
 	uint8_t QueueNumber = 0;
 	
-	for (int i = 0xFE00; i <= 0xFE9F; i += 4) {
-		if (CurrentY + 16 >= Memory[i] && CurrentY + 16 < Memory[i] + SpriteSize) { // Y Position
+	for (int i = 0; i < 0xA0; i += 4) {
+		if (CurrentY + 16 >= OAM[i] && CurrentY + 16 < OAM[i] + SpriteSize) { // Y Position
 			//printf ("%d: Load sprite at %d\n", QueueNumber, CurrentY);
-			memcpy (OAMQueue + (QueueNumber << 2), Memory + i, 4);
+			memcpy (OAMQueue + (QueueNumber << 2), OAM + i, 4);
 			QueueNumber++;
 			if (QueueNumber == 10) // Max 10 sprites per line
 				break;
@@ -46,20 +59,192 @@ void PPU::OAMSearch (uint8_t* Memory, uint8_t* IOMap) {
 	SpriteCount = QueueNumber;
 }
 
-void PPU::Render () {
-	SDL_UpdateTexture (MainTexture, NULL, PixelsReady, 2 * Width);
-	SDL_RenderCopy (MainRenderer, MainTexture, NULL, NULL);
-	SDL_RenderPresent (MainRenderer);
+void PPU::SetPalette (uint8_t ID) {
+	if (ID >= sizeof (Palettes) / sizeof (Palettes [0]))
+		ID = PALETTE_GRAYSCALE;
+	
+	SetColors (Palettes [ID]);
+}
+
+void PPU::SetColors (const uint32_t* Colors) {
+	memcpy (OutputPalette, Colors, sizeof (OutputPalette));
+	
+	for (int i = 0; i < 4; i++) { // ARGB8888 -> ARGB4444, keep the upper nibble of every channel
+		uint32_t Color = Colors [i];
+		OutputPalette16 [i] = ((Color >> 16) & 0xF000) | ((Color >> 12) & 0x0F00) | ((Color >> 8) & 0x00F0) | ((Color >> 4) & 0x000F);
+	}
+}
+
+void PPU::ConvertFrame (uint32_t* Out) {
+	const uint8_t* Shades = ShowAhead ? PixelsAhead : PixelsReady;
+	for (int i = 0; i < 160 * 144; i++)
+		Out [i] = OutputPalette [Shades [i]];
+}
+
+void PPU::KeepAheadFrame () {
+	memcpy (PixelsAhead, PixelsReady, sizeof (PixelsAhead));
+	ShowAhead = 1;
+}
+
+void PPU::ConvertFrame (uint16_t* Out) {
+	const uint8_t* Shades = ShowAhead ? PixelsAhead : PixelsReady;
+	for (int i = 0; i < 160 * 144; i++)
+		Out [i] = OutputPalette16 [Shades [i]];
+}
+
+void PPU::SyncState (StateStream &State) {
+	State.Sync (CurrentY);
+	State.Sync (LCDOn);
+	State.Sync (LineStart);
+	State.Sync (TransferClocks);
+	State.Sync (SpriteCount);
+	State.Sync (FrameCount);
+	State.Bytes (OAMQueue, sizeof (OAMQueue));
+	State.Bytes (BGPalette, sizeof (BGPalette));
+	State.Bytes (SpritePalette0, sizeof (SpritePalette0));
+	State.Bytes (SpritePalette1, sizeof (SpritePalette1));
+	State.Bytes (Pixels, sizeof (Pixels));
+	State.Bytes (PixelsReady, sizeof (PixelsReady));
+}
+
+// LCD Timing
+void PPU::Position (uint32_t Clock, uint8_t &Line, uint32_t &Offset) {
+	Line = CurrentY;
+	Offset = Clock - LineStart;
+	while (Offset >= LCD_LINE_CLOCKS) { // Line end due, but not taken yet (mid-instruction, DMA)
+		Offset -= LCD_LINE_CLOCKS;
+		Line = (Line + 1) % LCD_LINES;
+	}
+}
+
+uint8_t PPU::Mode (uint32_t Clock) {
+	if (!LCDOn)
+		return 0;
+	
+	uint8_t Line;
+	uint32_t Offset;
+	Position (Clock, Line, Offset);
+	
+	if (Line >= Height)
+		return 1;
+	if (Offset < LCD_OAM_CLOCKS)
+		return 2;
+	if (Offset < LCD_OAM_CLOCKS + TransferClocks)
+		return 3;
+	return 0;
+}
+
+uint8_t PPU::ReadRegister (uint16_t Address, uint8_t* IOMap, uint32_t Clock) {
+	uint8_t Line = 0;
+	uint32_t Offset;
+	if (LCDOn)
+		Position (Clock, Line, Offset);
+	
+	if (Address == 0xFF44) // LY
+		return Line;
+	
+	// STAT: Interrupt selection as written, LY = LYC, Mode
+	return 0x80 | (IOMap [0x41] & 0x78) | ((Line == IOMap [0x45]) << 2) | Mode (Clock);
 }
 
-void PPU::Update (uint8_t* Memory, uint8_t* IOMap) {
-	uint16_t BGTable = 0x9800;
-	uint16_t WindowTable = 0x9800;
+void PPU::WriteRegister (uint16_t Address, uint8_t Value, const uint8_t* OAM, uint8_t* IOMap, uint32_t Clock) {
+	switch (Address) {
+		case 0xFF40: { // LCDC, the LCD starts on line 0 when turned on, and stays there while off
+			IOMap [0x40] = Value;
+			if (GetBit (Value, 7) == LCDOn)
+				return;
+			
+			LCDOn = GetBit (Value, 7);
+			CurrentY = 0;
+			IOMap [0x44] = 0;
+			if (LCDOn) {
+				LineStart = Clock;
+				if (StartLine (OAM, IOMap) & LCD_INT_STAT)
+					Events->Schedule (EVENT_LCD_STAT, Clock);
+			} else {
+				Events->Cancel (EVENT_LCD_LINE);
+				Events->Cancel (EVENT_LCD_HBLANK);
+			}
+			return;
+		}
+		case 0xFF41: // STAT, only the interrupt selection is writable
+			IOMap [0x41] = Value & 0x78;
+			if (LCDOn)
+				ScheduleHBlank (IOMap, Clock);
+			return;
+		case 0xFF45: { // LYC, matching the current line now raises the interrupt right away
+			uint8_t Line = 0;
+			uint32_t Offset;
+			if (LCDOn)
+				Position (Clock, Line, Offset);
+			
+			uint8_t Matched = (Line == IOMap [0x45]);
+			IOMap [0x45] = Value;
+			if (LCDOn && !Matched && Line == Value && GetBit (IOMap [0x41], 6))
+				Events->Schedule (EVENT_LCD_STAT, Clock);
+			return;
+		}
+		default: break;
+	}
+}
+
+uint8_t PPU::Event (uint8_t ID, const uint8_t* VRAM, const uint8_t* OAM, uint8_t* IOMap) {
+	switch (ID) {
+		case EVENT_LCD_LINE: // Draw the line that ended, go on with the next
+			Update (VRAM, IOMap);
+			LineStart += LCD_LINE_CLOCKS;
+			return StartLine (OAM, IOMap);
+		case EVENT_LCD_HBLANK:
+			return GetBit (IOMap [0x41], 3) ? LCD_INT_STAT : 0;
+		case EVENT_LCD_STAT:
+			return LCD_INT_STAT;
+		default: return 0;
+	}
+}
+
+uint8_t PPU::StartLine (const uint8_t* OAM, uint8_t* IOMap) {
+	uint8_t Interrupts = 0;
+	
+	if (CurrentY < Height) { // OAM Search now, it decides how long the transfer takes
+		OAMSearch (OAM, IOMap);
+		TransferClocks = 168 + (SpriteCount * (291 - 168)) / 10; // 10 Sprites should cause maximum duration = 291 Clocks
+		ScheduleHBlank (IOMap, LineStart);
+		
+		if (GetBit (IOMap [0x41], 5))
+			Interrupts |= LCD_INT_STAT;
+	} else if (CurrentY == Height) { // VBlank
+		Interrupts |= LCD_INT_VBLANK;
+		if (GetBit (IOMap [0x41], 4))
+			Interrupts |= LCD_INT_STAT;
+	}
+	
+	if (CurrentY == IOMap [0x45] && GetBit (IOMap [0x41], 6)) // Coincidence LY, LYC
+		Interrupts |= LCD_INT_STAT;
+	
+	Events->Schedule (EVENT_LCD_LINE, LineStart + LCD_LINE_CLOCKS);
+	return Interrupts;
+}
+
+void PPU::ScheduleHBlank (uint8_t* IOMap, uint32_t Clock) {
+	uint8_t Line;
+	uint32_t Offset;
+	Position (Clock, Line, Offset);
+	
+	// Only when it is selected and still ahead on this line, the next line schedules its own
+	if (Line == CurrentY && CurrentY < Height && GetBit (IOMap [0x41], 3) && Offset < LCD_OAM_CLOCKS + TransferClocks)
+		Events->Schedule (EVENT_LCD_HBLANK, LineStart + LCD_OAM_CLOCKS + TransferClocks);
+	else
+		Events->Cancel (EVENT_LCD_HBLANK);
+}
+
+void PPU::Update (const uint8_t* VRAM, uint8_t* IOMap) {
+	uint16_t BGTable = 0x1800; // Offsets into VRAM
+	uint16_t WindowTable = 0x1800;
 	if (GetBit (IOMap [0x40], 3))
-		BGTable = 0x9C00;
+		BGTable = 0x1C00;
 	
 	if (GetBit (IOMap [0x40], 6))
-		WindowTable = 0x9C00;
+		WindowTable = 0x1C00;
 		
 	uint8_t BGAddressingMode = GetBit (IOMap [0x40], 4); // 0 - Signed (0x8000), 1 - Unsigned (0x9000)
 	
@@ -82,32 +267,32 @@ void PPU::Update (uint8_t* Memory, uint8_t* IOMap) {
 		SpritePalette1 [3] = GetBit (IOMap [0x49], 6) | (GetBit (IOMap [0x49], 7) << 1);
 	}
 
-	if (CurrentY < Height) {
+	if (CurrentY < Height && !SkipRendering) {
 		for (int CurrentX = 0; CurrentX < Width; CurrentX++) {
-			uint32_t ColorToDraw = Colors [BGPalette [0]];
+			uint8_t ColorToDraw = BGPalette [0];
 			
 			uint8_t BGColor = 0;
 			if (GetBit (IOMap [0x40], 0)) { // BG Display + Window Display (DMG Only)
 				uint8_t BGX = CurrentX + IOMap[0x43];
 				uint8_t BGY = CurrentY + IOMap[0x42];
 				
-				uint8_t BGTile = Memory [BGTable + ((BGY >> 3) << 5) + (BGX >> 3)];
+				uint8_t BGTile = VRAM [BGTable + ((BGY >> 3) << 5) + (BGX >> 3)];
 				uint8_t PixelX = BGX & 0x7;
 				uint8_t PixelY = BGY & 0x7;
 				
-				uint8_t* BGTileData;
+				const uint8_t* BGTileData;
 				
 				if (BGAddressingMode)
-					BGTileData = Memory + (0x8000 + (BGTile << 4));
+					BGTileData = VRAM + (BGTile << 4);
 				else
-					BGTileData = Memory + (0x9000 + (int8_t) BGTile * 16);
+					BGTileData = VRAM + (0x1000 + (int8_t) BGTile * 16);
 				
 				// First Byte: LSB of Color for Pixel (PixelX, PixelY)
 				// Second Byte: MSB ~~~
 				
 				uint8_t Color = (GetBit (BGTileData [PixelY * 2 + 1], 7 - PixelX) << 1) | GetBit (BGTileData [PixelY * 2], 7 - PixelX);
 				BGColor = Color;
-				ColorToDraw = Colors [BGPalette [Color]];
+				ColorToDraw = BGPalette [Color];
 			}
 			
 			if (GetBit (IOMap [0x40], 0) && GetBit (IOMap [0x40], 5)) { // Window Display
@@ -118,21 +303,21 @@ void PPU::Update (uint8_t* Memory, uint8_t* IOMap) {
 					uint8_t WindowX = CurrentX + 7 - CoordX;
 					uint8_t WindowY = CurrentY - CoordY;
 					
-					uint8_t WindowTile = Memory [WindowTable + ((WindowY >> 3) << 5) + (WindowX >> 3)];
+					uint8_t WindowTile = VRAM [WindowTable + ((WindowY >> 3) << 5) + (WindowX >> 3)];
 					uint8_t PixelX = WindowX & 0x7;
 					uint8_t PixelY = WindowY & 0x7;
 					
-					uint8_t* WindowTileData;
+					const uint8_t* WindowTileData;
 					if (BGAddressingMode)
-						WindowTileData = Memory + (0x8000 + (WindowTile << 4));
+						WindowTileData = VRAM + (WindowTile << 4);
 					else
-						WindowTileData = Memory + (0x9000 + (int8_t) WindowTile * 16);
+						WindowTileData = VRAM + (0x1000 + (int8_t) WindowTile * 16);
 
 					// First Byte: LSB of Color for Pixel (PixelX, PixelY)
 					// Second Byte: MSB ~~~
 
 					uint8_t Color = (GetBit (WindowTileData [PixelY * 2 + 1], 7 - PixelX) << 1) | GetBit (WindowTileData [PixelY * 2], 7 - PixelX);
-					ColorToDraw = Colors [BGPalette [Color]]; // Shared with BG
+					ColorToDraw = BGPalette [Color]; // Shared with BG
 				}
 			}
 			
@@ -151,7 +336,7 @@ void PPU::Update (uint8_t* Memory, uint8_t* IOMap) {
 						if (GetBit (IOMap [0x40], 2)) // Ignore bit 0 if 8x16
 							SetBit (SpriteTile, 0, 0);
 							
-						uint8_t* SpriteTileData = Memory + (0x8000 + (SpriteTile << 4));
+						const uint8_t* SpriteTileData = VRAM + (SpriteTile << 4);
 						uint8_t Color = 0;
 						
 						if (GetBit (OAMQueue [i + 3], 5)) // Flip X
@@ -178,9 +363,9 @@ void PPU::Update (uint8_t* Memory, uint8_t* IOMap) {
 								MinX = CoordX;
 								if (GetBit (OAMQueue [i + 3], 7)) { // Above only if BG Color is 0
 									if (BGColor == 0)
-										ColorToDraw = Colors [Color];
+										ColorToDraw = Color;
 								} else
-									ColorToDraw = Colors [Color]; // Above BG
+									ColorToDraw = Color; // Above BG
 							}
 						}
 					}
@@ -194,6 +379,9 @@ void PPU::Update (uint8_t* Memory, uint8_t* IOMap) {
 	CurrentY = (CurrentY + 1) % 154;
 	IOMap [0x44] = CurrentY; // Update current line that's being scanned
 	
-	if (CurrentY == 0) // End of Frame, Save the good pixels to be drawn at 60 Hz afterwards
-		memcpy (PixelsReady, Pixels, sizeof (Pixels));
+	if (CurrentY == 0) { // End of Frame, Save the good pixels to be drawn at 60 Hz afterwards
+		if (!SkipRendering)
+			memcpy (PixelsReady, Pixels, sizeof (Pixels));
+		FrameCount++;
+	}
 }
\ No newline at end of file
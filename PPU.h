@@ -1,33 +1,81 @@
 #include <stdint.h>
-#include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "utils.h"
+#include "State.h"
+#include "Scheduler.h"
 #ifndef PPU_H
 #define PPU_H
 
+// Output Palettes
+#define PALETTE_GRAYSCALE 0
+#define PALETTE_DMG_GREEN 1
+#define PALETTE_POCKET 2
+
+// LCD Timing, in clocks
+#define LCD_LINE_CLOCKS 456
+#define LCD_OAM_CLOCKS 80
+#define LCD_LINES 154
+
+// Interrupts raised by LCD events, for the caller
+#define LCD_INT_VBLANK 0x01
+#define LCD_INT_STAT 0x02
+
 class PPU {
 public:
-	PPU (const char* Title, const uint16_t _PixelSize);
-	~PPU ();
-	void OAMSearch (uint8_t* Memory, uint8_t* IOMap);
-	void Update (uint8_t* Memory, uint8_t* IOMap);
-	void Render ();
+	PPU (Scheduler* _Events);
+	void Reset (); // Emulated state only, the output settings stay
+	void OAMSearch (const uint8_t* OAM, uint8_t* IOMap);
+	void Update (const uint8_t* VRAM, uint8_t* IOMap); // VRAM from 0x8000
+	
+	/* LCD Timing - Only the start of the current line is kept: LY, the STAT mode and the LY = LYC flag are
+	   computed from it when read. Line ends, HBlank and STAT interrupts are scheduled events */
+	uint8_t ReadRegister (uint16_t Address, uint8_t* IOMap, uint32_t Clock); // STAT, LY
+	void WriteRegister (uint16_t Address, uint8_t Value, const uint8_t* OAM, uint8_t* IOMap, uint32_t Clock); // LCDC, STAT, LYC
+	uint8_t Mode (uint32_t Clock); // 0 - HBlank, 1 - VBlank, 2 - OAM Search, 3 - Pixel Transfer
+	uint8_t Event (uint8_t ID, const uint8_t* VRAM, const uint8_t* OAM, uint8_t* IOMap); // EVENT_LCD_*, returns the LCD_INT_* to raise
+	void SyncState (StateStream &State);
+	
+	// Output - The frame is kept as shades (0-3), colors are only applied when presenting / exporting
+	void SetPalette (uint8_t ID);
+	void SetColors (const uint32_t* Colors); // 4 ARGB8888 Colors, lightest first
+	void ConvertFrame (uint32_t* Out); // ARGB8888, 160 * 144
+	void ConvertFrame (uint16_t* Out); // ARGB4444, 160 * 144
+	const uint8_t* GetFrame () { return PixelsReady; }
+	const uint32_t* GetColors () { return OutputPalette; }
+	
+	void KeepAheadFrame (); // Present the frame just completed from now on, even after a state is loaded over it (run-ahead)
+	
 	uint8_t SpriteCount = 0;
+	uint32_t FrameCount = 0; // Completed frames
+	uint8_t SkipRendering = 0; // Keep timing and registers, don't draw pixels
 private:
-	uint16_t PixelSize;
 	uint8_t CurrentY = 0;
+	Scheduler* Events;
+	uint8_t LCDOn = 0;
+	uint32_t LineStart = 0; // Clock CurrentY started at
+	uint32_t TransferClocks = 0; // Pixel transfer of the current line, longer with more sprites
 	uint16_t Width = 160; // 160
 	uint16_t Height = 144; // 144
-	SDL_Window* MainWindow;
-	SDL_Renderer* MainRenderer;
-	SDL_Texture* MainTexture;
-	uint16_t Pixels [160 * 144];
-	uint16_t PixelsReady [160 * 144]; // When rendering, use these
+	uint8_t Pixels [160 * 144]; // Shades
+	uint8_t PixelsReady [160 * 144]; // When rendering, use these
+	uint8_t PixelsAhead [160 * 144]; // Run-ahead frame to present instead
+	uint8_t ShowAhead = 0;
 	uint8_t OAMQueue [10 * 4]; // 10 Sprites, 4 Bytes each
+	uint8_t BGPalette [4] = {0, 0, 0, 0};
+	uint8_t SpritePalette0 [4] = {0, 0, 0, 0};
+	uint8_t SpritePalette1 [4] = {0, 0, 0, 0};
+	
+	uint32_t OutputPalette [4];
+	uint16_t OutputPalette16 [4];
 	
 	// Drawing Functions
-	void SetPixel (uint32_t CoordX, uint32_t CoordY, uint32_t Color);
+	void SetPixel (uint32_t CoordX, uint32_t CoordY, uint8_t Color);
+	
+	// Timing Functions
+	void Position (uint32_t Clock, uint8_t &Line, uint32_t &Offset); // Line and clocks into it at Clock
+	uint8_t StartLine (const uint8_t* OAM, uint8_t* IOMap); // Returns the LCD_INT_* to raise
+	void ScheduleHBlank (uint8_t* IOMap, uint32_t Clock);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "Profiler.h"
+#ifdef PROFILE
+#include <chrono>
+#include <string.h>
+
+namespace Profiler {
+	uint64_t Opcodes [256];
+	uint64_t CBOpcodes [256];
+	uint64_t Time [PROF_SUBSYSTEMS];
+	uint64_t Overshoot [PROF_OVERSHOOT_BUCKETS];
+	uint8_t Current = PROF_OTHER;
+	uint64_t Mark = 0;
+	volatile sig_atomic_t DumpRequested = 0;
+	
+	static uint64_t StartTicks;
+	static std::chrono::steady_clock::time_point StartTime;
+	static const char* Names [PROF_SUBSYSTEMS] = {"other", "cpu", "io", "ppu", "timers", "apu", "present", "sleep"};
+	
+	static void OnSignal (int) {
+		DumpRequested = 1;
+	}
+	
+	void Start () {
+		memset (Time, 0, sizeof (Time)); // Drop anything profiled while setting up
+		StartTime = std::chrono::steady_clock::now ();
+		StartTicks = Mark = Ticks ();
+		signal (SIGUSR1, OnSignal);
+	}
+	
+	void AddOvershoot (uint64_t Nanoseconds) {
+		uint64_t us = Nanoseconds / 1000;
+		uint8_t Bucket = 0;
+		while (us && Bucket < PROF_OVERSHOOT_BUCKETS - 1) {
+			us >>= 1;
+			Bucket++;
+		}
+		Overshoot [Bucket]++;
+	}
+	
+	static void WriteCounts (FILE* File, const char* Name, const uint64_t* Counts) {
+		fprintf (File, "\t\"%s\": {", Name);
+		const char* Separator = "";
+		for (int i = 0; i < 256; i++) {
+			if (Counts [i] == 0)
+				continue;
+			fprintf (File, "%s\"%02X\": %llu", Separator, i, (unsigned long long) Counts [i]);
+			Separator = ", ";
+		}
+		fprintf (File, "},\n");
+	}
+	
+	void Write (const char* Filename, uint64_t Clocks, uint64_t Instructions) {
+		Enter (Current); // Charge up to now
+		
+		double Seconds = std::chrono::duration <double> (std::chrono::steady_clock::now () - StartTime).count ();
+		double SecondsPerTick = (Mark > StartTicks) ? Seconds / (Mark - StartTicks) : 0;
+		
+		FILE* File = fopen (Filename, "w");
+		if (File == NULL) {
+			printf ("[ERR] Can't write profile %s\n", Filename);
+			return;
+		}
+		
+		fprintf (File, "{\n\t\"seconds\": %.6f,\n\t\"clocks\": %llu,\n\t\"instructions\": %llu,\n", Seconds,
+			(unsigned long long) Clocks, (unsigned long long) Instructions);
+		
+		fprintf (File, "\t\"subsystems\": {");
+		for (int i = 0; i < PROF_SUBSYSTEMS; i++)
+			fprintf (File, "%s\"%s\": %.6f", i ? ", " : "", Names [i], Time [i] * SecondsPerTick);
+		fprintf (File, "},\n");
+		
+		WriteCounts (File, "opcodes", Opcodes);
+		WriteCounts (File, "cb_opcodes", CBOpcodes);
+		
+		fprintf (File, "\t\"overshoot_us\": {\"below\": [");
+		for (int i = 0; i < PROF_OVERSHOOT_BUCKETS; i++)
+			fprintf (File, "%s%d", i ? ", " : "", 1 << i);
+		fprintf (File, "], \"count\": [");
+		for (int i = 0; i < PROF_OVERSHOOT_BUCKETS; i++)
+			fprintf (File, "%s%llu", i ? ", " : "", (unsigned long long) Overshoot [i]);
+		fprintf (File, "]}\n}\n");
+		
+		fclose (File);
+		printf ("[INFO] Profile written to %s\n", Filename);
+	}
+}
+
+#endif
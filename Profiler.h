@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdio.h>
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Subsystems, host time is charged to the innermost one
+#define PROF_OTHER 0 // Main loop, outside every scope
+#define PROF_CPU 1
+#define PROF_IO 2 // MMU accesses to FF00 - FF7F
+#define PROF_PPU 3 // Line drawing, OAM search
+#define PROF_TIMERS 4 // LCD modes, timer, DIV, interrupts
+#define PROF_APU 5 // Catching up sound, sample generation
+#define PROF_PRESENT 6 // Window, video / shared memory output
+#define PROF_SLEEP 7 // Throttling
+#define PROF_SUBSYSTEMS 8
+
+#define PROF_OVERSHOOT_BUCKETS 16 // Bucket N: below 2^N us, the last one takes the rest
+
+/* Compiled in with `make PROFILE=1`, otherwise every hook is empty.
+   Time is taken with the TSC where there is one, and only converted when written. */
+#ifdef PROFILE
+#include <signal.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+namespace Profiler {
+	extern uint64_t Opcodes [256];
+	extern uint64_t CBOpcodes [256];
+	extern uint64_t Time [PROF_SUBSYSTEMS]; // Ticks
+	extern uint64_t Overshoot [PROF_OVERSHOOT_BUCKETS];
+	extern uint8_t Current;
+	extern uint64_t Mark;
+	extern volatile sig_atomic_t DumpRequested; // SIGUSR1
+	
+	inline uint64_t Ticks () {
+#if defined (__x86_64__) || defined (__i386__)
+		return __rdtsc ();
+#else
+		timespec Now;
+		clock_gettime (CLOCK_MONOTONIC, &Now);
+		return (uint64_t) Now.tv_sec * 1000000000 + Now.tv_nsec;
+#endif
+	}
+	
+	// Charge the time since the last switch to the running subsystem, then switch
+	inline uint8_t Enter (uint8_t ID) {
+		uint64_t Now = Ticks ();
+		Time [Current] += Now - Mark;
+		Mark = Now;
+		uint8_t Previous = Current;
+		Current = ID;
+		return Previous;
+	}
+	
+	void Start ();
+	void AddOvershoot (uint64_t Nanoseconds);
+	void Write (const char* Filename, uint64_t Clocks, uint64_t Instructions);
+}
+
+class ProfileScope {
+	public:
+		ProfileScope (uint8_t ID, bool _Active = true) : Active (_Active) { if (Active) Previous = Profiler::Enter (ID); }
+		~ProfileScope () { if (Active) Profiler::Enter (Previous); }
+	private:
+		bool Active;
+		uint8_t Previous = 0;
+};
+
+#define PROFILE_SCOPE(ID) ProfileScope ProfiledScope (ID)
+#define PROFILE_SCOPE_IF(Condition, ID) ProfileScope ProfiledScope (ID, Condition)
+#define PROFILE_OPCODE(Opcode) Profiler::Opcodes [Opcode]++
+#define PROFILE_CB_OPCODE(Opcode) Profiler::CBOpcodes [Opcode]++
+#define PROFILE_OVERSHOOT(Nanoseconds) Profiler::AddOvershoot (Nanoseconds)
+#else
+#define PROFILE_SCOPE(ID)
+#define PROFILE_SCOPE_IF(Condition, ID)
+#define PROFILE_OPCODE(Opcode)
+#define PROFILE_CB_OPCODE(Opcode)
+#define PROFILE_OVERSHOOT(Nanoseconds)
+#endif
+
+#endif
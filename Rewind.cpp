@@ -0,0 +1,148 @@
+#include "Rewind.h"
+#include "Compress.h"
+
+Rewind::Rewind (GameBoy* _gb, uint32_t _Budget) {
+	gb = _gb;
+	Budget = _Budget;
+	StateSize = gb->StateSize ();
+	
+	Pending = (uint8_t*) malloc (StateSize);
+	Work = (uint8_t*) malloc (StateSize);
+	Current = (uint8_t*) malloc (StateSize);
+	Scratch = (uint8_t*) malloc (Compression::Bound (StateSize));
+	Storage = (uint8_t*) malloc (Budget);
+	
+	Worker = std::thread (&Rewind::WorkerLoop, this);
+}
+
+Rewind::~Rewind () {
+	Lock.lock ();
+	Quit = 1;
+	Lock.unlock ();
+	Changed.notify_all ();
+	Worker.join ();
+	
+	free (Pending);
+	free (Work);
+	free (Current);
+	free (Scratch);
+	free (Storage);
+}
+
+void Rewind::Capture () {
+	std::lock_guard <std::mutex> Guard (Lock);
+	
+	if (PendingFull) { // Worker fell behind, keep the one it has
+		Skipped++;
+		return;
+	}
+	
+	gb->SaveState (Pending, StateSize);
+	PendingFull = 1;
+	AtCurrent = 0;
+	Captured++;
+	Changed.notify_all ();
+}
+
+void Rewind::XOR (uint8_t* Out, const uint8_t* In, uint32_t Size) {
+	uint32_t i = 0;
+	for (; i + 8 <= Size; i += 8) {
+		uint64_t A, B;
+		memcpy (&A, Out + i, 8);
+		memcpy (&B, In + i, 8);
+		A ^= B;
+		memcpy (Out + i, &A, 8);
+	}
+	for (; i < Size; i++)
+		Out [i] ^= In [i];
+}
+
+void Rewind::WorkerLoop () {
+	std::unique_lock <std::mutex> Guard (Lock);
+	
+	while (1) {
+		Changed.wait (Guard, [this] { return PendingFull || Quit; });
+		if (Quit)
+			return;
+		
+		std::swap (Pending, Work);
+		PendingFull = 0;
+		Processing = 1;
+		uint8_t HadCurrent = HaveCurrent;
+		Guard.unlock ();
+		
+		// Work becomes the newest state, Current turns into the delta that leads back to it
+		uint32_t Size = 0;
+		if (HadCurrent)
+			XOR (Current, Work, StateSize);
+		std::swap (Current, Work);
+		if (HadCurrent)
+			Size = Compression::Compress (Work, StateSize, Scratch, Compression::Bound (StateSize));
+		
+		Guard.lock ();
+		if (HadCurrent)
+			Store (Size);
+		HaveCurrent = 1;
+		Processing = 0;
+		Changed.notify_all ();
+	}
+}
+
+void Rewind::Store (uint32_t Size) { // Locked, the compressed delta is in Scratch
+	if (Size == 0 || Size > Budget) { // Can't keep it, and older ones can't be reached without it
+		History.clear ();
+		Entries = 0;
+		StoredBytes = 0;
+		return;
+	}
+	
+	uint32_t Offset = 0;
+	if (!History.empty ()) {
+		Offset = History.back ().Offset + History.back ().Size;
+		if (Offset + Size > Budget)
+			Offset = 0;
+	}
+	
+	// Drop the oldest ones in the way
+	while (!History.empty () && History.front ().Offset < Offset + Size && Offset < History.front ().Offset + History.front ().Size) {
+		StoredBytes -= History.front ().Size;
+		History.pop_front ();
+	}
+	
+	memcpy (Storage + Offset, Scratch, Size);
+	History.push_back ({Offset, Size});
+	Entries = History.size ();
+	StoredBytes += Size;
+}
+
+uint8_t Rewind::StepBack () {
+	std::unique_lock <std::mutex> Guard (Lock);
+	Changed.wait (Guard, [this] { return !PendingFull && !Processing; });
+	
+	if (!HaveCurrent)
+		return 0;
+	
+	if (AtCurrent) { // Already there, go one further
+		if (History.empty ())
+			return 0;
+		
+		Entry Newest = History.back ();
+		History.pop_back ();
+		Entries = History.size ();
+		StoredBytes -= Newest.Size;
+		
+		if (Compression::Decompress (Storage + Newest.Offset, Newest.Size, Scratch, StateSize) != StateSize)
+			return 0;
+		XOR (Current, Scratch, StateSize);
+	}
+	
+	AtCurrent = 1;
+	return gb->LoadState (Current, StateSize);
+}
+
+void Rewind::Report () {
+	std::lock_guard <std::mutex> Guard (Lock);
+	printf ("[INFO] Rewind: %d states (%.1f of %.1f MB, %d bytes avg), %d captured, %d skipped\n", Entries + HaveCurrent,
+		StoredBytes / 1048576.0, Budget / 1048576.0, Entries ? (uint32_t) (StoredBytes / Entries) : 0, Captured, Skipped);
+	Captured = Skipped = 0;
+}
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "GameBoy.h"
+#ifndef REWIND_H
+#define REWIND_H
+
+/* History of states within a fixed memory budget.
+   Only the newest state is kept whole. Every older one is stored as the compressed XOR against the one
+   after it, so stepping back is decompress + XOR + load. The oldest entries are dropped when the budget is full.
+   Capturing only copies the state on the emulator thread; diffing and compressing run on a background thread. */
+class Rewind {
+	public:
+		Rewind (GameBoy* _gb, uint32_t Budget);
+		~Rewind ();
+		void Capture (); // Newest state, call every N frames
+		uint8_t StepBack (); // Loads the previous state, 0 - Nothing left
+		void Report ();
+		
+		// Statistics
+		uint32_t Captured = 0;
+		uint32_t Skipped = 0; // Capture while the previous one was still being compressed
+		uint32_t Entries = 0;
+		uint64_t StoredBytes = 0;
+	private:
+		struct Entry {
+			uint32_t Offset;
+			uint32_t Size;
+		};
+		
+		GameBoy* gb;
+		uint32_t StateSize;
+		uint8_t* Pending; // Captured, not compressed yet
+		uint8_t* Work;
+		uint8_t* Current; // Newest state, whole
+		uint8_t* Scratch;
+		uint8_t HaveCurrent = 0;
+		uint8_t AtCurrent = 0; // Current is what's loaded right now
+		
+		// Budget, entries are laid out circularly in Storage
+		uint8_t* Storage;
+		uint32_t Budget;
+		std::deque <Entry> History; // Oldest first
+		
+		// Worker
+		uint8_t PendingFull = 0;
+		uint8_t Processing = 0;
+		uint8_t Quit = 0;
+		std::mutex Lock;
+		std::condition_variable Changed;
+		std::thread Worker;
+		
+		void WorkerLoop ();
+		void Store (uint32_t Size);
+		static void XOR (uint8_t* Out, const uint8_t* In, uint32_t Size);
+};
+
+#endif
@@ -0,0 +1,554 @@
+#include "Scaler.h"
+#if defined (__SSE2__)
+#include <immintrin.h>
+#define SCALER_SIMD
+#endif
+
+#ifdef SCALER_SIMD
+static uint8_t DetectAVX2 () {
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("avx2") != 0;
+}
+
+static const uint8_t HasAVX2 = DetectAVX2 ();
+#endif
+
+Scaler::Scaler (uint8_t _Filter, uint8_t _Factor, uint8_t _Threads) {
+	Filter = _Filter;
+	Factor = _Factor;
+	if (Factor < 1)
+		Factor = 1;
+	if (Factor > 16)
+		Factor = 16;
+
+	ThreadCount = _Threads;
+	if (ThreadCount < 1)
+		ThreadCount = 1;
+	if (ThreadCount > SCALER_MAX_THREADS)
+		ThreadCount = SCALER_MAX_THREADS;
+
+	uint16_t Width = 160;
+	uint16_t Height = 144;
+	uint8_t Remaining = Factor;
+
+	if (Filter == SCALER_SCALENX) {
+		while (Remaining > 1 && (Remaining % 3 == 0 || Remaining % 2 == 0)) {
+			uint8_t PassFactor = (Remaining % 3 == 0) ? 3 : 2;
+			AddPass (SCALER_SCALENX, PassFactor, Width, Height);
+			Remaining /= PassFactor;
+		}
+	} else if (Filter == SCALER_XBR) {
+		while (Remaining % 2 == 0) {
+			AddPass (SCALER_XBR, 2, Width, Height);
+			Remaining /= 2;
+		}
+	}
+
+	if (Remaining > 1 || PassCount == 0) // Whatever the filter couldn't do by itself
+		AddPass (SCALER_NEAREST, Remaining, Width, Height);
+
+	OutWidth = Width;
+	OutHeight = Height;
+
+	if (PassCount > 1) { // Only the intermediate passes need own buffers, the biggest one is the one before last
+		uint32_t Size = Passes [PassCount - 1].Width * Passes [PassCount - 1].Height;
+		Intermediate [0] = (uint32_t*) malloc (Size * 4);
+		Intermediate [1] = (uint32_t*) malloc (Size * 4);
+	}
+
+	for (int i = 1; i < ThreadCount; i++)
+		Workers [i] = std::thread (&Scaler::WorkerLoop, this, i);
+}
+
+Scaler::~Scaler () {
+	WorkLock.lock ();
+	Quit = 1;
+	WorkLock.unlock ();
+	WorkStart.notify_all ();
+
+	for (int i = 1; i < ThreadCount; i++)
+		Workers [i].join ();
+
+	free (Intermediate [0]);
+	free (Intermediate [1]);
+}
+
+void Scaler::AddPass (uint8_t PassFilter, uint8_t PassFactor, uint16_t &Width, uint16_t &Height) {
+	Pass* P = Passes + PassCount;
+	P->Filter = PassFilter;
+	P->Factor = PassFactor;
+	P->Width = Width;
+	P->Height = Height;
+	PassCount++;
+
+	Width *= PassFactor;
+	Height *= PassFactor;
+}
+
+void Scaler::Scale (const uint32_t* In, uint32_t* Out) {
+	for (int i = 0; i < PassCount; i++) {
+		Passes [i].In = (i == 0) ? In : Passes [i - 1].Out;
+		Passes [i].Out = (i == PassCount - 1) ? Out : Intermediate [i & 1];
+		RunPass (Passes + i);
+	}
+}
+
+void Scaler::RunPass (Pass* P) {
+	if (ThreadCount == 1) {
+		RunBand (P, 0);
+		return;
+	}
+
+	std::unique_lock <std::mutex> Lock (WorkLock);
+	CurrentPass = P;
+	WorkRemaining = ThreadCount - 1;
+	WorkGeneration++;
+	Lock.unlock ();
+	WorkStart.notify_all ();
+
+	RunBand (P, 0); // This thread takes the first band
+
+	Lock.lock ();
+	while (WorkRemaining != 0) // Every pass depends on the whole previous one
+		WorkDone.wait (Lock);
+}
+
+void Scaler::WorkerLoop (uint32_t Band) {
+	uint32_t LastGeneration = 0;
+
+	while (1) {
+		std::unique_lock <std::mutex> Lock (WorkLock);
+		while (!Quit && WorkGeneration == LastGeneration)
+			WorkStart.wait (Lock);
+
+		if (Quit)
+			return;
+
+		LastGeneration = WorkGeneration;
+		Pass* P = CurrentPass;
+		Lock.unlock ();
+
+		RunBand (P, Band);
+
+		Lock.lock ();
+		WorkRemaining--;
+		if (WorkRemaining == 0)
+			WorkDone.notify_one ();
+	}
+}
+
+void Scaler::RunBand (Pass* P, uint32_t Band) {
+	uint16_t FirstRow = (P->Height * Band) / ThreadCount;
+	uint16_t LastRow = (P->Height * (Band + 1)) / ThreadCount;
+
+	switch (P->Filter) {
+		case SCALER_NEAREST: Scalers::Nearest (P->In, P->Out, P->Width, P->Height, P->Factor, FirstRow, LastRow); break;
+		case SCALER_SCALENX:
+			if (P->Factor == 3)
+				Scalers::Scale3x (P->In, P->Out, P->Width, P->Height, FirstRow, LastRow);
+			else
+				Scalers::Scale2x (P->In, P->Out, P->Width, P->Height, FirstRow, LastRow);
+			break;
+		case SCALER_XBR: Scalers::XBR2x (P->In, P->Out, P->Width, P->Height, FirstRow, LastRow); break;
+		default: break;
+	}
+}
+
+// Nearest Neighbour
+#ifdef SCALER_SIMD
+__attribute__ ((target ("avx2"))) static void NearestRowAVX2 (const uint32_t* In, uint32_t* Out, uint16_t Width, uint8_t Factor) {
+	for (int x = 0; x < Width; x++) { // Two overlapping stores cover 8 - 16 copies
+		__m256i Pixel = _mm256_set1_epi32 (In [x]);
+		_mm256_storeu_si256 ((__m256i*) Out, Pixel);
+		_mm256_storeu_si256 ((__m256i*) (Out + Factor - 8), Pixel);
+		Out += Factor;
+	}
+}
+
+static void NearestRowSSE2 (const uint32_t* In, uint32_t* Out, uint16_t Width, uint8_t Factor) {
+	int x = 0;
+
+	if (Factor == 2) {
+		for (; x + 4 <= Width; x += 4) {
+			__m128i Pixels = _mm_loadu_si128 ((const __m128i*) (In + x));
+			_mm_storeu_si128 ((__m128i*) Out, _mm_unpacklo_epi32 (Pixels, Pixels));
+			_mm_storeu_si128 ((__m128i*) (Out + 4), _mm_unpackhi_epi32 (Pixels, Pixels));
+			Out += 8;
+		}
+	} else if (Factor == 3) {
+		for (; x + 4 <= Width; x += 4) {
+			__m128i Pixels = _mm_loadu_si128 ((const __m128i*) (In + x));
+			_mm_storeu_si128 ((__m128i*) Out, _mm_shuffle_epi32 (Pixels, _MM_SHUFFLE (1, 0, 0, 0)));
+			_mm_storeu_si128 ((__m128i*) (Out + 4), _mm_shuffle_epi32 (Pixels, _MM_SHUFFLE (2, 2, 1, 1)));
+			_mm_storeu_si128 ((__m128i*) (Out + 8), _mm_shuffle_epi32 (Pixels, _MM_SHUFFLE (3, 3, 3, 2)));
+			Out += 12;
+		}
+	} else if (Factor >= 4) { // The last store overlaps the previous one when Factor isn't a multiple of 4
+		for (; x < Width; x++) {
+			__m128i Pixel = _mm_set1_epi32 (In [x]);
+			for (int i = 0; i + 4 < Factor; i += 4)
+				_mm_storeu_si128 ((__m128i*) (Out + i), Pixel);
+			_mm_storeu_si128 ((__m128i*) (Out + Factor - 4), Pixel);
+			Out += Factor;
+		}
+	}
+
+	for (; x < Width; x++)
+		for (int i = 0; i < Factor; i++)
+			*Out++ = In [x];
+}
+#endif
+
+void Scalers::Nearest (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint8_t Factor, uint16_t FirstRow, uint16_t LastRow) {
+	uint32_t OutWidth = Width * Factor;
+	(void) Height;
+
+	for (int y = FirstRow; y < LastRow; y++) {
+		uint32_t* OutRow = Out + y * Factor * OutWidth;
+
+#ifdef SCALER_SIMD
+		if (Factor >= 8 && HasAVX2)
+			NearestRowAVX2 (In + y * Width, OutRow, Width, Factor);
+		else
+			NearestRowSSE2 (In + y * Width, OutRow, Width, Factor);
+#else
+		for (int x = 0; x < Width; x++)
+			for (int i = 0; i < Factor; i++)
+				OutRow [x * Factor + i] = In [y * Width + x];
+#endif
+
+		for (int i = 1; i < Factor; i++) // Every other row is the same
+			memcpy (OutRow + i * OutWidth, OutRow, OutWidth * 4);
+	}
+}
+
+/* Scale2x / Scale3x (AdvanceMAME):
+	A B C
+	D E F
+	G H I
+*/
+static inline uint32_t Pick (uint8_t Condition, uint32_t Then, uint32_t Else) {
+	return Condition ? Then : Else;
+}
+
+static inline void Scale2xPixel (const uint32_t* Up, const uint32_t* Row, const uint32_t* Down, uint16_t Width, int x, uint32_t* Out0, uint32_t* Out1) {
+	uint32_t B = Up [x], H = Down [x], E = Row [x];
+	uint32_t D = Row [x > 0 ? x - 1 : x];
+	uint32_t F = Row [x < Width - 1 ? x + 1 : x];
+
+	if (B != H && D != F) {
+		Out0 [0] = Pick (D == B, D, E);
+		Out0 [1] = Pick (B == F, F, E);
+		Out1 [0] = Pick (D == H, D, E);
+		Out1 [1] = Pick (H == F, F, E);
+	} else {
+		Out0 [0] = Out0 [1] = Out1 [0] = Out1 [1] = E;
+	}
+}
+
+#ifdef SCALER_SIMD
+static inline __m128i Blend (__m128i Mask, __m128i Then, __m128i Else) {
+	return _mm_or_si128 (_mm_and_si128 (Mask, Then), _mm_andnot_si128 (Mask, Else));
+}
+
+static int Scale2xRowSSE2 (const uint32_t* Up, const uint32_t* Row, const uint32_t* Down, uint16_t Width, uint32_t* Out0, uint32_t* Out1, int x) {
+	for (; x + 5 <= Width; x += 4) {
+		__m128i B = _mm_loadu_si128 ((const __m128i*) (Up + x));
+		__m128i H = _mm_loadu_si128 ((const __m128i*) (Down + x));
+		__m128i D = _mm_loadu_si128 ((const __m128i*) (Row + x - 1));
+		__m128i E = _mm_loadu_si128 ((const __m128i*) (Row + x));
+		__m128i F = _mm_loadu_si128 ((const __m128i*) (Row + x + 1));
+
+		__m128i Active = _mm_andnot_si128 (_mm_or_si128 (_mm_cmpeq_epi32 (B, H), _mm_cmpeq_epi32 (D, F)), _mm_set1_epi32 (-1));
+		__m128i E0 = Blend (_mm_and_si128 (Active, _mm_cmpeq_epi32 (D, B)), D, E);
+		__m128i E1 = Blend (_mm_and_si128 (Active, _mm_cmpeq_epi32 (B, F)), F, E);
+		__m128i E2 = Blend (_mm_and_si128 (Active, _mm_cmpeq_epi32 (D, H)), D, E);
+		__m128i E3 = Blend (_mm_and_si128 (Active, _mm_cmpeq_epi32 (H, F)), F, E);
+
+		_mm_storeu_si128 ((__m128i*) (Out0 + 2 * x), _mm_unpacklo_epi32 (E0, E1));
+		_mm_storeu_si128 ((__m128i*) (Out0 + 2 * x + 4), _mm_unpackhi_epi32 (E0, E1));
+		_mm_storeu_si128 ((__m128i*) (Out1 + 2 * x), _mm_unpacklo_epi32 (E2, E3));
+		_mm_storeu_si128 ((__m128i*) (Out1 + 2 * x + 4), _mm_unpackhi_epi32 (E2, E3));
+	}
+	return x;
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i Blend256 (__m256i Mask, __m256i Then, __m256i Else) {
+	return _mm256_blendv_epi8 (Else, Then, Mask);
+}
+
+__attribute__ ((target ("avx2"))) static int Scale2xRowAVX2 (const uint32_t* Up, const uint32_t* Row, const uint32_t* Down, uint16_t Width, uint32_t* Out0, uint32_t* Out1, int x) {
+	for (; x + 9 <= Width; x += 8) {
+		__m256i B = _mm256_loadu_si256 ((const __m256i*) (Up + x));
+		__m256i H = _mm256_loadu_si256 ((const __m256i*) (Down + x));
+		__m256i D = _mm256_loadu_si256 ((const __m256i*) (Row + x - 1));
+		__m256i E = _mm256_loadu_si256 ((const __m256i*) (Row + x));
+		__m256i F = _mm256_loadu_si256 ((const __m256i*) (Row + x + 1));
+
+		__m256i Active = _mm256_andnot_si256 (_mm256_or_si256 (_mm256_cmpeq_epi32 (B, H), _mm256_cmpeq_epi32 (D, F)), _mm256_set1_epi32 (-1));
+		__m256i E0 = Blend256 (_mm256_and_si256 (Active, _mm256_cmpeq_epi32 (D, B)), D, E);
+		__m256i E1 = Blend256 (_mm256_and_si256 (Active, _mm256_cmpeq_epi32 (B, F)), F, E);
+		__m256i E2 = Blend256 (_mm256_and_si256 (Active, _mm256_cmpeq_epi32 (D, H)), D, E);
+		__m256i E3 = Blend256 (_mm256_and_si256 (Active, _mm256_cmpeq_epi32 (H, F)), F, E);
+
+		// Unpack works per 128-bit lane, put the halves back in order
+		__m256i Low = _mm256_unpacklo_epi32 (E0, E1);
+		__m256i High = _mm256_unpackhi_epi32 (E0, E1);
+		_mm256_storeu_si256 ((__m256i*) (Out0 + 2 * x), _mm256_permute2x128_si256 (Low, High, 0x20));
+		_mm256_storeu_si256 ((__m256i*) (Out0 + 2 * x + 8), _mm256_permute2x128_si256 (Low, High, 0x31));
+
+		Low = _mm256_unpacklo_epi32 (E2, E3);
+		High = _mm256_unpackhi_epi32 (E2, E3);
+		_mm256_storeu_si256 ((__m256i*) (Out1 + 2 * x), _mm256_permute2x128_si256 (Low, High, 0x20));
+		_mm256_storeu_si256 ((__m256i*) (Out1 + 2 * x + 8), _mm256_permute2x128_si256 (Low, High, 0x31));
+	}
+	return x;
+}
+#endif
+
+void Scalers::Scale2x (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint16_t FirstRow, uint16_t LastRow) {
+	uint32_t OutWidth = Width * 2;
+
+	for (int y = FirstRow; y < LastRow; y++) {
+		const uint32_t* Up = In + (y > 0 ? y - 1 : y) * Width;
+		const uint32_t* Row = In + y * Width;
+		const uint32_t* Down = In + (y < Height - 1 ? y + 1 : y) * Width;
+		uint32_t* Out0 = Out + (y * 2) * OutWidth;
+		uint32_t* Out1 = Out0 + OutWidth;
+
+		Scale2xPixel (Up, Row, Down, Width, 0, Out0, Out1); // Borders are clamped
+
+		int x = 1;
+#ifdef SCALER_SIMD
+		if (HasAVX2)
+			x = Scale2xRowAVX2 (Up, Row, Down, Width, Out0, Out1, x);
+		x = Scale2xRowSSE2 (Up, Row, Down, Width, Out0, Out1, x); // Whatever is left for 8 wide
+#endif
+		for (; x < Width; x++)
+			Scale2xPixel (Up, Row, Down, Width, x, Out0 + 2 * x, Out1 + 2 * x);
+	}
+}
+
+static inline void Scale3xPixel (const uint32_t* Up, const uint32_t* Row, const uint32_t* Down, uint16_t Width, int x, uint32_t* Out0, uint32_t* Out1, uint32_t* Out2) {
+	int Left = x > 0 ? x - 1 : x;
+	int Right = x < Width - 1 ? x + 1 : x;
+	uint32_t A = Up [Left], B = Up [x], C = Up [Right];
+	uint32_t D = Row [Left], E = Row [x], F = Row [Right];
+	uint32_t G = Down [Left], H = Down [x], I = Down [Right];
+
+	if (B != H && D != F) {
+		Out0 [0] = Pick (D == B, D, E);
+		Out0 [1] = Pick ((D == B && E != C) || (B == F && E != A), B, E);
+		Out0 [2] = Pick (B == F, F, E);
+		Out1 [0] = Pick ((D == B && E != G) || (D == H && E != A), D, E);
+		Out1 [1] = E;
+		Out1 [2] = Pick ((B == F && E != I) || (H == F && E != C), F, E);
+		Out2 [0] = Pick (D == H, D, E);
+		Out2 [1] = Pick ((D == H && E != I) || (H == F && E != G), H, E);
+		Out2 [2] = Pick (H == F, F, E);
+	} else {
+		Out0 [0] = Out0 [1] = Out0 [2] = E;
+		Out1 [0] = Out1 [1] = Out1 [2] = E;
+		Out2 [0] = Out2 [1] = Out2 [2] = E;
+	}
+}
+
+#ifdef SCALER_SIMD
+static inline void Store3 (uint32_t* Out, __m128i A, __m128i B, __m128i C) { // A0 B0 C0 A1 B1 C1 ...
+	__m128 AB0 = _mm_castsi128_ps (_mm_unpacklo_epi32 (A, B)); // A0 B0 A1 B1
+	__m128 AB1 = _mm_castsi128_ps (_mm_unpackhi_epi32 (A, B)); // A2 B2 A3 B3
+	__m128 CA0 = _mm_castsi128_ps (_mm_unpacklo_epi32 (C, A)); // C0 A0 C1 A1
+	__m128 CA1 = _mm_castsi128_ps (_mm_unpackhi_epi32 (C, A)); // C2 A2 C3 A3
+	__m128 BC0 = _mm_castsi128_ps (_mm_unpacklo_epi32 (B, C)); // B0 C0 B1 C1
+	__m128 BC1 = _mm_castsi128_ps (_mm_unpackhi_epi32 (B, C)); // B2 C2 B3 C3
+
+	_mm_storeu_ps ((float*) Out, _mm_shuffle_ps (AB0, CA0, _MM_SHUFFLE (3, 0, 1, 0)));
+	_mm_storeu_ps ((float*) (Out + 4), _mm_shuffle_ps (BC0, AB1, _MM_SHUFFLE (1, 0, 3, 2)));
+	_mm_storeu_ps ((float*) (Out + 8), _mm_shuffle_ps (CA1, BC1, _MM_SHUFFLE (3, 2, 3, 0)));
+}
+
+static int Scale3xRowSSE2 (const uint32_t* Up, const uint32_t* Row, const uint32_t* Down, uint16_t Width, uint32_t* Out0, uint32_t* Out1, uint32_t* Out2, int x) {
+	for (; x + 5 <= Width; x += 4) {
+		__m128i A = _mm_loadu_si128 ((const __m128i*) (Up + x - 1));
+		__m128i B = _mm_loadu_si128 ((const __m128i*) (Up + x));
+		__m128i C = _mm_loadu_si128 ((const __m128i*) (Up + x + 1));
+		__m128i D = _mm_loadu_si128 ((const __m128i*) (Row + x - 1));
+		__m128i E = _mm_loadu_si128 ((const __m128i*) (Row + x));
+		__m128i F = _mm_loadu_si128 ((const __m128i*) (Row + x + 1));
+		__m128i G = _mm_loadu_si128 ((const __m128i*) (Down + x - 1));
+		__m128i H = _mm_loadu_si128 ((const __m128i*) (Down + x));
+		__m128i I = _mm_loadu_si128 ((const __m128i*) (Down + x + 1));
+
+		__m128i Active = _mm_andnot_si128 (_mm_or_si128 (_mm_cmpeq_epi32 (B, H), _mm_cmpeq_epi32 (D, F)), _mm_set1_epi32 (-1));
+		__m128i DB = _mm_and_si128 (Active, _mm_cmpeq_epi32 (D, B));
+		__m128i BF = _mm_and_si128 (Active, _mm_cmpeq_epi32 (B, F));
+		__m128i DH = _mm_and_si128 (Active, _mm_cmpeq_epi32 (D, H));
+		__m128i HF = _mm_and_si128 (Active, _mm_cmpeq_epi32 (H, F));
+
+		// E == X, used negated
+		__m128i EqA = _mm_cmpeq_epi32 (E, A), EqC = _mm_cmpeq_epi32 (E, C);
+		__m128i EqG = _mm_cmpeq_epi32 (E, G), EqI = _mm_cmpeq_epi32 (E, I);
+
+		__m128i E0 = Blend (DB, D, E);
+		__m128i E1 = Blend (_mm_or_si128 (_mm_andnot_si128 (EqC, DB), _mm_andnot_si128 (EqA, BF)), B, E);
+		__m128i E2 = Blend (BF, F, E);
+		__m128i E3 = Blend (_mm_or_si128 (_mm_andnot_si128 (EqG, DB), _mm_andnot_si128 (EqA, DH)), D, E);
+		__m128i E5 = Blend (_mm_or_si128 (_mm_andnot_si128 (EqI, BF), _mm_andnot_si128 (EqC, HF)), F, E);
+		__m128i E6 = Blend (DH, D, E);
+		__m128i E7 = Blend (_mm_or_si128 (_mm_andnot_si128 (EqI, DH), _mm_andnot_si128 (EqG, HF)), H, E);
+		__m128i E8 = Blend (HF, F, E);
+
+		Store3 (Out0 + 3 * x, E0, E1, E2);
+		Store3 (Out1 + 3 * x, E3, E, E5);
+		Store3 (Out2 + 3 * x, E6, E7, E8);
+	}
+	return x;
+}
+
+__attribute__ ((target ("avx2"))) static inline void Store3x256 (uint32_t* Out, __m256i A, __m256i B, __m256i C) { // Per 128-bit half
+	Store3 (Out, _mm256_castsi256_si128 (A), _mm256_castsi256_si128 (B), _mm256_castsi256_si128 (C));
+	Store3 (Out + 12, _mm256_extracti128_si256 (A, 1), _mm256_extracti128_si256 (B, 1), _mm256_extracti128_si256 (C, 1));
+}
+
+__attribute__ ((target ("avx2"))) static int Scale3xRowAVX2 (const uint32_t* Up, const uint32_t* Row, const uint32_t* Down, uint16_t Width, uint32_t* Out0, uint32_t* Out1, uint32_t* Out2, int x) {
+	for (; x + 9 <= Width; x += 8) {
+		__m256i A = _mm256_loadu_si256 ((const __m256i*) (Up + x - 1));
+		__m256i B = _mm256_loadu_si256 ((const __m256i*) (Up + x));
+		__m256i C = _mm256_loadu_si256 ((const __m256i*) (Up + x + 1));
+		__m256i D = _mm256_loadu_si256 ((const __m256i*) (Row + x - 1));
+		__m256i E = _mm256_loadu_si256 ((const __m256i*) (Row + x));
+		__m256i F = _mm256_loadu_si256 ((const __m256i*) (Row + x + 1));
+		__m256i G = _mm256_loadu_si256 ((const __m256i*) (Down + x - 1));
+		__m256i H = _mm256_loadu_si256 ((const __m256i*) (Down + x));
+		__m256i I = _mm256_loadu_si256 ((const __m256i*) (Down + x + 1));
+
+		__m256i Active = _mm256_andnot_si256 (_mm256_or_si256 (_mm256_cmpeq_epi32 (B, H), _mm256_cmpeq_epi32 (D, F)), _mm256_set1_epi32 (-1));
+		__m256i DB = _mm256_and_si256 (Active, _mm256_cmpeq_epi32 (D, B));
+		__m256i BF = _mm256_and_si256 (Active, _mm256_cmpeq_epi32 (B, F));
+		__m256i DH = _mm256_and_si256 (Active, _mm256_cmpeq_epi32 (D, H));
+		__m256i HF = _mm256_and_si256 (Active, _mm256_cmpeq_epi32 (H, F));
+
+		// E == X, used negated
+		__m256i EqA = _mm256_cmpeq_epi32 (E, A), EqC = _mm256_cmpeq_epi32 (E, C);
+		__m256i EqG = _mm256_cmpeq_epi32 (E, G), EqI = _mm256_cmpeq_epi32 (E, I);
+
+		__m256i E0 = Blend256 (DB, D, E);
+		__m256i E1 = Blend256 (_mm256_or_si256 (_mm256_andnot_si256 (EqC, DB), _mm256_andnot_si256 (EqA, BF)), B, E);
+		__m256i E2 = Blend256 (BF, F, E);
+		__m256i E3 = Blend256 (_mm256_or_si256 (_mm256_andnot_si256 (EqG, DB), _mm256_andnot_si256 (EqA, DH)), D, E);
+		__m256i E5 = Blend256 (_mm256_or_si256 (_mm256_andnot_si256 (EqI, BF), _mm256_andnot_si256 (EqC, HF)), F, E);
+		__m256i E6 = Blend256 (DH, D, E);
+		__m256i E7 = Blend256 (_mm256_or_si256 (_mm256_andnot_si256 (EqI, DH), _mm256_andnot_si256 (EqG, HF)), H, E);
+		__m256i E8 = Blend256 (HF, F, E);
+
+		Store3x256 (Out0 + 3 * x, E0, E1, E2);
+		Store3x256 (Out1 + 3 * x, E3, E, E5);
+		Store3x256 (Out2 + 3 * x, E6, E7, E8);
+	}
+	return x;
+}
+#endif
+
+void Scalers::Scale3x (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint16_t FirstRow, uint16_t LastRow) {
+	uint32_t OutWidth = Width * 3;
+
+	for (int y = FirstRow; y < LastRow; y++) {
+		const uint32_t* Up = In + (y > 0 ? y - 1 : y) * Width;
+		const uint32_t* Row = In + y * Width;
+		const uint32_t* Down = In + (y < Height - 1 ? y + 1 : y) * Width;
+		uint32_t* Out0 = Out + (y * 3) * OutWidth;
+		uint32_t* Out1 = Out0 + OutWidth;
+		uint32_t* Out2 = Out1 + OutWidth;
+
+		Scale3xPixel (Up, Row, Down, Width, 0, Out0, Out1, Out2);
+
+		int x = 1;
+#ifdef SCALER_SIMD
+		if (HasAVX2)
+			x = Scale3xRowAVX2 (Up, Row, Down, Width, Out0, Out1, Out2, x);
+		x = Scale3xRowSSE2 (Up, Row, Down, Width, Out0, Out1, Out2, x); // Whatever is left for 8 wide
+#endif
+		for (; x < Width; x++)
+			Scale3xPixel (Up, Row, Down, Width, x, Out0 + 3 * x, Out1 + 3 * x, Out2 + 3 * x);
+	}
+}
+
+/* xBR, level 1 at 2x. Neighbourhood of E:
+	   A1 B1 C1
+	A0 A  B  C  C4
+	D0 D  E  F  F4
+	G0 G  H  I  I4
+	   G5 H5 I5
+   Every output corner is the bottom right one of a rotated neighbourhood.
+*/
+static inline uint32_t YUVDistance (uint32_t ColorA, uint32_t ColorB) {
+	if (ColorA == ColorB)
+		return 0;
+
+	int R = (int) ((ColorA >> 16) & 0xFF) - (int) ((ColorB >> 16) & 0xFF);
+	int G = (int) ((ColorA >> 8) & 0xFF) - (int) ((ColorB >> 8) & 0xFF);
+	int B = (int) (ColorA & 0xFF) - (int) (ColorB & 0xFF);
+
+	int Y = (299 * R + 587 * G + 114 * B) / 1000;
+	int U = (-169 * R - 331 * G + 500 * B) / 1000;
+	int V = (500 * R - 419 * G - 81 * B) / 1000;
+
+	return 48 * abs (Y) + 7 * abs (U) + 6 * abs (V);
+}
+
+static inline uint32_t Mix (uint32_t ColorA, uint32_t ColorB) { // 50% blend
+	return ((ColorA & 0xFEFEFEFE) >> 1) + ((ColorB & 0xFEFEFEFE) >> 1) + (ColorA & ColorB & 0x01010101);
+}
+
+static inline uint32_t XBRCorner (uint32_t E, uint32_t B, uint32_t C, uint32_t D, uint32_t F, uint32_t G, uint32_t H, uint32_t I, uint32_t F4, uint32_t H5, uint32_t I4, uint32_t I5) {
+	if (E == F || E == H) // Nothing to smooth
+		return E;
+
+	uint32_t EdgeE = YUVDistance (E, C) + YUVDistance (E, G) + YUVDistance (I, F4) + YUVDistance (I, H5) + 4 * YUVDistance (H, F);
+	uint32_t EdgeI = YUVDistance (H, D) + YUVDistance (H, I5) + YUVDistance (F, I4) + YUVDistance (F, B) + 4 * YUVDistance (E, I);
+
+	if (EdgeE < EdgeI)
+		return Mix (E, YUVDistance (E, F) <= YUVDistance (E, H) ? F : H);
+
+	return E;
+}
+
+void Scalers::XBR2x (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint16_t FirstRow, uint16_t LastRow) {
+	uint32_t OutWidth = Width * 2;
+
+	for (int y = FirstRow; y < LastRow; y++) {
+		const uint32_t* Rows [5];
+		for (int i = 0; i < 5; i++) {
+			int RowY = y + i - 2;
+			RowY = RowY < 0 ? 0 : (RowY >= Height ? Height - 1 : RowY);
+			Rows [i] = In + RowY * Width;
+		}
+
+		uint32_t* Out0 = Out + (y * 2) * OutWidth;
+		uint32_t* Out1 = Out0 + OutWidth;
+
+		for (int x = 0; x < Width; x++) {
+			int X [5];
+			for (int i = 0; i < 5; i++) {
+				X [i] = x + i - 2;
+				X [i] = X [i] < 0 ? 0 : (X [i] >= Width ? Width - 1 : X [i]);
+			}
+
+			uint32_t A1 = Rows [0][X [1]], B1 = Rows [0][X [2]], C1 = Rows [0][X [3]];
+			uint32_t A0 = Rows [1][X [0]], A = Rows [1][X [1]], B = Rows [1][X [2]], C = Rows [1][X [3]], C4 = Rows [1][X [4]];
+			uint32_t D0 = Rows [2][X [0]], D = Rows [2][X [1]], E = Rows [2][X [2]], F = Rows [2][X [3]], F4 = Rows [2][X [4]];
+			uint32_t G0 = Rows [3][X [0]], G = Rows [3][X [1]], H = Rows [3][X [2]], I = Rows [3][X [3]], I4 = Rows [3][X [4]];
+			uint32_t G5 = Rows [4][X [1]], H5 = Rows [4][X [2]], I5 = Rows [4][X [3]];
+
+			if (A == E && B == E && C == E && D == E && F == E && G == E && H == E && I == E) { // Flat area, most of a frame
+				Out0 [2 * x] = Out0 [2 * x + 1] = Out1 [2 * x] = Out1 [2 * x + 1] = E;
+				continue;
+			}
+
+			Out1 [2 * x + 1] = XBRCorner (E, B, C, D, F, G, H, I, F4, H5, I4, I5); // Bottom Right
+			Out1 [2 * x] = XBRCorner (E, F, I, B, H, A, D, G, H5, D0, G5, G0); // Bottom Left
+			Out0 [2 * x] = XBRCorner (E, H, G, F, D, C, B, A, D0, B1, A0, A1); // Top Left
+			Out0 [2 * x + 1] = XBRCorner (E, D, A, H, B, I, F, C, B1, F4, C1, C4); // Top Right
+		}
+	}
+}
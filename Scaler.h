@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifndef SCALER_H
+#define SCALER_H
+
+// Filters
+#define SCALER_NONE 0 // Let SDL scale the 160x144 texture
+#define SCALER_NEAREST 1 // Any integer factor
+#define SCALER_SCALENX 2 // Scale2x / Scale3x passes, 2, 3, 4, 6, 8, 9...
+#define SCALER_XBR 3 // xBR level 1 passes at 2x
+
+#define SCALER_MAX_THREADS 16
+
+/* CPU-side upscaler for the presented frame (ARGB8888).
+   A factor that can't be built from the filter's own passes is completed with nearest neighbour.
+   With more than one thread, every pass is split in horizontal bands. */
+class Scaler {
+	public:
+		Scaler (uint8_t _Filter, uint8_t _Factor, uint8_t _Threads);
+		~Scaler ();
+		void Scale (const uint32_t* In, uint32_t* Out); // In: 160 * 144, Out: OutWidth * OutHeight
+
+		uint8_t Filter;
+		uint8_t Factor;
+		uint16_t OutWidth;
+		uint16_t OutHeight;
+	private:
+		struct Pass {
+			uint8_t Filter;
+			uint8_t Factor;
+			uint16_t Width; // Input size
+			uint16_t Height;
+			const uint32_t* In;
+			uint32_t* Out;
+		};
+
+		Pass Passes [8];
+		uint8_t PassCount = 0;
+		uint32_t* Intermediate [2] = {NULL, NULL};
+
+		// Band threads
+		uint8_t ThreadCount;
+		std::thread Workers [SCALER_MAX_THREADS];
+		std::mutex WorkLock;
+		std::condition_variable WorkStart;
+		std::condition_variable WorkDone;
+		uint32_t WorkGeneration = 0;
+		uint8_t WorkRemaining = 0;
+		uint8_t Quit = 0;
+		Pass* CurrentPass = NULL;
+
+		void AddPass (uint8_t PassFilter, uint8_t PassFactor, uint16_t &Width, uint16_t &Height);
+		void RunPass (Pass* P);
+		void RunBand (Pass* P, uint32_t Band);
+		void WorkerLoop (uint32_t Band);
+};
+
+namespace Scalers {
+	// Rows [FirstRow, LastRow) of the input, output rows are written for those only
+	void Nearest (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint8_t Factor, uint16_t FirstRow, uint16_t LastRow);
+	void Scale2x (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint16_t FirstRow, uint16_t LastRow);
+	void Scale3x (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint16_t FirstRow, uint16_t LastRow);
+	void XBR2x (const uint32_t* In, uint32_t* Out, uint16_t Width, uint16_t Height, uint16_t FirstRow, uint16_t LastRow);
+}
+
+#endif
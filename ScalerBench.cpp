@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include "Scaler.h"
+
+// Microbenchmark for the upscaling filters: ms/frame at 4x and 6x, single and multi threaded
+
+using namespace std::chrono;
+
+const char* FilterNames [] = {"none", "nearest", "scalenx", "xbr"};
+
+double Benchmark (uint8_t Filter, uint8_t Factor, uint8_t Threads, const uint32_t* Frame, uint32_t Frames) {
+	Scaler FrameScaler (Filter, Factor, Threads);
+	uint32_t* Out = (uint32_t*) malloc (FrameScaler.OutWidth * FrameScaler.OutHeight * 4);
+	
+	FrameScaler.Scale (Frame, Out); // Warm up
+	
+	auto StartTime = high_resolution_clock::now ();
+	for (uint32_t i = 0; i < Frames; i++)
+		FrameScaler.Scale (Frame, Out);
+	double Elapsed = duration_cast <nanoseconds> (high_resolution_clock::now () - StartTime).count () / 1000000.0;
+	
+	free (Out);
+	return Elapsed / Frames;
+}
+
+int main (int argc, char** argv) {
+	uint32_t Frames = 200;
+	if (argc > 1)
+		Frames = atoi (argv[1]);
+	
+	uint8_t MaxThreads = std::thread::hardware_concurrency ();
+	if (MaxThreads < 1)
+		MaxThreads = 1;
+	if (MaxThreads > SCALER_MAX_THREADS)
+		MaxThreads = SCALER_MAX_THREADS;
+	
+	// Something that looks like a game: 8x8 tiles with diagonal edges, 4 shades
+	const uint32_t Colors [4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000};
+	static uint32_t Frame [160 * 144];
+	for (int y = 0; y < 144; y++)
+		for (int x = 0; x < 160; x++) {
+			uint32_t Tile = ((x >> 3) * 7 + (y >> 3) * 13) & 3;
+			uint32_t Shade = ((x & 7) > (y & 7)) ? Tile : (Tile + 1) & 3;
+			Frame [y * 160 + x] = Colors [Shade];
+		}
+	
+	printf ("Filter     Factor  Threads  ms/frame\n");
+	for (uint8_t Filter = SCALER_NEAREST; Filter <= SCALER_XBR; Filter++)
+		for (uint8_t Factor = 4; Factor <= 6; Factor += 2) {
+			printf ("%-10s %-7d %-8d %.3f\n", FilterNames [Filter], Factor, 1, Benchmark (Filter, Factor, 1, Frame, Frames));
+			if (MaxThreads > 1)
+				printf ("%-10s %-7d %-8d %.3f\n", FilterNames [Filter], Factor, MaxThreads, Benchmark (Filter, Factor, MaxThreads, Frame, Frames));
+		}
+	
+	return 0;
+}
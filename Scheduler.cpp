@@ -0,0 +1,46 @@
+#include "Scheduler.h"
+
+void Scheduler::Reset (uint32_t Clock) {
+	Active = 0;
+	Reference = Clock;
+	Update ();
+}
+
+void Scheduler::Schedule (uint8_t ID, uint32_t Clock) {
+	When [ID] = Clock;
+	Active |= 1 << ID;
+	Update ();
+}
+
+void Scheduler::Cancel (uint8_t ID) {
+	Active &= ~(1 << ID);
+	Update ();
+}
+
+int Scheduler::Pop (uint32_t Clock) {
+	Reference = Clock;
+	
+	int Earliest = -1;
+	for (uint8_t i = 0; i < EVENT_COUNT; i++)
+		if ((Active & (1 << i)) && (int32_t) (Clock - When [i]) >= 0 && (Earliest < 0 || (int32_t) (When [i] - When [Earliest]) < 0))
+			Earliest = i;
+	
+	if (Earliest >= 0)
+		Active &= ~(1 << Earliest);
+	Update ();
+	return Earliest;
+}
+
+void Scheduler::Update () {
+	Next = Reference + 0x40000000; // Nothing: look again later, so the reference never falls behind by half the range
+	for (uint8_t i = 0; i < EVENT_COUNT; i++)
+		if ((Active & (1 << i)) && (int32_t) (When [i] - Next) < 0)
+			Next = When [i];
+}
+
+void Scheduler::SyncState (StateStream &State) {
+	State.Bytes (When, sizeof (When));
+	State.Sync (Active);
+	State.Sync (Reference);
+	State.Sync (Next);
+}
@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include "State.h"
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Events
+#define EVENT_TIMER 0 // TIMA overflow
+#define EVENT_LCD_LINE 1 // End of the current LCD line
+#define EVENT_LCD_HBLANK 2 // Mode 0 STAT interrupt
+#define EVENT_LCD_STAT 3 // STAT interrupt from a register write
+#define EVENT_COUNT 4
+
+/* Clock-driven events of the emulated machine, so nothing has to be polled per instruction:
+   the caller only compares the clock with Next, and pops what is due. Clocks wrap, all
+   comparisons are relative to the last clock seen. */
+class Scheduler {
+	public:
+		void Reset (uint32_t Clock);
+		void Schedule (uint8_t ID, uint32_t Clock);
+		void Cancel (uint8_t ID);
+		inline uint8_t Due (uint32_t Clock) { return (int32_t) (Clock - Next) >= 0; }
+		int Pop (uint32_t Clock); // The earliest event due at Clock, -1 - None
+		void SyncState (StateStream &State);
+		
+		uint32_t Next = 0x40000000; // Earliest event, or a clock to look again
+	private:
+		uint32_t When [EVENT_COUNT];
+		uint32_t Active = 0; // Bit per event
+		uint32_t Reference = 0; // Clock the events are compared from
+		
+		void Update ();
+};
+
+#endif
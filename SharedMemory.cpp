@@ -0,0 +1,110 @@
+#include "SharedMemory.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+SharedMemory::SharedMemory (const char* _Name, const char* Regions) {
+	snprintf (Name, sizeof (Name), "%s%s", _Name [0] == '/' ? "" : "/", _Name);
+	
+	int fd = shm_open (Name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate (fd, sizeof (SharedLayout)) != 0) {
+		printf ("[ERR] Can't create shared memory %s\n", Name);
+		if (fd >= 0)
+			close (fd);
+		return;
+	}
+	
+	void* Mapping = mmap (NULL, sizeof (SharedLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	
+	if (Mapping == MAP_FAILED) {
+		printf ("[ERR] Can't map shared memory %s\n", Name);
+		return;
+	}
+	
+	Layout = (SharedLayout*) Mapping;
+	memset (Layout, 0, sizeof (SharedLayout));
+	Layout->SlotCount = SHM_SLOTS;
+	Layout->SlotSize = sizeof (SharedSlot);
+	Layout->LatestSlot = 0;
+	
+	if (Regions == NULL)
+		AddRegion (0xC000, 0x2000);
+	else {
+		const char* Position = Regions;
+		while (*Position) {
+			char* End;
+			uint16_t Start = strtoul (Position, &End, 16);
+			if (End == Position) // Garbage
+				break;
+			
+			uint16_t Length = 1;
+			if (*End == ':')
+				Length = strtoul (End + 1, &End, 16);
+			
+			AddRegion (Start, Length);
+			Position = (*End == ',') ? End + 1 : End;
+		}
+	}
+	
+	Layout->Version = SHM_VERSION;
+	__atomic_store_n (&Layout->Magic, SHM_MAGIC, __ATOMIC_RELEASE); // Written last, readers can start now
+	
+	printf ("[INFO] Publishing frames to shared memory %s (%u bytes)\n", Name, (uint32_t) sizeof (SharedLayout));
+}
+
+SharedMemory::~SharedMemory () {
+	if (Layout == NULL)
+		return;
+	
+	munmap (Layout, sizeof (SharedLayout));
+	shm_unlink (Name);
+}
+
+void SharedMemory::AddRegion (uint16_t Start, uint16_t Length) {
+	uint32_t Used = 0;
+	for (uint32_t i = 0; i < Layout->RegionCount; i++)
+		Used += Layout->RegionLength [i];
+	
+	if (Layout->RegionCount == SHM_MAX_REGIONS || Used + Length > SHM_REGION_BYTES || Start + Length > 0x10000) {
+		printf ("[WARN] Shared memory region %04x:%x doesn't fit, ignored\n", Start, Length);
+		return;
+	}
+	
+	Layout->RegionStart [Layout->RegionCount] = Start;
+	Layout->RegionLength [Layout->RegionCount] = Length;
+	Layout->RegionCount++;
+}
+
+void SharedMemory::Publish (const uint8_t* Frame, MMU* mmu, uint32_t FrameNumber) {
+	if (Layout == NULL)
+		return;
+	
+	SharedSlot* Slot = Layout->Slots + NextSlot;
+	uint32_t Sequence = Slot->Sequence;
+	
+	__atomic_store_n (&Slot->Sequence, Sequence + 1, __ATOMIC_RELAXED); // Odd: Being written
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	
+	Slot->FrameNumber = FrameNumber;
+	memcpy (Slot->Frame, Frame, sizeof (Slot->Frame));
+	memcpy (Slot->IOMap, mmu->IOMap, sizeof (Slot->IOMap));
+	
+	uint8_t* Region = Slot->Regions;
+	for (uint32_t i = 0; i < Layout->RegionCount; i++) // Regions can span banks, byte by byte
+		for (uint32_t Offset = 0; Offset < Layout->RegionLength [i]; Offset++)
+			*Region++ = mmu->PeekByteAt (Layout->RegionStart [i] + Offset);
+	
+	__atomic_store_n (&Slot->Sequence, Sequence + 2, __ATOMIC_RELEASE);
+	__atomic_store_n (&Layout->LatestSlot, NextSlot, __ATOMIC_RELEASE);
+	
+	NextSlot = (NextSlot + 1) % SHM_SLOTS;
+}
+
+uint8_t SharedMemory::GetInput () {
+	if (Layout == NULL)
+		return 0;
+	
+	return __atomic_load_n (&Layout->Input, __ATOMIC_RELAXED);
+}
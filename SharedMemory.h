@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "MMU.h"
+#ifndef SHAREDMEMORY_H
+#define SHAREDMEMORY_H
+
+#define SHM_MAGIC 0x47425348 // "GBSH"
+#define SHM_VERSION 1
+#define SHM_SLOTS 4
+#define SHM_MAX_REGIONS 8
+#define SHM_REGION_BYTES 0x2000 // All selected regions together, at most all of WRAM
+
+/* Layout of the POSIX shared memory segment, for external readers.
+   Every completed frame goes to the next slot of the ring, guarded by the slot's Sequence:
+   odd while it is being written, even when done. A reader takes LatestSlot, reads Sequence,
+   reads the slot in place and reads Sequence again; if both are the same even number, what it read is consistent.
+   Readers write Input (bit set = pressed, JOYPAD_* from MMU.h), it is merged with the keyboard. */
+struct SharedSlot {
+	uint32_t Sequence;
+	uint32_t FrameNumber;
+	uint8_t Frame [160 * 144]; // Shades, 0 - Lightest, 3 - Darkest
+	uint8_t IOMap [0x100]; // 0xFF00 - 0xFFFF, includes HRAM and IE
+	uint8_t Regions [SHM_REGION_BYTES]; // Selected regions, back to back
+};
+
+struct SharedLayout {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t SlotCount;
+	uint32_t SlotSize;
+	uint32_t LatestSlot; // Index of the newest complete slot
+	uint32_t RegionCount;
+	uint16_t RegionStart [SHM_MAX_REGIONS];
+	uint16_t RegionLength [SHM_MAX_REGIONS];
+	uint8_t Input; // Written by readers
+	uint8_t Padding [63];
+	SharedSlot Slots [SHM_SLOTS];
+};
+
+class SharedMemory {
+	public:
+		SharedMemory (const char* _Name, const char* Regions); // Regions: "C000:100,D000:200", NULL for all of WRAM
+		~SharedMemory ();
+		void Publish (const uint8_t* Frame, MMU* mmu, uint32_t FrameNumber);
+		uint8_t GetInput ();
+	private:
+		char Name [256];
+		SharedLayout* Layout = NULL;
+		uint32_t NextSlot = 0;
+		
+		void AddRegion (uint16_t Start, uint16_t Length);
+};
+
+#endif
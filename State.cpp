@@ -0,0 +1,135 @@
+#include "State.h"
+#include "Compress.h"
+
+StateWriter::StateWriter () {
+	Writer = std::thread (&StateWriter::WriterLoop, this);
+}
+
+StateWriter::~StateWriter () {
+	QueueLock.lock ();
+	Quit = 1;
+	QueueLock.unlock ();
+	QueueChanged.notify_all ();
+	Writer.join (); // Finishes the queue first
+}
+
+void StateWriter::Write (const char* Filename, const uint8_t* State, uint32_t Size, uint8_t Compress) {
+	Job* J = new Job;
+	snprintf (J->Filename, sizeof (J->Filename), "%s", Filename);
+	J->State = (uint8_t*) malloc (Size);
+	memcpy (J->State, State, Size);
+	J->Size = Size;
+	J->Compress = Compress;
+	J->Next = NULL;
+	
+	std::lock_guard <std::mutex> Lock (QueueLock);
+	Job** Last = &Queue;
+	while (*Last)
+		Last = &(*Last)->Next;
+	*Last = J;
+	QueueChanged.notify_all ();
+}
+
+void StateWriter::Wait () {
+	std::unique_lock <std::mutex> Lock (QueueLock);
+	QueueChanged.wait (Lock, [this] { return Queue == NULL && !Busy; });
+}
+
+void StateWriter::WriterLoop () {
+	std::unique_lock <std::mutex> Lock (QueueLock);
+	
+	while (1) {
+		QueueChanged.wait (Lock, [this] { return Queue != NULL || Quit; });
+		if (Queue == NULL) // Quit, and nothing left
+			return;
+		
+		Job* J = Queue;
+		Queue = J->Next;
+		Busy = 1;
+		
+		Lock.unlock ();
+		WriteJob (J);
+		free (J->State);
+		delete J;
+		Lock.lock ();
+		
+		Busy = 0;
+		QueueChanged.notify_all ();
+	}
+}
+
+void StateWriter::WriteJob (Job* J) {
+	StateHeader Header;
+	memcpy (&Header, J->State, sizeof (Header));
+	const uint8_t* Payload = J->State + sizeof (Header);
+	uint8_t* Compressed = NULL;
+	
+	if (J->Compress) {
+		uint32_t Capacity = Compression::Bound (Header.Size);
+		Compressed = (uint8_t*) malloc (Capacity);
+		uint32_t CompressedSize = Compression::Compress (Payload, Header.Size, Compressed, Capacity);
+		
+		if (CompressedSize && CompressedSize < Header.Size) {
+			Header.Flags |= STATE_COMPRESSED;
+			Header.StoredSize = CompressedSize;
+			Payload = Compressed;
+		}
+	}
+	
+	// Write next to it and rename, a crash never leaves half a state in the slot
+	char TempFilename [260];
+	snprintf (TempFilename, sizeof (TempFilename), "%s.tmp", J->Filename);
+	
+	FILE* File = fopen (TempFilename, "wb");
+	if (File == NULL)
+		printf ("[ERR] Can't write state %s\n", J->Filename);
+	else {
+		uint8_t Written = fwrite (&Header, sizeof (Header), 1, File) == 1 && fwrite (Payload, 1, Header.StoredSize, File) == Header.StoredSize;
+		Written &= fclose (File) == 0;
+		
+		if (Written && rename (TempFilename, J->Filename) == 0)
+			printf ("[INFO] State written to %s (%d bytes%s)\n", J->Filename, Header.StoredSize, (Header.Flags & STATE_COMPRESSED) ? ", compressed" : "");
+		else
+			printf ("[ERR] Can't write state %s\n", J->Filename);
+	}
+	
+	free (Compressed);
+}
+
+uint8_t* StateWriter::ReadFile (const char* Filename, uint32_t &Size) {
+	FILE* File = fopen (Filename, "rb");
+	if (File == NULL)
+		return NULL;
+	
+	StateHeader Header;
+	if (fread (&Header, sizeof (Header), 1, File) != 1 || Header.Magic != STATE_MAGIC || Header.Size > 64 * 1024 * 1024 || Header.StoredSize > Compression::Bound (Header.Size)) {
+		fclose (File);
+		return NULL;
+	}
+	
+	uint8_t* Stored = (uint8_t*) malloc (Header.StoredSize);
+	uint8_t* State = (uint8_t*) malloc (sizeof (Header) + Header.Size);
+	uint8_t Valid = fread (Stored, 1, Header.StoredSize, File) == Header.StoredSize;
+	fclose (File);
+	
+	if (Valid) {
+		if (Header.Flags & STATE_COMPRESSED)
+			Valid = Compression::Decompress (Stored, Header.StoredSize, State + sizeof (Header), Header.Size) == Header.Size;
+		else if (Header.StoredSize == Header.Size)
+			memcpy (State + sizeof (Header), Stored, Header.Size);
+		else
+			Valid = 0;
+	}
+	free (Stored);
+	
+	if (!Valid) {
+		free (State);
+		return NULL;
+	}
+	
+	Header.Flags &= ~STATE_COMPRESSED;
+	Header.StoredSize = Header.Size;
+	memcpy (State, &Header, sizeof (Header));
+	Size = sizeof (Header) + Header.Size;
+	return State;
+}
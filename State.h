@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifndef STATE_H
+#define STATE_H
+
+#define STATE_MAGIC 0x54534247 // "GBST"
+#define STATE_VERSION 5
+#define STATE_COMPRESSED 0x01 // Payload is LZ compressed (files only)
+
+struct StateHeader {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t Flags;
+	uint32_t ROMID; // Hash of the cartridge header, states only load on the same game
+	uint32_t Size; // Payload, uncompressed
+	uint32_t StoredSize; // Payload as stored
+};
+
+/* One symmetric pass over every component: the same SyncState code saves and loads,
+   so the order and size of fields can't get out of step. Buffer = NULL only counts. */
+class StateStream {
+	public:
+		StateStream (uint8_t* _Buffer, uint32_t _Capacity, uint8_t _Loading) {
+			Buffer = _Buffer;
+			Capacity = _Capacity;
+			Loading = _Loading;
+		}
+		
+		void Bytes (void* Data, uint32_t Size) {
+			if (Buffer) {
+				if (Position + Size > Capacity) {
+					Overflow = 1;
+					return;
+				}
+				if (Loading)
+					memcpy (Data, Buffer + Position, Size);
+				else
+					memcpy (Buffer + Position, Data, Size);
+			}
+			Position += Size;
+		}
+		
+		template <typename T> void Sync (T &Value) {
+			Bytes (&Value, sizeof (T));
+		}
+		
+		uint8_t* Buffer;
+		uint32_t Capacity;
+		uint32_t Position = 0;
+		uint8_t Loading;
+		uint8_t Overflow = 0;
+		uint8_t SkipRAM = 0; // Leave out the MMU's RAM blocks, for forks that share them
+};
+
+/* Writes state files on a background thread, compressing them there if asked.
+   States are copied when queued, so the emulator can keep going right away. */
+class StateWriter {
+	public:
+		StateWriter ();
+		~StateWriter ();
+		void Write (const char* Filename, const uint8_t* State, uint32_t Size, uint8_t Compress); // State: header + payload
+		void Wait (); // Until everything queued is on disk
+		
+		static uint8_t* ReadFile (const char* Filename, uint32_t &Size); // Header + uncompressed payload, malloc'd. NULL - Invalid
+	private:
+		struct Job {
+			char Filename [256];
+			uint8_t* State;
+			uint32_t Size;
+			uint8_t Compress;
+			Job* Next;
+		};
+		
+		Job* Queue = NULL;
+		uint8_t Busy = 0;
+		uint8_t Quit = 0;
+		std::mutex QueueLock;
+		std::condition_variable QueueChanged;
+		std::thread Writer;
+		
+		void WriterLoop ();
+		void WriteJob (Job* J);
+};
+
+#endif
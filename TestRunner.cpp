@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <algorithm>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "GameBoy.h"
+
+/* Runs the serial-reporting test ROMs (blargg) headless, one machine per thread.
+   A ROM stops when its serial output says "Passed" or "Failed", when it executes STOP or at the clock cap. */
+
+using namespace std::chrono;
+
+#define RESULT_PASSED 0
+#define RESULT_FAILED 1
+#define RESULT_TIMEOUT 2
+#define RESULT_STOPPED 3
+#define RESULT_NOROM 4
+
+const char* ResultNames [] = {"PASS", "FAIL", "TIMEOUT", "STOP", "NO ROM"};
+
+struct Test {
+	std::string ROM;
+	uint8_t Result;
+	uint32_t Clocks;
+	double WallTime; // ms
+	std::string Serial;
+};
+
+void Run (Test &T, uint32_t MaxClocks) {
+	auto StartTime = high_resolution_clock::now ();
+	
+	GameBoy* gb = new GameBoy (48000);
+	if (!gb->LoadROM (T.ROM.c_str ())) {
+		T.Result = RESULT_NOROM;
+		T.Clocks = 0;
+		T.WallTime = 0;
+		delete gb;
+		return;
+	}
+	
+	CPU* cpu = gb->cpu;
+	MMU* mmu = gb->mmu;
+	mmu->EchoSerial = 0;
+	gb->apu->Muted = 1;
+	
+	uint32_t LastFlushClock = 0;
+	uint32_t CheckedLength = 0;
+	T.Result = RESULT_TIMEOUT;
+	
+	while (cpu->ClockCount < MaxClocks) {
+		uint32_t Before = cpu->ClockCount;
+		gb->Step ();
+		if (cpu->ClockCount == Before) {
+			T.Result = RESULT_STOPPED;
+			break;
+		}
+		
+		if (cpu->ClockCount - LastFlushClock >= 8192) {
+			LastFlushClock = cpu->ClockCount;
+			gb->apu->Flush (cpu->ClockCount);
+		}
+		
+		if (mmu->SerialLength != CheckedLength) { // Only look when something was sent
+			CheckedLength = mmu->SerialLength;
+			if (strstr (mmu->SerialOutput, "Passed")) {
+				T.Result = RESULT_PASSED;
+				break;
+			}
+			if (strstr (mmu->SerialOutput, "Failed")) {
+				T.Result = RESULT_FAILED;
+				break;
+			}
+		}
+	}
+	
+	T.Clocks = cpu->ClockCount;
+	T.Serial = mmu->SerialOutput;
+	delete gb;
+	T.WallTime = duration_cast <microseconds> (high_resolution_clock::now () - StartTime).count () / 1000.0;
+}
+
+// "RESULT ROM" lines, the results the core is known to give today
+uint8_t LoadExpected (const char* Filename, std::map <std::string, uint8_t> &Expected) {
+	FILE* File = fopen (Filename, "r");
+	if (File == NULL)
+		return 0;
+	
+	char Line [1024];
+	while (fgets (Line, sizeof (Line), File)) {
+		Line [strcspn (Line, "\r\n")] = 0;
+		if (Line [0] == '#' || Line [0] == 0)
+			continue;
+		for (uint8_t Result = 0; Result < sizeof (ResultNames) / sizeof (ResultNames [0]); Result++) {
+			size_t Length = strlen (ResultNames [Result]);
+			if (strncmp (Line, ResultNames [Result], Length) == 0 && Line [Length] == ' ') {
+				Expected [Line + Length + 1] = Result;
+				break;
+			}
+		}
+	}
+	fclose (File);
+	return 1;
+}
+
+int main (int argc, char** argv) {
+	uint32_t MaxClocks = 4194304 * 120; // 2 emulated minutes, cpu_instrs needs about one
+	uint32_t Threads = std::thread::hardware_concurrency ();
+	uint8_t Verbose = 0;
+	const char* ExpectFilename = NULL;
+	uint8_t UpdateExpected = 0;
+	std::vector <Test> Tests;
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "-clocks") == 0 && i + 1 < argc)
+			MaxClocks = strtoul (argv[++i], NULL, 10);
+		else if (strcmp (argv[i], "-threads") == 0 && i + 1 < argc)
+			Threads = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-v") == 0)
+			Verbose = 1;
+		else if (strcmp (argv[i], "-expect") == 0 && i + 1 < argc)
+			ExpectFilename = argv[++i];
+		else if (strcmp (argv[i], "-update") == 0)
+			UpdateExpected = 1;
+		else if (argv[i][0] == '-') {
+			printf ("Usage: %s [-clocks N] [-threads N] [-v] [-expect FILE [-update]] [ROM...]\n", argv[0]);
+			return 1;
+		} else {
+			Test T;
+			T.ROM = argv[i];
+			Tests.push_back (T);
+		}
+	}
+	
+	if (Tests.empty ()) { // The bundled ones, checked against their known results
+		if (ExpectFilename == NULL)
+			ExpectFilename = "TestROMs/expected.txt";
+		std::vector <std::string> ROMs = {"TestROMs/cpu_instrs.gb"};
+		DIR* Directory = opendir ("TestROMs/individual");
+		if (Directory) {
+			while (dirent* Entry = readdir (Directory))
+				if (strstr (Entry->d_name, ".gb"))
+					ROMs.push_back (std::string ("TestROMs/individual/") + Entry->d_name);
+			closedir (Directory);
+		}
+		std::sort (ROMs.begin () + 1, ROMs.end ());
+		
+		for (uint32_t i = 0; i < ROMs.size (); i++) {
+			Test T;
+			T.ROM = ROMs [i];
+			Tests.push_back (T);
+		}
+	}
+	
+	if (Threads < 1)
+		Threads = 1;
+	if (Threads > Tests.size ())
+		Threads = Tests.size ();
+	
+	auto StartTime = high_resolution_clock::now ();
+	std::atomic <uint32_t> Next {0};
+	std::vector <std::thread> Workers;
+	for (uint32_t i = 0; i < Threads; i++)
+		Workers.push_back (std::thread ([&] () {
+			uint32_t Index;
+			while ((Index = Next++) < Tests.size ())
+				Run (Tests [Index], MaxClocks);
+		}));
+	for (uint32_t i = 0; i < Workers.size (); i++)
+		Workers [i].join ();
+	double WallTime = duration_cast <microseconds> (high_resolution_clock::now () - StartTime).count () / 1000.0;
+	
+	if (UpdateExpected && ExpectFilename) {
+		FILE* File = fopen (ExpectFilename, "w");
+		if (File == NULL) {
+			printf ("[ERR] Can't write %s\n", ExpectFilename);
+			return 1;
+		}
+		fprintf (File, "# Results gbtests expects, anything else fails it. ./gbtests -update rewrites this\n");
+		for (uint32_t i = 0; i < Tests.size (); i++)
+			fprintf (File, "%s %s\n", ResultNames [Tests [i].Result], Tests [i].ROM.c_str ());
+		fclose (File);
+		printf ("[INFO] Expected results written to %s\n", ExpectFilename);
+	}
+	
+	// Without expected results every ROM has to pass
+	std::map <std::string, uint8_t> Expected;
+	if (ExpectFilename && !LoadExpected (ExpectFilename, Expected))
+		printf ("[WARN] Can't read %s, every ROM has to pass\n", ExpectFilename);
+	
+	uint32_t Passed = 0;
+	uint32_t Unexpected = 0;
+	printf ("%-44s %-8s %12s %10s\n", "ROM", "Result", "Emulated s", "Wall ms");
+	for (uint32_t i = 0; i < Tests.size (); i++) {
+		Test &T = Tests [i];
+		auto Known = Expected.find (T.ROM);
+		uint8_t Want = Known == Expected.end () ? RESULT_PASSED : Known->second;
+		printf ("%-44s %-8s %12.2f %10.1f", T.ROM.c_str (), ResultNames [T.Result], T.Clocks / 4194304.0, T.WallTime);
+		if (T.Result != Want) {
+			printf ("   expected %s", ResultNames [Want]);
+			Unexpected++;
+		}
+		printf ("\n");
+		if (T.Result == RESULT_PASSED)
+			Passed++;
+		else if (Verbose && !T.Serial.empty ())
+			printf ("%s\n", T.Serial.c_str ());
+	}
+	printf ("%d / %d passed, %d unexpected, %.1f ms on %d threads\n", Passed, (uint32_t) Tests.size (), Unexpected, WallTime, Threads);
+	
+	return Unexpected == 0 ? 0 : 1;
+}
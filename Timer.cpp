@@ -0,0 +1,89 @@
+#include "Timer.h"
+
+Timer::Timer (Scheduler* _Events) {
+	Events = _Events;
+	Reset (0);
+}
+
+void Timer::Reset (uint32_t Clock) {
+	DividerBase = TimerBase = Clock;
+	TimerValue = 0;
+	TMA = 0;
+	TAC = 0;
+	Events->Cancel (EVENT_TIMER);
+}
+
+// Falling edges between TimerBase and Clock, never more than one overflow since it is scheduled
+uint8_t Timer::TIMA (uint32_t Clock) {
+	if (!(TAC & 0x04))
+		return TimerValue;
+	
+	uint32_t Phase = (TimerBase - DividerBase) % Period ();
+	return TimerValue + (Phase + (Clock - TimerBase)) / Period ();
+}
+
+void Timer::Rebase (uint32_t Clock) {
+	TimerValue = TIMA (Clock);
+	TimerBase = Clock;
+}
+
+void Timer::Reschedule () {
+	if (!(TAC & 0x04)) {
+		Events->Cancel (EVENT_TIMER);
+		return;
+	}
+	
+	// Edges are at multiples of the period on the divider, the overflow is on edge 0x100 - TIMA
+	uint32_t Phase = (TimerBase - DividerBase) % Period ();
+	OverflowClock = TimerBase - Phase + (0x100 - TimerValue) * Period ();
+	Events->Schedule (EVENT_TIMER, OverflowClock);
+}
+
+uint8_t Timer::Read (uint16_t Address, uint32_t Clock) {
+	switch (Address) {
+		case 0xFF04: return (Clock - DividerBase) >> 8;
+		case 0xFF05: return TIMA (Clock);
+		case 0xFF06: return TMA;
+		default: return 0xF8 | TAC;
+	}
+}
+
+void Timer::Write (uint16_t Address, uint8_t Value, uint32_t Clock) {
+	Rebase (Clock);
+	
+	switch (Address) {
+		case 0xFF04: // Any write resets the divider. If the selected bit was set, that is a falling edge too
+			if ((TAC & 0x04) && ((Clock - DividerBase) % Period ()) >= Period () / 2) {
+				DividerBase = Clock;
+				if (++TimerValue == 0) { // That edge overflowed
+					TimerValue = TMA;
+					OverflowClock = Clock;
+					Events->Schedule (EVENT_TIMER, Clock);
+					return;
+				}
+			}
+			DividerBase = Clock;
+			break;
+		case 0xFF05: TimerValue = Value; break;
+		case 0xFF06: TMA = Value; break;
+		default: TAC = Value & 0x07; break;
+	}
+	
+	Reschedule ();
+}
+
+void Timer::Overflow () {
+	// Reloaded at the edge itself, edges since then count from TMA
+	TimerValue = TMA;
+	TimerBase = OverflowClock;
+	Reschedule ();
+}
+
+void Timer::SyncState (StateStream &State) {
+	State.Sync (DividerBase);
+	State.Sync (TimerBase);
+	State.Sync (TimerValue);
+	State.Sync (TMA);
+	State.Sync (TAC);
+	State.Sync (OverflowClock);
+}
@@ -0,0 +1,33 @@
+#include <stdint.h>
+#include "Scheduler.h"
+#include "State.h"
+#ifndef TIMER_H
+#define TIMER_H
+
+/* DIV, TIMA, TMA, TAC (FF04 - FF07), computed from the clock when they are read.
+   DIV is the top of a 16-bit divider counting clocks since it was last reset, TIMA counts its
+   falling edges of the bit selected by TAC. Overflows are scheduled, and rescheduled on writes. */
+class Timer {
+	public:
+		Timer (Scheduler* _Events);
+		void Reset (uint32_t Clock);
+		uint8_t Read (uint16_t Address, uint32_t Clock);
+		void Write (uint16_t Address, uint8_t Value, uint32_t Clock);
+		void Overflow (); // EVENT_TIMER: TIMA reloaded from TMA, the caller raises the interrupt
+		void SyncState (StateStream &State);
+	private:
+		Scheduler* Events;
+		uint32_t DividerBase = 0; // Clock when the divider was 0
+		uint32_t TimerBase = 0; // Clock TimerValue was taken at
+		uint8_t TimerValue = 0;
+		uint8_t TMA = 0;
+		uint8_t TAC = 0;
+		uint32_t OverflowClock = 0; // When EVENT_TIMER is due
+		
+		inline uint32_t Period () { static const uint32_t Periods [4] = {1024, 16, 64, 256}; return Periods [TAC & 3]; }
+		uint8_t TIMA (uint32_t Clock);
+		void Rebase (uint32_t Clock); // TimerValue = TIMA now
+		void Reschedule ();
+};
+
+#endif
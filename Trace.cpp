@@ -0,0 +1,139 @@
+#include "Trace.h"
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TRACE_STREAM_RECORDS 0x10000 // 1.5 MB
+
+static Tracer* Crashing = NULL;
+
+Tracer::Tracer (const char* Filename, uint32_t ROMID, uint32_t Last) {
+	Stream = Last == 0;
+	Keep = Last;
+	Capacity = 1;
+	while (Capacity < (Stream ? TRACE_STREAM_RECORDS : Last))
+		Capacity <<= 1;
+	Ring = new TraceRecord [Capacity];
+	WriteIndex = 0;
+	ReadIndex = 0;
+	Quit = 0;
+	
+	memset (&Header, 0, sizeof (Header));
+	Header.Magic = TRACE_MAGIC;
+	Header.Version = TRACE_VERSION;
+	Header.RecordSize = sizeof (TraceRecord);
+	Header.ROMID = ROMID;
+	
+	File = open (Filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (File < 0) {
+		printf ("[ERR] Can't open trace output %s\n", Filename);
+		return;
+	}
+	Open = 1;
+	
+	if (Stream) {
+		if (write (File, &Header, sizeof (Header)) != sizeof (Header))
+			printf ("[ERR] Can't write trace output %s\n", Filename);
+		Writer = std::thread (&Tracer::WriterLoop, this);
+	}
+}
+
+Tracer::~Tracer () {
+	if (Crashing == this)
+		Crashing = NULL;
+	
+	if (Open) {
+		if (Stream) {
+			Quit = 1;
+			Writer.join (); // Drains the ring first
+		} else
+			WriteLast ();
+		printf ("[INFO] Trace: %llu instructions, waited on the writer %llu times\n", (unsigned long long) WriteIndex.load (), (unsigned long long) Waits);
+		close (File);
+	}
+	delete[] Ring;
+}
+
+void Tracer::Wait (uint64_t Index) {
+	Waits++;
+	while (Index - ReadIndex.load (std::memory_order_acquire) == Capacity)
+		std::this_thread::yield ();
+}
+
+void Tracer::WriterLoop () {
+	while (1) {
+		uint64_t From = ReadIndex.load (std::memory_order_relaxed);
+		uint64_t To = WriteIndex.load (std::memory_order_acquire);
+		if (From == To) {
+			if (Quit)
+				break;
+			usleep (1000);
+			continue;
+		}
+		WriteRange (From, To);
+		ReadIndex.store (To, std::memory_order_release);
+	}
+}
+
+void Tracer::WriteRange (uint64_t From, uint64_t To) {
+	while (From < To) { // At most two pieces, around the end of the ring
+		uint32_t Start = From & (Capacity - 1);
+		uint32_t Count = To - From < Capacity - Start ? To - From : Capacity - Start;
+		const char* Data = (const char*) &Ring [Start];
+		size_t Left = Count * sizeof (TraceRecord);
+		while (Left) {
+			ssize_t Written = write (File, Data, Left);
+			if (Written <= 0)
+				return;
+			Data += Written;
+			Left -= Written;
+		}
+		From += Count;
+	}
+}
+
+void Tracer::WriteLast () {
+	uint64_t To = WriteIndex.load (std::memory_order_acquire);
+	uint64_t From = To > Keep ? To - Keep : 0;
+	Header.First = From;
+	if (ftruncate (File, 0) != 0 || lseek (File, 0, SEEK_SET) != 0)
+		return;
+	if (write (File, &Header, sizeof (Header)) != sizeof (Header))
+		return;
+	WriteRange (From, To);
+}
+
+void Tracer::Dump () {
+	if (!Open)
+		return;
+	
+	if (Stream) {
+		while (ReadIndex.load (std::memory_order_acquire) != WriteIndex.load (std::memory_order_acquire))
+			std::this_thread::yield ();
+	} else
+		WriteLast ();
+	printf ("[INFO] Trace written, %llu instructions so far\n", (unsigned long long) WriteIndex.load ());
+}
+
+void Tracer::OnCrash (int Signal) {
+	Tracer* Trace = Crashing;
+	if (Trace && Trace->Open) {
+		Crashing = NULL;
+		if (Trace->Stream) // The writer may be stuck, or in the middle of a write; what's left goes after it
+			Trace->WriteRange (Trace->ReadIndex.load (), Trace->WriteIndex.load ());
+		else
+			Trace->WriteLast ();
+	}
+	signal (Signal, SIG_DFL);
+	raise (Signal);
+}
+
+void Tracer::DumpOnCrash () {
+	Crashing = this;
+	signal (SIGSEGV, OnCrash);
+	signal (SIGBUS, OnCrash);
+	signal (SIGFPE, OnCrash);
+	signal (SIGILL, OnCrash);
+	signal (SIGABRT, OnCrash);
+}
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_MAGIC 0x52544247 // "GBTR"
+#define TRACE_VERSION 1
+
+// Record flags
+#define TRACE_IME 0x01 // Interrupts enabled
+#define TRACE_EI 0x02 // EI pending, enabled after this instruction
+
+// One executed instruction, with the state before it
+struct TraceRecord {
+	uint32_t Clock; // CPU ClockCount, wraps
+	uint16_t PC;
+	uint8_t Bank; // ROM bank for 0x4000 - 0x7FFF, 0 elsewhere
+	uint8_t Flags; // TRACE_*
+	uint8_t Memory [4]; // Opcode and the bytes after it
+	uint16_t AF, BC, DE, HL, SP;
+	uint8_t IF, IE;
+};
+
+struct TraceHeader {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t RecordSize;
+	uint32_t ROMID;
+	uint32_t Reserved;
+	uint64_t First; // Index of the first record in the file, records before it were dropped
+};
+
+/* Binary execution trace, records are written by the CPU into a lock-free ring.
+   Last = 0: Stream every record to the file from a writer thread; the CPU waits if the ring is full.
+   Last = N: Flight recorder, only keep the last N records in memory and write them on Dump (). */
+class Tracer {
+	public:
+		Tracer (const char* Filename, uint32_t ROMID, uint32_t Last);
+		~Tracer (); // Writes everything left
+		void Dump (); // Bring the file up to date: wait for the writer, or write the last records
+		void DumpOnCrash (); // Dump from SIGSEGV / SIGBUS / SIGFPE / SIGILL / SIGABRT
+		
+		inline TraceRecord* Next () {
+			uint64_t Index = WriteIndex.load (std::memory_order_relaxed);
+			if (Stream && Index - ReadIndex.load (std::memory_order_acquire) == Capacity)
+				Wait (Index);
+			return &Ring [Index & (Capacity - 1)];
+		}
+		inline void Commit () { WriteIndex.store (WriteIndex.load (std::memory_order_relaxed) + 1, std::memory_order_release); }
+		
+		uint8_t Open = 0;
+		uint64_t Waits = 0; // Times the CPU waited for the writer
+	private:
+		int File = -1;
+		uint8_t Stream;
+		uint32_t Capacity; // Power of two
+		uint32_t Keep; // Flight recorder: Records Dump writes, Capacity may be more
+		TraceRecord* Ring;
+		TraceHeader Header;
+		std::atomic <uint64_t> WriteIndex;
+		std::atomic <uint64_t> ReadIndex; // Stream: Written to the file so far
+		std::atomic <uint8_t> Quit;
+		std::thread Writer;
+		
+		void Wait (uint64_t Index);
+		void WriterLoop ();
+		void WriteRange (uint64_t From, uint64_t To); // Ring records [From, To), async signal safe
+		void WriteLast (); // Flight recorder: Header + last records
+		static void OnCrash (int Signal);
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Trace.h"
+#include "Disassembler.h"
+
+/* Decodes the binary traces written with -trace / -tracelast.
+   The default listing has the instruction number, clock, bank:PC, bytes, disassembly and the registers before it;
+   -doctor prints the gameboy-doctor log format instead, to diff against other emulators' logs. */
+
+void PrintListing (const TraceRecord &Record, uint64_t Index) {
+	char Text [32];
+	uint8_t Length = Disassembler::Disassemble (Record.Memory, Record.PC, Text, sizeof (Text));
+	char Bytes [12] = "";
+	for (uint8_t i = 0; i < Length; i++)
+		sprintf (Bytes + i * 3, "%02X ", Record.Memory [i]);
+	
+	uint8_t F = Record.AF & 0xFF;
+	printf ("%10llu %10u %02X:%04X  %-9s %-18s AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X [%c%c%c%c] IME=%d IF=%02X IE=%02X\n",
+		(unsigned long long) Index, Record.Clock, Record.Bank, Record.PC, Bytes, Text,
+		Record.AF, Record.BC, Record.DE, Record.HL, Record.SP,
+		(F & 0x80) ? 'Z' : '-', (F & 0x40) ? 'N' : '-', (F & 0x20) ? 'H' : '-', (F & 0x10) ? 'C' : '-',
+		Record.Flags & TRACE_IME ? 1 : 0, Record.IF, Record.IE);
+}
+
+void PrintDoctor (const TraceRecord &Record) {
+	printf ("A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
+		Record.AF >> 8, Record.AF & 0xFF, Record.BC >> 8, Record.BC & 0xFF, Record.DE >> 8, Record.DE & 0xFF,
+		Record.HL >> 8, Record.HL & 0xFF, Record.SP, Record.PC,
+		Record.Memory [0], Record.Memory [1], Record.Memory [2], Record.Memory [3]);
+}
+
+int main (int argc, char** argv) {
+	const char* Filename = NULL;
+	uint8_t Doctor = 0;
+	uint64_t From = 0;
+	uint64_t Count = (uint64_t) -1;
+	int32_t OnlyPC = -1;
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "-doctor") == 0)
+			Doctor = 1;
+		else if (strcmp (argv[i], "-from") == 0 && i + 1 < argc)
+			From = strtoull (argv[++i], NULL, 10);
+		else if (strcmp (argv[i], "-count") == 0 && i + 1 < argc)
+			Count = strtoull (argv[++i], NULL, 10);
+		else if (strcmp (argv[i], "-pc") == 0 && i + 1 < argc)
+			OnlyPC = strtoul (argv[++i], NULL, 16);
+		else if (argv[i][0] == '-' || Filename) {
+			printf ("Usage: %s [-doctor] [-from N] [-count N] [-pc ADDRESS] TRACE\n", argv[0]);
+			printf ("\t-doctor\t\tgameboy-doctor log lines instead of the listing\n");
+			printf ("\t-from N\t\tStart at instruction N\n");
+			printf ("\t-count N\tStop after N instructions\n");
+			printf ("\t-pc ADDRESS\tOnly instructions at this address (hex)\n");
+			return 1;
+		} else
+			Filename = argv[i];
+	}
+	if (Filename == NULL) {
+		printf ("Usage: %s [-doctor] [-from N] [-count N] [-pc ADDRESS] TRACE\n", argv[0]);
+		return 1;
+	}
+	
+	FILE* File = fopen (Filename, "rb");
+	if (File == NULL) {
+		fprintf (stderr, "[ERR] Can't open %s\n", Filename);
+		return 1;
+	}
+	
+	TraceHeader Header;
+	if (fread (&Header, sizeof (Header), 1, File) != 1 || Header.Magic != TRACE_MAGIC) {
+		fprintf (stderr, "[ERR] %s is not a trace\n", Filename);
+		return 1;
+	}
+	if (Header.Version != TRACE_VERSION || Header.RecordSize != sizeof (TraceRecord)) {
+		fprintf (stderr, "[ERR] %s is trace version %d, this decoder reads version %d\n", Filename, Header.Version, TRACE_VERSION);
+		return 1;
+	}
+	
+	if (!Doctor) {
+		printf ("ROM %08X", Header.ROMID);
+		if (Header.First)
+			printf (", first %llu instructions not kept", (unsigned long long) Header.First);
+		printf ("\n%10s %10s %7s  %-9s %-18s Registers\n", "#", "Clock", "PC", "Bytes", "Instruction");
+	}
+	
+	// Records are numbered from the start of the run
+	const uint32_t Chunk = 4096;
+	TraceRecord* Records = new TraceRecord [Chunk];
+	uint64_t Index = Header.First;
+	uint64_t Printed = 0;
+	size_t Read;
+	while (Printed < Count && (Read = fread (Records, sizeof (TraceRecord), Chunk, File)) > 0) {
+		for (size_t i = 0; i < Read && Printed < Count; i++, Index++) {
+			if (Index < From || (OnlyPC >= 0 && Records [i].PC != OnlyPC))
+				continue;
+			if (Doctor)
+				PrintDoctor (Records [i]);
+			else
+				PrintListing (Records [i], Index);
+			Printed++;
+		}
+	}
+	
+	delete[] Records;
+	fclose (File);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include "VideoWriter.h"
+#include "utils.h"
+#include <unistd.h>
+
+VideoWriter::VideoWriter (const char* Filename, uint8_t _Format, uint32_t _Every, const char* HashFilename, const uint32_t* Colors) {
+	Format = _Format;
+	Every = _Every ? _Every : 1;
+	
+	if (strcmp (Filename, "-") == 0) { // Keep stdout for the stream only, logs go to stderr from now on
+		fflush (stdout);
+		Output = fdopen (dup (STDOUT_FILENO), "wb");
+		dup2 (STDERR_FILENO, STDOUT_FILENO);
+	} else
+		Output = fopen (Filename, "wb");
+	
+	if (Output == NULL) {
+		printf ("[ERR] Can't open video output %s\n", Filename);
+		return;
+	}
+	
+	if (HashFilename) {
+		HashOutput = fopen (HashFilename, "w");
+		if (HashOutput == NULL)
+			printf ("[ERR] Can't open frame hash output %s\n", HashFilename);
+	}
+	
+	for (int i = 0; i < 4; i++) {
+		int R = (Colors [i] >> 16) & 0xFF;
+		int G = (Colors [i] >> 8) & 0xFF;
+		int B = Colors [i] & 0xFF;
+		
+		ColorsRGB [i][0] = R;
+		ColorsRGB [i][1] = G;
+		ColorsRGB [i][2] = B;
+		
+		// BT.601, studio range
+		ColorsYUV [i][0] = 16 + ((66 * R + 129 * G + 25 * B + 128) >> 8);
+		ColorsYUV [i][1] = 128 + ((-38 * R - 74 * G + 112 * B + 128) >> 8);
+		ColorsYUV [i][2] = 128 + ((112 * R - 94 * G - 18 * B + 128) >> 8);
+	}
+	
+	if (Format == VIDEO_Y4M)
+		fprintf (Output, "YUV4MPEG2 W160 H144 F4194304:%u Ip A1:1 C444\n", 70224 * Every); // One frame every 70224 clocks
+	
+	Writer = std::thread (&VideoWriter::WriterLoop, this);
+}
+
+VideoWriter::~VideoWriter () {
+	if (Output == NULL)
+		return;
+	
+	QueueLock.lock ();
+	Quit = 1;
+	QueueLock.unlock ();
+	QueueNotEmpty.notify_one ();
+	Writer.join (); // Drains the queue first
+	
+	fclose (Output);
+	if (HashOutput)
+		fclose (HashOutput);
+	
+	printf ("[INFO] Video: %u frames written, emulator waited on the writer %u times\n", FramesWritten, FramesBlocked);
+}
+
+void VideoWriter::PushFrame (const uint8_t* Shades, uint32_t FrameNumber) {
+	if (Output == NULL || FrameNumber % Every != 0)
+		return;
+	
+	std::unique_lock <std::mutex> Lock (QueueLock);
+	if (Head - Tail == QueueSize) {
+		FramesBlocked++;
+		while (Head - Tail == QueueSize) // Back-pressure
+			QueueNotFull.wait (Lock);
+	}
+	
+	uint32_t Slot = Head % QueueSize;
+	Lock.unlock (); // The writer never touches the slot at Head
+	
+	memcpy (Queue [Slot], Shades, 160 * 144);
+	QueueFrame [Slot] = FrameNumber;
+	
+	Lock.lock ();
+	Head++;
+	Lock.unlock ();
+	QueueNotEmpty.notify_one ();
+}
+
+void VideoWriter::WriterLoop () {
+	while (1) {
+		std::unique_lock <std::mutex> Lock (QueueLock);
+		while (Head == Tail && !Quit)
+			QueueNotEmpty.wait (Lock);
+		
+		if (Head == Tail) // Quit and drained
+			return;
+		
+		uint32_t Slot = Tail % QueueSize;
+		Lock.unlock ();
+		
+		WriteFrame (Queue [Slot], QueueFrame [Slot]);
+		
+		Lock.lock ();
+		Tail++;
+		Lock.unlock ();
+		QueueNotFull.notify_one ();
+	}
+}
+
+void VideoWriter::WriteFrame (const uint8_t* Shades, uint32_t FrameNumber) {
+	if (Format == VIDEO_Y4M) {
+		fputs ("FRAME\n", Output);
+		for (int Plane = 0; Plane < 3; Plane++) // Planar Y, U, V
+			for (int i = 0; i < 160 * 144; i++)
+				Line [Plane * 160 * 144 + i] = ColorsYUV [Shades [i]][Plane];
+	} else {
+		for (int i = 0; i < 160 * 144; i++)
+			memcpy (Line + i * 3, ColorsRGB [Shades [i]], 3);
+	}
+	
+	fwrite (Line, 1, sizeof (Line), Output);
+	
+	if (HashOutput)
+		fprintf (HashOutput, "%u %016llx\n", FrameNumber, (unsigned long long) Utils::HashFrame (Shades, 160 * 144));
+	
+	FramesWritten++;
+}
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifndef VIDEOWRITER_H
+#define VIDEOWRITER_H
+
+// Formats
+#define VIDEO_Y4M 0 // YUV4MPEG2, 4:4:4
+#define VIDEO_RGB 1 // Raw RGB24, 160x144 frames back to back
+
+/* Streams every N-th completed frame to a file or stdout ("-").
+   Frames are queued as shades and colored on the writer thread. A full queue blocks the emulator
+   until the consumer catches up instead of writing from the CPU loop. */
+class VideoWriter {
+	public:
+		VideoWriter (const char* Filename, uint8_t _Format, uint32_t _Every, const char* HashFilename, const uint32_t* Colors);
+		~VideoWriter ();
+		void PushFrame (const uint8_t* Shades, uint32_t FrameNumber);
+		
+		uint32_t FramesWritten = 0;
+		uint32_t FramesBlocked = 0; // Times the emulator had to wait for the writer
+	private:
+		FILE* Output = NULL;
+		FILE* HashOutput = NULL;
+		uint8_t Format;
+		uint32_t Every;
+		
+		uint8_t ColorsRGB [4][3];
+		uint8_t ColorsYUV [4][3];
+		uint8_t Line [160 * 144 * 3]; // Writer thread conversion buffer
+		
+		// Bounded queue
+		static const uint32_t QueueSize = 8;
+		uint8_t Queue [QueueSize][160 * 144];
+		uint32_t QueueFrame [QueueSize];
+		uint32_t Head = 0; // Next slot to write
+		uint32_t Tail = 0; // Next slot to read
+		uint8_t Quit = 0;
+		std::mutex QueueLock;
+		std::condition_variable QueueNotEmpty;
+		std::condition_variable QueueNotFull;
+		std::thread Writer;
+		
+		void WriterLoop ();
+		void WriteFrame (const uint8_t* Shades, uint32_t FrameNumber);
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "WavWriter.h"
+
+WavWriter::WavWriter (const char* Filename, uint32_t _SampleRate) {
+	SampleRate = _SampleRate;
+	
+	Output = fopen (Filename, "wb");
+	if (Output == NULL) {
+		printf ("[ERR] Can't open audio output %s\n", Filename);
+		return;
+	}
+	
+	WriteHeader (); // Placeholder sizes until closed
+}
+
+WavWriter::~WavWriter () {
+	if (Output == NULL)
+		return;
+	
+	fseek (Output, 0, SEEK_SET);
+	WriteHeader ();
+	fclose (Output);
+}
+
+void WavWriter::Write (const int16_t* Samples, uint32_t Frames) {
+	if (Output == NULL)
+		return;
+	
+	fwrite (Samples, 4, Frames, Output); // Host is little endian, like WAV
+	FramesWritten += Frames;
+}
+
+static void PutLE (uint8_t* Out, uint32_t Value, uint8_t Bytes) {
+	for (int i = 0; i < Bytes; i++)
+		Out [i] = Value >> (i * 8);
+}
+
+void WavWriter::WriteHeader () {
+	uint8_t Header [44];
+	uint32_t DataSize = FramesWritten * 4;
+	
+	memcpy (Header, "RIFF", 4);
+	PutLE (Header + 4, 36 + DataSize, 4);
+	memcpy (Header + 8, "WAVEfmt ", 8);
+	PutLE (Header + 16, 16, 4); // fmt chunk size
+	PutLE (Header + 20, 1, 2); // PCM
+	PutLE (Header + 22, 2, 2); // Channels
+	PutLE (Header + 24, SampleRate, 4);
+	PutLE (Header + 28, SampleRate * 4, 4); // Bytes per second
+	PutLE (Header + 32, 4, 2); // Bytes per frame
+	PutLE (Header + 34, 16, 2); // Bits per sample
+	memcpy (Header + 36, "data", 4);
+	PutLE (Header + 40, DataSize, 4);
+	
+	fwrite (Header, 1, sizeof (Header), Output);
+}
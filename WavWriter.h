@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+// 16 bit stereo PCM. Sizes in the header are patched when closed.
+class WavWriter {
+	public:
+		WavWriter (const char* Filename, uint32_t _SampleRate);
+		~WavWriter ();
+		void Write (const int16_t* Samples, uint32_t Frames);
+		
+		uint32_t FramesWritten = 0;
+	private:
+		FILE* Output = NULL;
+		uint32_t SampleRate;
+		
+		void WriteHeader ();
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include "Window.h"
+
+Window::Window (const char* Title, uint16_t _PixelSize) {
+	PixelSize = _PixelSize;
+	
+	MainWindow = SDL_CreateWindow (Title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, Width * PixelSize, Height * PixelSize, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+	MainRenderer = SDL_CreateRenderer(MainWindow, -1, SDL_RENDERER_ACCELERATED);
+	MainTexture = SDL_CreateTexture (MainRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, Width, Height);
+	SDL_SetRenderDrawColor(MainRenderer, 0x00, 0x00, 0x00, 0x00);
+	SDL_RenderClear(MainRenderer);
+}
+
+Window::~Window () {
+	delete FrameScaler;
+	free (FrameScaled);
+	
+	SDL_DestroyTexture (MainTexture);
+	SDL_DestroyRenderer (MainRenderer);
+	SDL_DestroyWindow (MainWindow);
+}
+
+void Window::SetScaler (uint8_t Filter, uint8_t Factor, uint8_t Threads) {
+	delete FrameScaler;
+	free (FrameScaled);
+	FrameScaler = NULL;
+	FrameScaled = NULL;
+	
+	uint16_t TextureWidth = Width;
+	uint16_t TextureHeight = Height;
+	
+	if (Filter != SCALER_NONE) {
+		FrameScaler = new Scaler (Filter, Factor, Threads);
+		TextureWidth = FrameScaler->OutWidth;
+		TextureHeight = FrameScaler->OutHeight;
+		FrameScaled = (uint32_t*) malloc (TextureWidth * TextureHeight * 4);
+	}
+	
+	SDL_DestroyTexture (MainTexture);
+	MainTexture = SDL_CreateTexture (MainRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, TextureWidth, TextureHeight);
+}
+
+void Window::Render (PPU* ppu) {
+	ppu->ConvertFrame (FrameARGB); // Only convert shades to colors once per presented frame
+	
+	if (FrameScaler) {
+		FrameScaler->Scale (FrameARGB, FrameScaled);
+		SDL_UpdateTexture (MainTexture, NULL, FrameScaled, 4 * FrameScaler->OutWidth);
+	} else
+		SDL_UpdateTexture (MainTexture, NULL, FrameARGB, 4 * Width);
+	SDL_RenderCopy (MainRenderer, MainTexture, NULL, NULL);
+	SDL_RenderPresent (MainRenderer);
+}
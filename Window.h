@@ -0,0 +1,29 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "PPU.h"
+#include "Scaler.h"
+#ifndef WINDOW_H
+#define WINDOW_H
+
+/* The SDL window frames are presented in. Only the frontend uses SDL, the emulated machine just
+   keeps its last frame as shades for whoever shows it */
+class Window {
+	public:
+		Window (const char* Title, uint16_t _PixelSize);
+		~Window ();
+		void SetScaler (uint8_t Filter, uint8_t Factor, uint8_t Threads); // CPU-side upscaling before presenting
+		void Render (PPU* ppu); // Present its last completed frame, in its palette
+	private:
+		uint16_t PixelSize;
+		uint16_t Width = 160;
+		uint16_t Height = 144;
+		SDL_Window* MainWindow = NULL;
+		SDL_Renderer* MainRenderer = NULL;
+		SDL_Texture* MainTexture = NULL;
+		uint32_t FrameARGB [160 * 144]; // Conversion buffer for presenting
+		Scaler* FrameScaler = NULL;
+		uint32_t* FrameScaled = NULL;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "gbcore.h"
+#include "GameBoy.h"
+#include "Batch.h"
+
+// gb_core is only ever a GameBoy behind an opaque pointer
+static inline GameBoy* Machine (gb_core* gb) {
+	return (GameBoy*) gb;
+}
+
+gb_core* gb_create (const void* rom, size_t rom_size, uint32_t sample_rate) {
+	GameBoy* gb = new GameBoy (sample_rate ? sample_rate : 48000);
+	if (!gb->LoadROM ((const uint8_t*) rom, rom_size)) {
+		delete gb;
+		return NULL;
+	}
+	
+	gb->mmu->EchoSerial = 0;
+	return (gb_core*) gb;
+}
+
+void gb_destroy (gb_core* gb) {
+	delete Machine (gb);
+}
+
+void gb_reset (gb_core* gb) {
+	Machine (gb)->Reset ();
+}
+
+uint32_t gb_run_frame (gb_core* gb) {
+	return Machine (gb)->RunFrame ();
+}
+
+uint32_t gb_run_cycles (gb_core* gb, uint32_t clocks) {
+	return Machine (gb)->RunClocks (clocks);
+}
+
+void gb_set_input (gb_core* gb, uint8_t buttons) {
+	MMU* mmu = Machine (gb)->mmu;
+	if (mmu->JoypadState != buttons) // Only changes can raise the interrupt
+		mmu->SetJoypad (buttons);
+}
+
+const uint8_t* gb_framebuffer (gb_core* gb) {
+	return Machine (gb)->ppu->GetFrame ();
+}
+
+void gb_framebuffer_argb (gb_core* gb, uint32_t* out) {
+	Machine (gb)->ppu->ConvertFrame (out);
+}
+
+void gb_set_palette (gb_core* gb, const uint32_t colors [4]) {
+	Machine (gb)->ppu->SetColors (colors);
+}
+
+uint32_t gb_frame_count (gb_core* gb) {
+	return Machine (gb)->ppu->FrameCount;
+}
+
+uint32_t gb_audio_samples (gb_core* gb, int16_t* out, uint32_t frames) {
+	GameBoy* Core = Machine (gb);
+	Core->apu->Flush (Core->cpu->ClockCount); // Samples are only made up to the last register access otherwise
+	return Core->apu->Output.Read (out, frames);
+}
+
+uint8_t gb_read (gb_core* gb, uint16_t address) {
+	return Machine (gb)->mmu->PeekByteAt (address);
+}
+
+void gb_write (gb_core* gb, uint16_t address, uint8_t value) {
+	Machine (gb)->mmu->SetByteAt (address, value);
+}
+
+size_t gb_battery_ram_size (gb_core* gb) {
+	return 0x2000 * Machine (gb)->mmu->ExternalRAMSize;
+}
+
+void gb_get_battery_ram (gb_core* gb, void* out) {
+	MMU* mmu = Machine (gb)->mmu;
+	mmu->CopyExternalRAM ((uint8_t*) out, 0x2000 * mmu->ExternalRAMSize);
+}
+
+void gb_set_battery_ram (gb_core* gb, const void* in) {
+	MMU* mmu = Machine (gb)->mmu;
+	mmu->SetExternalRAM ((const uint8_t*) in, 0x2000 * mmu->ExternalRAMSize);
+}
+
+gb_core* gb_fork (gb_core* gb) {
+	return (gb_core*) Machine (gb)->Fork ();
+}
+
+size_t gb_state_size (gb_core* gb) {
+	return Machine (gb)->StateSize ();
+}
+
+size_t gb_save_state (gb_core* gb, void* buffer, size_t capacity) {
+	return Machine (gb)->SaveState ((uint8_t*) buffer, capacity);
+}
+
+int gb_load_state (gb_core* gb, const void* buffer, size_t size) {
+	return Machine (gb)->LoadState ((const uint8_t*) buffer, size);
+}
+
+// Batches
+gb_batch* gb_batch_create (const void* rom, size_t rom_size, uint32_t count, uint32_t threads) {
+	Batch* Machines = new Batch ((const uint8_t*) rom, rom_size, count, threads);
+	if (!Machines->Valid) {
+		delete Machines;
+		return NULL;
+	}
+	return (gb_batch*) Machines;
+}
+
+void gb_batch_destroy (gb_batch* batch) {
+	delete (Batch*) batch;
+}
+
+void gb_batch_reset (gb_batch* batch) {
+	((Batch*) batch)->Reset ();
+}
+
+void gb_batch_watch (gb_batch* batch, const uint16_t* addresses, uint32_t count) {
+	((Batch*) batch)->Watch (addresses, count);
+}
+
+void gb_batch_step (gb_batch* batch, const uint8_t* actions, uint32_t frames, uint8_t* screens, uint8_t* ram) {
+	((Batch*) batch)->Step (actions, frames, screens, ram);
+}
+
+gb_core* gb_batch_machine (gb_batch* batch, uint32_t index) {
+	Batch* Machines = (Batch*) batch;
+	return index < Machines->Count ? (gb_core*) Machines->Machine (index) : NULL;
+}
@@ -0,0 +1,78 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef GBCORE_H
+#define GBCORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* C API of libgbcore, the emulated machine without any frontend.
+   gb_create and gb_fork are the only calls that allocate; everything else works in place or in buffers
+   the caller owns. A fork shares RAM with its source and copies a block the first time it writes to it. An instance isn't thread safe, separate instances (forks too) are independent. */
+
+typedef struct gb_core gb_core;
+
+#define GB_WIDTH 160
+#define GB_HEIGHT 144
+#define GB_CLOCK_RATE 4194304 // Clocks per emulated second
+
+// Buttons for gb_set_input, bit set = pressed
+#define GB_BUTTON_RIGHT 0x01
+#define GB_BUTTON_LEFT 0x02
+#define GB_BUTTON_UP 0x04
+#define GB_BUTTON_DOWN 0x08
+#define GB_BUTTON_A 0x10
+#define GB_BUTTON_B 0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START 0x80
+
+gb_core* gb_create (const void* rom, size_t rom_size, uint32_t sample_rate); // The ROM is copied. NULL - Not a ROM. sample_rate: 0 - 48000, kept within 8000 - 192000
+void gb_destroy (gb_core* gb);
+void gb_reset (gb_core* gb); // Power cycle, battery RAM is kept
+
+// Running, both return the clocks actually run (fewer once the CPU has stopped)
+uint32_t gb_run_frame (gb_core* gb); // Until the next frame completes
+uint32_t gb_run_cycles (gb_core* gb, uint32_t clocks); // At least clocks, ends on an instruction boundary
+void gb_set_input (gb_core* gb, uint8_t buttons); // GB_BUTTON_*, held until changed
+
+// Output
+const uint8_t* gb_framebuffer (gb_core* gb); // Last completed frame, GB_WIDTH * GB_HEIGHT shades, 0 - Lightest, 3 - Darkest
+void gb_framebuffer_argb (gb_core* gb, uint32_t* out); // The same in the palette, GB_WIDTH * GB_HEIGHT ARGB8888
+void gb_set_palette (gb_core* gb, const uint32_t colors [4]); // ARGB8888, lightest first
+uint32_t gb_frame_count (gb_core* gb);
+uint32_t gb_audio_samples (gb_core* gb, int16_t* out, uint32_t frames); // Interleaved stereo, returns the frames written
+
+// Memory, as the CPU sees it with the current banks
+uint8_t gb_read (gb_core* gb, uint16_t address); // No side effects, nothing is blocked
+void gb_write (gb_core* gb, uint16_t address, uint8_t value); // Exactly like a CPU write (MBC, I/O registers)
+size_t gb_battery_ram_size (gb_core* gb); // External RAM the cartridge has
+void gb_get_battery_ram (gb_core* gb, void* out); // gb_battery_ram_size bytes
+void gb_set_battery_ram (gb_core* gb, const void* in);
+
+// Forks - an independent copy of a running machine in microseconds: ROM and RAM are shared copy-on-write
+// in 8KB blocks, so a fork costs a few KB until it writes. Destroy with gb_destroy, in any order
+gb_core* gb_fork (gb_core* gb);
+
+// States, same format as the emulator's state files before compression
+size_t gb_state_size (gb_core* gb);
+size_t gb_save_state (gb_core* gb, void* buffer, size_t capacity); // Bytes written, 0 - Didn't fit
+int gb_load_state (gb_core* gb, const void* buffer, size_t size); // 1 - Loaded, untouched otherwise
+
+/* Batches - count machines of the same game in lockstep, for training. They share one copy of the ROM
+   and are stepped on a pool of threads; observations go into struct-of-arrays buffers of the caller */
+typedef struct gb_batch gb_batch;
+
+gb_batch* gb_batch_create (const void* rom, size_t rom_size, uint32_t count, uint32_t threads); // threads = 0: One per core
+void gb_batch_destroy (gb_batch* batch);
+void gb_batch_reset (gb_batch* batch);
+void gb_batch_watch (gb_batch* batch, const uint16_t* addresses, uint32_t count); // RAM bytes to observe, copied
+// actions [count] - GB_BUTTON_*, screens [count][GB_WIDTH * GB_HEIGHT] shades, ram [count][watched], NULL - Skip
+void gb_batch_step (gb_batch* batch, const uint8_t* actions, uint32_t frames, uint8_t* screens, uint8_t* ram);
+gb_core* gb_batch_machine (gb_batch* batch, uint32_t index); // Owned by the batch, not to be used during a step
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
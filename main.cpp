@@ -2,59 +2,387 @@
 #include <stdio.h>
 #include <chrono>
 #include <SDL2/SDL.h>
-#include "PPU.h"
-#include "MMU.h"
-#include "CPU.h"
+#include "GameBoy.h"
+#include "Window.h"
 #include "utils.h"
+#include "VideoWriter.h"
+#include "SharedMemory.h"
+#include "WavWriter.h"
+#include "FrameSync.h"
+#include "Rewind.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Debugger.h"
+#include "Console.h"
 
 using namespace Utils;
 
 void OpenFileError (const char* Filename);
 void LoadROM (MMU* mmu);
 void AnalyzeROM (MMU* mmu);
-void CPULoop (CPU* cpu, MMU* mmu, PPU* ppu);
+void CPULoop (GameBoy* gb);
 
 void SaveGame (MMU* mmu);
-void SaveState (uint8_t ID);
-void LoadState (uint8_t ID);
-void Reset (MMU* &mmu, CPU* &cpu, PPU* &ppu);
+void SaveState (GameBoy* gb, uint8_t ID);
+uint8_t LoadState (GameBoy* gb, uint8_t ID);
+void SetupOutput (PPU* ppu);
+void AudioCallback (void* Userdata, uint8_t* Stream, int Length);
 
-uint8_t ROMwBattery [] = {0x03, 0x06, 0x09, 0x0D, 0x0F, 0x10, 0x1B, 0x1E, 0x20, 0xFF};
-uint8_t ROMwRAM [] = {0x02, 0x03, 0x06, 0x08, 0x09, 0x0C, 0x0D, 0x10, 0x12, 0x13, 0x1A, 0x1B, 0x1D, 0x1E, 0x20, 0x22, 0xFF};
+// Keyboard -> Joypad
+const struct {
+	SDL_Scancode Key;
+	uint8_t Button;
+} KeyMap [] = {
+	{SDL_SCANCODE_RIGHT, JOYPAD_RIGHT},
+	{SDL_SCANCODE_LEFT, JOYPAD_LEFT},
+	{SDL_SCANCODE_UP, JOYPAD_UP},
+	{SDL_SCANCODE_DOWN, JOYPAD_DOWN},
+	{SDL_SCANCODE_A, JOYPAD_A},
+	{SDL_SCANCODE_S, JOYPAD_B},
+	{SDL_SCANCODE_ESCAPE, JOYPAD_B},
+	{SDL_SCANCODE_LSHIFT, JOYPAD_SELECT},
+	{SDL_SCANCODE_RETURN, JOYPAD_START}
+};
 
 char* ROMFilename;
 char* SaveFilename;
 
+// Options
+uint8_t PaletteID = PALETTE_GRAYSCALE;
+uint8_t ScalerFilter = SCALER_NONE;
+uint8_t ScaleFactor = 2;
+uint8_t ScalerThreads = 1;
+uint8_t Headless = 0;
+uint32_t FrameLimit = 0; // 0 - Run until closed
+const char* VideoFilename = NULL;
+const char* VideoHashFilename = NULL;
+uint32_t VideoEvery = 1;
+const char* SharedMemoryName = NULL;
+const char* SharedMemoryRegions = NULL;
+uint32_t SampleRate = 48000;
+const char* WavFilename = NULL;
+uint8_t ProbeInputLatency = 0;
+int SyncMode = -1; // -1 - Audio if there's a device, video otherwise
+uint8_t CompressStates = 1;
+uint32_t RewindMB = 0; // 0 - Off
+uint32_t RewindEvery = 1;
+uint8_t RunAhead = 0; // Frames
+const char* RecordFilename = NULL;
+const char* PlayFilename = NULL;
+uint32_t MovieHashEvery = 60;
+const char* ProfileFilename = "profile.json";
+const char* HotSpotsPrefix = NULL;
+const char* SymbolFilename = NULL;
+uint32_t HotSpotEvery = 1;
+uint8_t DebugMode = 0;
+const char* TraceFilename = NULL;
+uint32_t TraceLast = 0; // 0 - Stream every instruction
+
+Window* Screen = NULL; // NULL - Headless
+VideoWriter* Video = NULL;
+SharedMemory* Shared = NULL;
+WavWriter* Wav = NULL;
+SDL_AudioDeviceID AudioDevice = 0;
+FrameSync* Sync = NULL;
+StateWriter* States = NULL;
+uint8_t* QuickState = NULL; // In-memory snapshot, allocated once
+uint32_t QuickStateSize = 0;
+uint8_t* SlotState = NULL; // Ctrl+F5 - F8 saves, the writer keeps a copy
+Rewind* RewindBuffer = NULL;
+uint8_t* RunAheadState = NULL;
+Movie* InputMovie = NULL;
+Debugger* Debug = NULL;
+Console* DebugConsole = NULL;
+Tracer* Trace = NULL;
+
 // Initializations
 int main (int argc, char** argv) {
 	if (argc < 2) {
 		printf ("Please specify Game ROM Filename:\n");
-		printf ("\t- %s Game.gb\n", argv[0]);
+		printf ("\t- %s Game.gb [Options]\n", argv[0]);
+		printf ("Options:\n");
+		printf ("\t-palette gray|green|pocket\tOutput colors\n");
+		printf ("\t-scaler nearest|scalenx|xbr\tCPU-side upscaling filter\n");
+		printf ("\t-scale N\t\t\tWindow / upscaling factor, 1 - 16 (Default 2)\n");
+		printf ("\t-scalerthreads N\t\tThreads used for upscaling\n");
+		printf ("\t-headless\t\t\tNo window, no input and no throttling\n");
+		printf ("\t-frames N\t\t\tStop after N frames\n");
+		printf ("\t-video FILE|-\t\t\tStream frames as Y4M (raw RGB24 for .rgb files)\n");
+		printf ("\t-videoevery N\t\t\tOnly stream every N-th frame\n");
+		printf ("\t-videohash FILE\t\t\tWrite a hash of every streamed frame\n");
+		printf ("\t-shm NAME\t\t\tPublish frames, I/O and WRAM to POSIX shared memory\n");
+		printf ("\t-shmregions A:L,...\t\tMemory regions to publish (Hex, default C000:2000)\n");
+		printf ("\t-samplerate N\t\t\tAudio sample rate (Default 48000)\n");
+		printf ("\t-wav FILE\t\t\tWrite the sound output to a WAV file\n");
+		printf ("\t-inputlatency\t\t\tReport the time from each input change to the first frame that reacts\n");
+		printf ("\t-statecompress 0|1\t\tCompress state files (Default 1)\n");
+		printf ("\t-rewind MB\t\t\tKeep rewind history within MB of memory, hold R to rewind\n");
+		printf ("\t-rewindevery N\t\t\tOnly keep every N-th frame for rewinding\n");
+		printf ("\t-runahead N\t\t\tShow the frame N frames ahead of the current input\n");
+		printf ("\t-sync audio|video|none\t\tPace emulation from the audio queue or once per frame\n");
+		printf ("\t-record FILE\t\t\tRecord the joypad into a movie, from power on\n");
+		printf ("\t-play FILE\t\t\tReplay a movie unthrottled, checking its frame hashes\n");
+		printf ("\t-moviehash N\t\t\tStore a frame hash every N frames when recording (Default 60)\n");
+		printf ("\t-profile FILE\t\t\tWhere the profile goes at exit / on SIGUSR1 (make PROFILE=1 builds)\n");
+		printf ("\t-hotspots PREFIX\t\tWrite ROM hot spots, coverage and folded stacks at exit (make HOTSPOTS=1 builds)\n");
+		printf ("\t-hotspotevery N\t\t\tSample every N-th instruction instead of counting all of them\n");
+		printf ("\t-sym FILE\t\t\tSymbols for the hot spots (Default: Game.sym next to the ROM)\n");
+		printf ("\t-debug\t\t\t\tStart held, breakpoints and watchpoints from commands on stdin (h for help)\n");
+		printf ("\t-trace FILE\t\t\tWrite a binary trace of every instruction (gbtrace decodes it)\n");
+		printf ("\t-tracelast N\t\t\tOnly keep the last N instructions, written at exit / on a break / on a crash\n");
 		return 1;
 	}
 	
+	for (int i = 2; i < argc; i++) {
+		if (strcmp (argv[i], "-palette") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp (argv[i], "green") == 0)
+				PaletteID = PALETTE_DMG_GREEN;
+			else if (strcmp (argv[i], "pocket") == 0)
+				PaletteID = PALETTE_POCKET;
+			else
+				PaletteID = PALETTE_GRAYSCALE;
+		} else if (strcmp (argv[i], "-scaler") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp (argv[i], "nearest") == 0)
+				ScalerFilter = SCALER_NEAREST;
+			else if (strcmp (argv[i], "scalenx") == 0)
+				ScalerFilter = SCALER_SCALENX;
+			else if (strcmp (argv[i], "xbr") == 0)
+				ScalerFilter = SCALER_XBR;
+			else
+				ScalerFilter = SCALER_NONE;
+		} else if (strcmp (argv[i], "-scale") == 0 && i + 1 < argc) {
+			int Factor = atoi (argv[++i]);
+			ScaleFactor = Factor < 1 ? 1 : (Factor > 16 ? 16 : Factor); // What the scalers take
+		}
+		else if (strcmp (argv[i], "-scalerthreads") == 0 && i + 1 < argc)
+			ScalerThreads = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-headless") == 0)
+			Headless = 1;
+		else if (strcmp (argv[i], "-frames") == 0 && i + 1 < argc)
+			FrameLimit = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-video") == 0 && i + 1 < argc)
+			VideoFilename = argv[++i];
+		else if (strcmp (argv[i], "-videoevery") == 0 && i + 1 < argc)
+			VideoEvery = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-videohash") == 0 && i + 1 < argc)
+			VideoHashFilename = argv[++i];
+		else if (strcmp (argv[i], "-shm") == 0 && i + 1 < argc)
+			SharedMemoryName = argv[++i];
+		else if (strcmp (argv[i], "-shmregions") == 0 && i + 1 < argc)
+			SharedMemoryRegions = argv[++i];
+		else if (strcmp (argv[i], "-samplerate") == 0 && i + 1 < argc)
+			SampleRate = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-wav") == 0 && i + 1 < argc)
+			WavFilename = argv[++i];
+		else if (strcmp (argv[i], "-inputlatency") == 0)
+			ProbeInputLatency = 1;
+		else if (strcmp (argv[i], "-statecompress") == 0 && i + 1 < argc)
+			CompressStates = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-rewind") == 0 && i + 1 < argc)
+			RewindMB = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-rewindevery") == 0 && i + 1 < argc)
+			RewindEvery = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-runahead") == 0 && i + 1 < argc)
+			RunAhead = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-record") == 0 && i + 1 < argc)
+			RecordFilename = argv[++i];
+		else if (strcmp (argv[i], "-play") == 0 && i + 1 < argc)
+			PlayFilename = argv[++i];
+		else if (strcmp (argv[i], "-moviehash") == 0 && i + 1 < argc)
+			MovieHashEvery = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-profile") == 0 && i + 1 < argc) {
+			ProfileFilename = argv[++i];
+#ifndef PROFILE
+			printf ("[WARN] Built without the profiler (make PROFILE=1), -profile is ignored\n");
+#endif
+		} else if (strcmp (argv[i], "-hotspots") == 0 && i + 1 < argc) {
+			HotSpotsPrefix = argv[++i];
+#ifndef HOTSPOTS
+			printf ("[WARN] Built without hot spots (make HOTSPOTS=1), -hotspots is ignored\n");
+#endif
+		} else if (strcmp (argv[i], "-hotspotevery") == 0 && i + 1 < argc)
+			HotSpotEvery = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-sym") == 0 && i + 1 < argc)
+			SymbolFilename = argv[++i];
+		else if (strcmp (argv[i], "-debug") == 0)
+			DebugMode = 1;
+		else if (strcmp (argv[i], "-trace") == 0 && i + 1 < argc)
+			TraceFilename = argv[++i];
+		else if (strcmp (argv[i], "-tracelast") == 0 && i + 1 < argc)
+			TraceLast = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-sync") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp (argv[i], "audio") == 0)
+				SyncMode = SYNC_AUDIO;
+			else if (strcmp (argv[i], "video") == 0)
+				SyncMode = SYNC_VIDEO;
+			else
+				SyncMode = SYNC_NONE;
+		}
+		else
+			printf ("[WARN] Unknown option: %s\n", argv[i]);
+	}
+	
 	// Init SDL
-	printf ("[INFO] Initializing SDL...");
-	if (SDL_Init (SDL_INIT_EVERYTHING) < 0) {
-		printf ("\n[ERR] SDL failed to initialize: %s", SDL_GetError());
-		return 1;
+	if (!Headless) {
+		printf ("[INFO] Initializing SDL...");
+		if (SDL_Init (SDL_INIT_EVERYTHING) < 0) {
+			printf ("\n[ERR] SDL failed to initialize: %s", SDL_GetError());
+			return 1;
+		}
+		printf ("OK\n");
 	}
-	printf ("OK\n");
+	
+	if (SampleRate < APU_MIN_SAMPLE_RATE) // Same range as the APU, the device has to match it
+		SampleRate = APU_MIN_SAMPLE_RATE;
+	if (SampleRate > APU_MAX_SAMPLE_RATE)
+		SampleRate = APU_MAX_SAMPLE_RATE;
 	
 	// Init Hardware
-	MMU* mmu = new MMU;
-	CPU* cpu = new CPU (mmu);
-	PPU* ppu = new PPU ("Gameboy", 2);
+	GameBoy* gb = new GameBoy (SampleRate);
+	if (!Headless)
+		Screen = new Window ("Gameboy", ScaleFactor);
+	SetupOutput (gb->ppu);
+	
+	if (VideoFilename) {
+		uint8_t VideoFormat = VIDEO_Y4M;
+		if (strlen (VideoFilename) > 4 && strcmp (VideoFilename + strlen (VideoFilename) - 4, ".rgb") == 0)
+			VideoFormat = VIDEO_RGB;
+		Video = new VideoWriter (VideoFilename, VideoFormat, VideoEvery, VideoHashFilename, gb->ppu->GetColors ());
+	}
+	
+	if (SharedMemoryName)
+		Shared = new SharedMemory (SharedMemoryName, SharedMemoryRegions);
+	
+	if (WavFilename) // Drained by the emulator, no device needed
+		Wav = new WavWriter (WavFilename, SampleRate);
+	else if (!Headless) {
+		SDL_AudioSpec Wanted, Obtained;
+		memset (&Wanted, 0, sizeof (Wanted));
+		Wanted.freq = SampleRate;
+		Wanted.format = AUDIO_S16SYS;
+		Wanted.channels = 2;
+		Wanted.samples = 1024;
+		Wanted.callback = AudioCallback;
+		Wanted.userdata = gb->apu; // Kept across resets
+		
+		AudioDevice = SDL_OpenAudioDevice (NULL, 0, &Wanted, &Obtained, 0);
+		if (AudioDevice == 0)
+			printf ("[WARN] No audio device: %s\n", SDL_GetError ());
+		else
+			SDL_PauseAudioDevice (AudioDevice, 0);
+	}
+	
+	if (Headless || PlayFilename)
+		SyncMode = SYNC_NONE;
+	else if (SyncMode == -1 || (SyncMode == SYNC_AUDIO && AudioDevice == 0))
+		SyncMode = AudioDevice ? SYNC_AUDIO : SYNC_VIDEO;
+	Sync = new FrameSync (SyncMode, AudioDevice ? gb->apu : NULL, 2048 + SampleRate / 60); // Two device buffers and a frame
 	
 	ROMFilename = argv[1]; // Keep it for other functions to use
-	LoadROM (mmu);
+	LoadROM (gb->mmu);
+	
+	States = new StateWriter;
+	QuickState = (uint8_t*) malloc (gb->StateSize ());
+	SlotState = (uint8_t*) malloc (gb->StateSize ());
+	if (RewindMB)
+		RewindBuffer = new Rewind (gb, RewindMB * 1024 * 1024);
+	if (RewindEvery == 0)
+		RewindEvery = 1;
+	if (RunAhead)
+		RunAheadState = (uint8_t*) malloc (gb->StateSize ());
+	
+	if (PlayFilename)
+		InputMovie = new Movie (PlayFilename, MOVIE_PLAY, gb, 0);
+	else if (RecordFilename)
+		InputMovie = new Movie (RecordFilename, MOVIE_RECORD, gb, MovieHashEvery);
+	
+	if (InputMovie && !InputMovie->Valid) {
+		delete InputMovie;
+		delete gb;
+		delete Screen;
+		return 1;
+	}
+	
+#ifdef HOTSPOTS
+	HotSpots* Spots = NULL;
+	if (HotSpotsPrefix) {
+		Spots = new HotSpots (gb->mmu, &gb->cpu->ClockCount, HotSpotEvery);
+		gb->cpu->Spots = Spots;
+		
+		std::string Symbols = SymbolFilename ? SymbolFilename : ROMFilename;
+		if (!SymbolFilename && Symbols.rfind ('.') != std::string::npos)
+			Symbols = Symbols.substr (0, Symbols.rfind ('.')) + ".sym";
+		uint32_t Count = Spots->LoadSymbols (Symbols.c_str ());
+		if (Count)
+			printf ("[INFO] Loaded %d symbols from %s\n", Count, Symbols.c_str ());
+	}
+#endif
+	
+	if (TraceFilename) {
+		Trace = new Tracer (TraceFilename, gb->ROMID (), TraceLast);
+		if (Trace->Open) {
+			gb->cpu->Trace = Trace;
+			Trace->DumpOnCrash ();
+		} else {
+			delete Trace;
+			Trace = NULL;
+		}
+	}
+	
+	if (DebugMode) {
+		Debug = new Debugger (gb);
+		DebugConsole = new Console;
+		printf ("[INFO] Debugger commands are read from stdin, h for help, c to start\n");
+		Debug->Command ("p"); // Held at power on, so breakpoints can be set first
+	}
 	
 	// Loop
-	CPULoop (cpu, mmu, ppu);
+#ifdef PROFILE
+	Profiler::Start ();
+#endif
+	CPULoop (gb);
+#ifdef PROFILE
+	Profiler::Write (ProfileFilename, gb->cpu->ClockCount, gb->cpu->InstructionCount);
+#endif
+#ifdef HOTSPOTS
+	if (Spots) {
+		Spots->Write (HotSpotsPrefix);
+		gb->cpu->Spots = NULL;
+		delete Spots;
+	}
+#endif
+	
+	uint8_t Failed = 0;
+	if (InputMovie && InputMovie->Mode == MOVIE_PLAY) {
+		printf ("[INFO] Movie: %d hashes checked, %d mismatched, %d inputs out of sync%s\n", InputMovie->HashesChecked,
+			InputMovie->Mismatches, InputMovie->Desyncs, InputMovie->Finished ? "" : ", stopped before the end");
+		Failed = InputMovie->Mismatches || InputMovie->Desyncs || !InputMovie->Finished;
+	}
 	
 	// Cleanup
+	if (AudioDevice)
+		SDL_CloseAudioDevice (AudioDevice);
+	delete Video; // Flushes whatever is still queued
+	delete Shared;
+	delete Wav; // Patches the header
+	delete Sync;
+	delete States; // Waits for queued states
+	free (QuickState);
+	free (SlotState);
+	delete RewindBuffer;
+	free (RunAheadState);
+	delete InputMovie; // Ends the recording
+	delete DebugConsole;
+	delete Debug;
+	delete Trace; // Writes the rest
+	delete gb;
+	delete Screen;
 	SDL_Quit ();
 	printf ("\n\n[INFO] CPU Stopped.\n");
+	return Failed;
 }
 
 // ROM Management
@@ -73,6 +401,8 @@ void LoadROM (MMU* mmu) {
 	fseek (ROMfd, 0, SEEK_END);
 	uint32_t ROMSize = ftell (ROMfd);
 	ROMfd = freopen (ROMFilename, "rb", ROMfd);
+	if (ROMSize > MMU_ROM_SIZE)
+		ROMSize = MMU_ROM_SIZE;
 	
 	if (fread(mmu->ROM, 1, ROMSize, ROMfd) != ROMSize)
 		OpenFileError (ROMFilename);
@@ -90,8 +420,11 @@ void LoadROM (MMU* mmu) {
 		printf ("[INFO] Found savefile for game at %s\n", SaveFilename);
 		
 		uint32_t SaveSize = 0x2000 * mmu->ExternalRAMSize;
-		if (fread (mmu->ExternalRAM, 1, SaveSize, Savefile) != SaveSize) // Load External RAM
+		uint8_t* Save = (uint8_t*) malloc (SaveSize);
+		if (fread (Save, 1, SaveSize, Savefile) != SaveSize) // Load External RAM
 			OpenFileError (SaveFilename);
+		mmu->SetExternalRAM (Save, SaveSize);
+		free (Save);
 		
 		fclose (Savefile);
 	}
@@ -113,55 +446,10 @@ void AnalyzeROM (MMU* mmu) {
 	else
 		printf ("Unknown ROM\n");
 	
-	uint8_t ROMType = 0; // Actual ROM Type
-	uint8_t ROMBattery = 0;
-	uint8_t ROMRAM = 0;
-	uint8_t CartridgeROMType = mmu->GetByteAt (0x0147);
-	
-	if (CartridgeROMType == 0x00)
-		ROMType = 0; // ROM Only
-	else if (CartridgeROMType < 0x04)
-		ROMType = 1; // MBC1
-	else if (CartridgeROMType < 0x07)
-		ROMType = 2; // MBC2
-	else if (CartridgeROMType < 0x0A)
-		ROMType = 0; // ROM + RAM
-	else if (CartridgeROMType < 0x0E)
-		ROMType = 4; // MMM01, there's no MBC4
-	else if (CartridgeROMType < 0x18)
-		ROMType = 3; // MBC3
-	else if (CartridgeROMType < 0x1F)
-		ROMType = 5; // MBC5
-	else if (CartridgeROMType < 0x21)
-		ROMType = 6; // MBC6
-	else if (CartridgeROMType < 0x23)
-		ROMType = 7; // MBC7
-	
-	uint8_t ExternalRAMSize = mmu->GetByteAt (0x0149);
-	
-	switch (ExternalRAMSize) {
-		case 0: mmu->ExternalRAMSize = 0; break;
-		case 1: mmu->ExternalRAMSize = 1; break;
-		case 2: mmu->ExternalRAMSize = 1; break;
-		case 3: mmu->ExternalRAMSize = 4; break;
-		case 4: mmu->ExternalRAMSize = 16; break;
-		case 5: mmu->ExternalRAMSize = 8; break;
-		default: break;
-	}
-	
-	uint8_t ROMwBatteryCount = sizeof (ROMwBattery);
-	uint8_t ROMwRAMCount = sizeof (ROMwRAM);
-	
-	for (int i = 0; i < ROMwBatteryCount; i++)
-		if (CartridgeROMType == ROMwBattery [i])
-			ROMBattery = 1;
-	
-	for (int i = 0; i < ROMwRAMCount; i++)
-		if (CartridgeROMType == ROMwRAM [i])
-			ROMRAM = 1;
+	mmu->ParseHeader ();
 	
 	printf ("ROM Type: ");
-	switch (ROMType) {
+	switch (mmu->ROMType) {
 		case 0: printf ("ROM Only\n"); break;
 		case 1: printf ("MBC1\n"); break;
 		case 2: printf ("MBC2\n"); break;
@@ -174,20 +462,16 @@ void AnalyzeROM (MMU* mmu) {
 	}
 	
 	printf ("ROM Battery: ");
-	if (ROMBattery)
+	if (mmu->ROMBattery)
 		printf ("YES\n");
 	else
 		printf ("NO\n");
 	
 	printf ("ROM w/ RAM: ");
-	if (ROMRAM)
+	if (mmu->ROMRAM)
 		printf ("YES\n");
 	else
 		printf ("NO\n");
-	
-	mmu->ROMType = ROMType;
-	mmu->ROMBattery = ROMBattery;
-	mmu->ROMRAM = ROMRAM;
 }
 
 // State modifications
@@ -195,97 +479,163 @@ void SaveGame (MMU* mmu) {
 	if (mmu->ExternalRAMSize != 0) {
 		printf ("[INFO] Saving External RAM (Savegame) to %s\n", SaveFilename);
 
+		uint32_t SaveSize = 0x2000 * mmu->ExternalRAMSize;
+		uint8_t* Save = (uint8_t*) malloc (SaveSize);
+		mmu->CopyExternalRAM (Save, SaveSize);
+		
 		FILE* Savefile = fopen (SaveFilename, "wb");
-		fwrite (mmu->ExternalRAM, 1, 0x2000 * mmu->ExternalRAMSize, Savefile);
+		fwrite (Save, 1, SaveSize, Savefile);
 		fclose (Savefile);
+		free (Save);
 	}
 }
 
-void SaveState (uint8_t ID) {
-	char* StateName = (char*) malloc (strlen (ROMFilename) + 9);
-	strcpy (StateName, ROMFilename);
-	strcat (StateName, ".state");
-	snprintf (StateName + strlen(StateName), 4, "%d", ID);
-	
-	printf ("[INFO] Saving State %d to %s\n", ID, StateName);
-	// TODO State saving
+void StateFilename (char* Filename, uint32_t Size, uint8_t ID) {
+	snprintf (Filename, Size, "%s.state%d", ROMFilename, ID);
 }
 
-void Reset (MMU* &mmu, CPU* &cpu, PPU* &ppu) {
-	delete mmu;
-	delete cpu;
-	delete ppu;
+void SaveState (GameBoy* gb, uint8_t ID) {
+	char Filename [256];
+	StateFilename (Filename, sizeof (Filename), ID);
+	
+	uint32_t Size = gb->SaveState (SlotState, gb->StateSize ());
+	printf ("[INFO] Saving State %d to %s\n", ID, Filename);
+	States->Write (Filename, SlotState, Size, CompressStates);
+}
+
+uint8_t LoadState (GameBoy* gb, uint8_t ID) {
+	char Filename [256];
+	StateFilename (Filename, sizeof (Filename), ID);
+	
+	States->Wait (); // It may still be on its way to disk
+	
+	uint32_t Size = 0;
+	uint8_t* State = StateWriter::ReadFile (Filename, Size);
+	if (State == NULL) {
+		printf ("[ERR] No valid state in %s\n", Filename);
+		return 0;
+	}
+	
+	uint8_t Loaded = gb->LoadState (State, Size);
+	if (Loaded)
+		printf ("[INFO] Loaded State %d from %s\n", ID, Filename);
+	free (State);
+	return Loaded;
+}
 
-	mmu = new MMU;
-	cpu = new CPU (mmu);
-	ppu = new PPU ("Gameboy", 2);
-	LoadROM (mmu);
+void SetupOutput (PPU* ppu) {
+	ppu->SetPalette (PaletteID);
+	if (Screen && ScalerFilter != SCALER_NONE)
+		Screen->SetScaler (ScalerFilter, ScaleFactor, ScalerThreads);
 }
 
-/* TODO Serial+Sound
+// Runs on the SDL audio thread, silence on underrun
+void AudioCallback (void* Userdata, uint8_t* Stream, int Length) {
+	APU* apu = (APU*) Userdata;
+	uint32_t Frames = Length / 4;
+	uint32_t Read = apu->Output.Read ((int16_t*) Stream, Frames);
+	
+	if (Read < Frames)
+		memset (Stream + Read * 4, 0, (Frames - Read) * 4);
+}
+
+/* TODO Serial
 FF02 - Serial
-FF10 -> FF26 // Sound
 */
 
-// Clock Speed: 4.194304 MHz
-void CPULoop (CPU* cpu, MMU* mmu, PPU* ppu) {
+void CPULoop (GameBoy* gb) {
 	// Main Loop Variables
 	SDL_Event ev;
-	const uint8_t *Keyboard = SDL_GetKeyboardState (NULL);
-	uint8_t* IOMap = mmu->IOMap;
+	static const uint8_t NoKeys [SDL_NUM_SCANCODES] = {0};
+	const uint8_t *Keyboard = Headless ? NoKeys : SDL_GetKeyboardState (NULL);
+	CPU* cpu = gb->cpu;
+	MMU* mmu = gb->mmu;
+	PPU* ppu = gb->ppu;
 	
 	// Time Events - Clock independent
 	auto StartTime = std::chrono::high_resolution_clock::now ();
-	uint64_t ClockCompensation = 0;
 	uint64_t LastInputTime = 0;
 	uint64_t LastRenderTime = 0;
-	uint64_t LastLoopTime = 0;
 	uint64_t LastDebugTime = 0; // To show info
 	
 	// Input status
 	uint8_t PressDebug = 0;
 	uint8_t PressControlR = 0;
+	uint8_t Rewinding = 0;
 	uint8_t Quit = 0;
 	
 	// Timing
-	uint32_t LastLineDrawClock = 0;
-	uint32_t PixelTransferDuration = 0;
-	uint32_t ClocksPerSec = 4194304;
-	uint32_t ClocksPerMS = ClocksPerSec / 1000;
-	uint32_t LastMSClock = 0;
-	uint32_t LastTimerClock = 0;
-	uint32_t LastDivClock = 0;
+	uint32_t LastSyncClock = 0;
 	uint32_t LastDebugClock = 0;
 	uint32_t LastDebugInstructionCount = 0;
+	uint32_t LastFrameCount = 0;
+	uint32_t LastAudioClock = 0;
+	uint32_t LastInputClock = 0;
+	
+	// Joypad
+	uint8_t KeyboardButtons = 0; // Only changed by key events
+	uint8_t ExternalInput = 0; // Buttons pressed through shared memory
+	uint8_t ProbePending = 0; // Waiting for a frame to react to the last input change
+	uint32_t ProbeTicks = 0;
+	uint32_t ProbeFrame = 0;
+	uint64_t ProbeHash = 0;
+	
+	// Run-ahead cost since the last report
+	uint64_t RunAheadTime = 0;
+	uint32_t RunAheadFrames = 0;
+	
+	// Rebase everything that counts emulated clocks or frames, after the machine changed under us
+	auto Rebase = [&] () {
+		cpu = gb->cpu;
+		mmu = gb->mmu;
+		ppu = gb->ppu;
+		
+		LastSyncClock = LastInputClock = LastAudioClock = LastDebugClock = cpu->ClockCount;
+		LastDebugInstructionCount = cpu->InstructionCount;
+		LastFrameCount = ppu->FrameCount;
+		ProbePending = 0;
+		Sync->Reset ();
+		
+		if (InputMovie && InputMovie->Mode == MOVIE_RECORD) { // Not one run anymore
+			printf ("[WARN] Movie recording stopped\n");
+			delete InputMovie;
+			InputMovie = NULL;
+		}
+	};
 
 	// Main Loop
 	while (!Quit) {
 		uint64_t CurrentTime = GetCurrentTime (&StartTime);
 		
-		// Throttle
-		if (CurrentTime - LastLoopTime <= 4000) { // Check if Host CPU is faster, every 4ms
-			uint8_t Throttle = 0;
-			
-			if (cpu->ClockCount - LastMSClock >= (ClocksPerMS + ClockCompensation) << 2 && !Keyboard [SDL_SCANCODE_SPACE]) // Press space to disable throttling
-				Throttle = 1;
-			else if (cpu->ClockCount - LastMSClock >= ClocksPerMS + (ClockCompensation >> 2) && Keyboard [SDL_SCANCODE_BACKSPACE]) // x4 slow motion
-				Throttle = 1;
+		// Rewind, one stored state per displayed frame while R is held
+		if (Rewinding) {
+			SDL_PumpEvents ();
+			if (!Keyboard [SDL_SCANCODE_R]) {
+				Rewinding = 0;
+				Rebase ();
+				continue;
+			}
 			
-			if (Throttle) {
-				uint32_t usToSleep = 4000 - (CurrentTime - LastLoopTime);
-				MicroSleep (usToSleep);
-				LastLoopTime = GetCurrentTime (&StartTime);
-				LastMSClock = cpu->ClockCount;
-				
-				uint32_t MicroSleepOvershoot = (LastLoopTime - CurrentTime) - usToSleep; // How much time it actually slept - time it had to sleep
-				ClockCompensation = ((ClocksPerSec / 1000000) * MicroSleepOvershoot) >> 2; // Dont use float, since time calculations are already inexact. Having a precise calculation here would result in a faster-than-GB CPU,
-																						   // also divide by 4, to accomodate extra inaccuracies
-				if (MicroSleepOvershoot > 12000)
-					printf ("[WARN] MicroSleep Overshoot is over 12ms (%d us), CPU can't catch up!\n", MicroSleepOvershoot);
+			if (RewindBuffer->StepBack ()) {
+				Rebase ();
+				if (Screen)
+					Screen->Render (ppu);
 			}
-		} else { // Passed one milisecond without throttling
-			LastLoopTime = CurrentTime;
-			LastMSClock = cpu->ClockCount;
+			MicroSleep (SYNC_FRAME_NS / 1000);
+			continue;
+		}
+		
+		// Throttle, once per emulated frame
+		if (cpu->ClockCount - LastSyncClock >= SYNC_FRAME_CLOCKS) {
+			LastSyncClock += SYNC_FRAME_CLOCKS;
+			
+			uint8_t Slowdown = 1;
+			if (Keyboard [SDL_SCANCODE_SPACE]) // Press space to disable throttling
+				Slowdown = 0;
+			else if (Keyboard [SDL_SCANCODE_BACKSPACE]) // x4 slow motion
+				Slowdown = 4;
+			
+			Sync->Frame (Slowdown);
 		}
 		
 		// Show debug info
@@ -298,206 +648,234 @@ void CPULoop (CPU* cpu, MMU* mmu, PPU* ppu) {
 			
 			LastDebugClock = cpu->ClockCount;
 			LastDebugInstructionCount = cpu->InstructionCount;
+			Sync->Report ();
+			if (RewindBuffer)
+				RewindBuffer->Report ();
+			if (RunAheadFrames) {
+				printf ("[INFO] Run-ahead: %d frames ahead, %.3f ms extra per frame\n", RunAhead, (double) RunAheadTime / RunAheadFrames / 1000);
+				RunAheadTime = 0;
+				RunAheadFrames = 0;
+			}
 		}
 			
-		// Input - SDL
-		if (CurrentTime - LastInputTime >= 1000000 / 30) { // 30 Hz
+		// Input - SDL, once per emulated frame (30 Hz while stepping in the debugger)
+		if (cpu->ClockCount - LastInputClock >= SYNC_FRAME_CLOCKS || (cpu->Debugging && CurrentTime - LastInputTime >= 1000000 / 30)) {
+			LastInputClock = cpu->ClockCount;
 			LastInputTime = CurrentTime;
+			uint32_t KeyTicks = 0;
 			
-			while (SDL_PollEvent(&ev)) {
+			while (!Headless && SDL_PollEvent(&ev)) {
 				if (ev.type == SDL_QUIT) {
 					SaveGame (mmu); // Save game on poweroff
 					Quit = 1;
+				} else if ((ev.type == SDL_KEYDOWN || ev.type == SDL_KEYUP) && !ev.key.repeat) {
+					for (uint32_t i = 0; i < sizeof (KeyMap) / sizeof (KeyMap [0]); i++) {
+						if (ev.key.keysym.scancode != KeyMap [i].Key)
+							continue;
+						
+						if (ev.type == SDL_KEYDOWN)
+							KeyboardButtons |= KeyMap [i].Button;
+						else
+							KeyboardButtons &= ~KeyMap [i].Button;
+						
+						if (KeyTicks == 0)
+							KeyTicks = ev.key.timestamp;
+					}
+					
+					// States: F5 - F8 load slot 1 - 4, with Ctrl save. F9 snapshot in memory, F10 back to it
+					SDL_Scancode Key = ev.key.keysym.scancode;
+					if (ev.type == SDL_KEYDOWN && Key >= SDL_SCANCODE_F5 && Key <= SDL_SCANCODE_F8) {
+						if (Keyboard [SDL_SCANCODE_LCTRL] || Keyboard [SDL_SCANCODE_RCTRL])
+							SaveState (gb, Key - SDL_SCANCODE_F5 + 1);
+						else if (LoadState (gb, Key - SDL_SCANCODE_F5 + 1))
+							Rebase ();
+					} else if (ev.type == SDL_KEYDOWN && Key == SDL_SCANCODE_F9) {
+						auto Start = std::chrono::high_resolution_clock::now ();
+						QuickStateSize = gb->SaveState (QuickState, gb->StateSize ());
+						printf ("[INFO] Snapshot taken (%d bytes, %d us)\n", QuickStateSize, (uint32_t) GetCurrentTime (&Start));
+					} else if (ev.type == SDL_KEYDOWN && Key == SDL_SCANCODE_F10 && QuickStateSize) {
+						auto Start = std::chrono::high_resolution_clock::now ();
+						if (gb->LoadState (QuickState, QuickStateSize)) {
+							printf ("[INFO] Snapshot restored (%d us)\n", (uint32_t) GetCurrentTime (&Start));
+							Rebase ();
+						}
+					}
 				}
 			}
 			
+			if (Shared)
+				ExternalInput = Shared->GetInput ();
+			
+			// Debugger commands, taken while the machine is held too
+			char Command [256];
+			while (DebugConsole && DebugConsole->Poll (Command, sizeof (Command)))
+				if (!Debug->Command (Command))
+					Quit = 1;
+			
+			uint8_t Buttons = KeyboardButtons | ExternalInput;
+			if (Buttons != mmu->JoypadState && !(InputMovie && InputMovie->Mode == MOVIE_PLAY)) {
+				if (ProbeInputLatency && !ProbePending) {
+					ProbePending = 1;
+					ProbeTicks = KeyTicks ? KeyTicks : SDL_GetTicks ();
+					ProbeFrame = ppu->FrameCount;
+					ProbeHash = HashFrame (ppu->GetFrame (), 160 * 144);
+				}
+				
+				mmu->SetJoypad (Buttons);
+				if (InputMovie)
+					InputMovie->RecordInput (Buttons);
+			}
+			
 			if (cpu->Debugging) {
 				if (Keyboard [SDL_SCANCODE_F3] || Keyboard [SDL_SCANCODE_F4]) {
 					if (PressDebug == 0) {
 						PressDebug = 1;
 						//cpu->Debugging = 0;
-						cpu->Clock ();
-						if (Keyboard [SDL_SCANCODE_F3])
-							cpu->Debug ();
+						if (Debug)
+							Debug->Step (1); // Held again after it, the registers are printed then
+						else {
+							cpu->Clock ();
+							if (Keyboard [SDL_SCANCODE_F3])
+								cpu->Debug ();
+						}
 					}
 				} else
 					PressDebug = 0;
 			}
 			
+			if (RewindBuffer && Keyboard [SDL_SCANCODE_R] && !Keyboard [SDL_SCANCODE_LCTRL] && !Keyboard [SDL_SCANCODE_RCTRL])
+				Rewinding = 1;
+			
 			if ((Keyboard [SDL_SCANCODE_LCTRL] || Keyboard [SDL_SCANCODE_RCTRL])) { // Save external RAM
 				if (Keyboard [SDL_SCANCODE_R]) { // Reset
 					if (PressControlR == 0) {
 						PressControlR = 1;
 						
-						printf ("[INFO] State Reset\n");
-						Reset (mmu, cpu, ppu);
-						IOMap = mmu->IOMap;
-						
-						StartTime = std::chrono::high_resolution_clock::now ();
-						LastInputTime = 0;
-						LastRenderTime = 0;
-						LastLoopTime = 0;
-						LastDebugTime = 0;
-						
-						LastLineDrawClock = 0;
-						mmu->CurrentPPUMode = 1;
-						
-						LastMSClock = 0;
-						LastTimerClock = 0;
-						LastDivClock = 0;
-						
-						LastDebugClock = 0;
-						LastDebugInstructionCount = 0;
+						auto Start = std::chrono::high_resolution_clock::now ();
+						gb->Reset ();
+						printf ("[INFO] State Reset (%d us)\n", (uint32_t) GetCurrentTime (&Start));
+						Rebase ();
 					}
 				} else
 					PressControlR = 0;
 			}
 		}
 		
-		// IOMap 0x40 - LCDC
-		// IOMap 0x41 - LCD STAT
+		// Movie input lands on the exact clock it was recorded at
+		uint8_t MovieButtons;
+		if (InputMovie && InputMovie->Mode == MOVIE_PLAY && InputMovie->Poll (MovieButtons))
+			mmu->SetJoypad (MovieButtons);
 		
-		// Rendering
-		if (GetBit (IOMap [0x40], 7)) { // LCD Operation
-			uint32_t CurrentLineClock = cpu->ClockCount - LastLineDrawClock;
-				
-			if (IOMap [0x44] < 144) { // Current line being drawn
-				if (CurrentLineClock <= 80) { // OAM Period
-					if (mmu->CurrentPPUMode == 0 || mmu->CurrentPPUMode == 1) { // Came from HBlank or VBlank
-						mmu->CurrentPPUMode = 2;
-						ppu->OAMSearch (mmu->Memory, IOMap);
-						PixelTransferDuration = 168 + (ppu->SpriteCount * (291 - 168)) / 10; // 10 Sprites should cause maximum duration = 291 Clocks
-
-						SetBit (IOMap [0x41], 0, 0); // Set them now so that the CPU can service the INT correctly
-						SetBit (IOMap [0x41], 1, 1);
-						
-						if (GetBit (IOMap [0x41], 5))
-							cpu->Interrupt (1);
-					}
-				} else if (CurrentLineClock <= 80 + PixelTransferDuration) { // Pixel Transfer
-					if (mmu->CurrentPPUMode == 2) {
-						mmu->CurrentPPUMode = 3;
-						
-						SetBit (IOMap [0x41], 0, 1);
-						SetBit (IOMap [0x41], 1, 1);
-					}
-				} else { // HBlank
-					if (mmu->CurrentPPUMode == 3) {
-						mmu->CurrentPPUMode = 0;
-						
-						SetBit (IOMap [0x41], 0, 0);
-						SetBit (IOMap [0x41], 1, 0);
-						
-						if (GetBit (IOMap [0x41], 3))
-							cpu->Interrupt (1);
-					}
-				}
-			} else {
-				if (mmu->CurrentPPUMode == 0) { // VBlank
-					mmu->CurrentPPUMode = 1;
-					
-					SetBit (IOMap [0x41], 0, 1);
-					SetBit (IOMap [0x41], 1, 0);
-					
-					cpu->Interrupt (0);
-					
-					if (GetBit (IOMap [0x41], 4))
-						cpu->Interrupt (1);
-				}
-			}
-			
-			if (CurrentLineClock >= (114 << 2)) { // Passed On a New Line
-				LastLineDrawClock = cpu->ClockCount;
-				ppu->Update (mmu->Memory, IOMap);
-				
-				if (IOMap [0x44] == IOMap [0x45]) { // Coincidence LY, LYC
-					SetBit (IOMap [0x41], 2, 1);
-					if (GetBit (IOMap [0x41], 6))
-						cpu->Interrupt (1);
-				} else
-					SetBit (IOMap [0x41], 2, 0);
-			}
-		}
+		uint32_t StepClock = cpu->ClockCount;
+		gb->Step ();
 		
-		if (CurrentTime - LastRenderTime >= 1000000 / 50) { // 50 Hz
-			LastRenderTime = CurrentTime;
-			ppu->Render (); // Actual rendering on the screen
+		// STOP only ends with a reset, which nothing can press headless or during a replay
+		if (cpu->ClockCount == StepClock && !cpu->Debugging && (Headless || (InputMovie && InputMovie->Mode == MOVIE_PLAY))) {
+			printf ("[INFO] CPU stopped at frame %d, nothing left to run\n", ppu->FrameCount);
+			Quit = 1;
 		}
 		
-		// Timer
-		// TODO Timer Obscure Behaviour
-		if (GetBit (IOMap [0x07], 2)) { // TIMCONT
-			uint32_t TimerDelay = 0;
-			if (GetBit (IOMap [0x07], 0)) {
-				if (GetBit (IOMap [0x07], 1))
-					TimerDelay = 256;
-				else
-					TimerDelay = 16;
-			} else if (GetBit (IOMap [0x07], 1))
-				TimerDelay = 64;
-			else
-				TimerDelay = 1024;
+		if (ppu->FrameCount != LastFrameCount) { // Frame completed
+			LastFrameCount = ppu->FrameCount;
 			
-			if (cpu->ClockCount - LastTimerClock >= TimerDelay) {
-				LastTimerClock = cpu->ClockCount;
-				IOMap [0x05]++; // TIMECNT
-				
-				if (IOMap [0x05] == 0) {
-					IOMap [0x05] = IOMap [0x06]; // TIMEMOD
-					cpu->Interrupt (2);
-				}
+#ifdef PROFILE
+			if (Profiler::DumpRequested) {
+				Profiler::DumpRequested = 0;
+				Profiler::Write (ProfileFilename, cpu->ClockCount, cpu->InstructionCount);
 			}
-		}
-		
-		// Input - GB
-		if (GetBit (IOMap [0x00], 4) == 0) { // Direction Pad
-			IOMap [0x00] |= 0xF; // 1 - Not Pressed
-			
-			if (Keyboard [SDL_SCANCODE_RIGHT])
-				SetBit (IOMap [0x00], 0, 0);
-
-			if (Keyboard [SDL_SCANCODE_LEFT])
-				SetBit (IOMap [0x00], 1, 0);
-
-			if (Keyboard [SDL_SCANCODE_UP])
-				SetBit (IOMap [0x00], 2, 0);
-
-			if (Keyboard [SDL_SCANCODE_DOWN])
-				SetBit (IOMap [0x00], 3, 0);
+#endif
 			
-			if ((IOMap [0x00] & 0xF) != 0xF) // Something was pressed
-				cpu->Interrupt (4);
-		}
+			if (InputMovie) {
+				InputMovie->FrameDone ();
+				if (InputMovie->Finished)
+					Quit = 1;
+			}
 			
-		if (GetBit (IOMap [0x00], 5) == 0) { // Buttons
-			IOMap [0x00] |= 0b00001111; // 1 - Not Pressed
-			if (Keyboard [SDL_SCANCODE_A]) // A
-				SetBit (IOMap [0x00], 0, 0);
+			{
+				PROFILE_SCOPE (PROF_PRESENT);
+				if (Video)
+					Video->PushFrame (ppu->GetFrame (), LastFrameCount);
+				
+				if (Shared)
+					Shared->Publish (ppu->GetFrame (), mmu, LastFrameCount);
+			}
 			
-			if (Keyboard [SDL_SCANCODE_S] || Keyboard [SDL_SCANCODE_ESCAPE]) // B
-				SetBit (IOMap [0x00], 1, 0);
+			if (ProbePending) { // First frame that differs from the one shown when the input changed
+				if (HashFrame (ppu->GetFrame (), 160 * 144) != ProbeHash) {
+					ProbePending = 0;
+					printf ("[INFO] Input latency: %d frames, %d ms\n", LastFrameCount - ProbeFrame, SDL_GetTicks () - ProbeTicks);
+				} else if (LastFrameCount - ProbeFrame >= 60) {
+					ProbePending = 0;
+					printf ("[INFO] Input latency: no reaction within 60 frames\n");
+				}
+			}
 			
-			if (Keyboard [SDL_SCANCODE_LSHIFT]) // SELECT
-				SetBit (IOMap [0x00], 2, 0);
+			if (RewindBuffer && LastFrameCount % RewindEvery == 0)
+				RewindBuffer->Capture ();
 			
-			if (Keyboard [SDL_SCANCODE_RETURN]) // START
-				SetBit (IOMap [0x00], 3, 0);
+			if (FrameLimit && LastFrameCount >= FrameLimit)
+				Quit = 1;
 			
-			if ((IOMap [0x00] & 0xF) != 0xF) // Something was pressed
-				cpu->Interrupt (4);
+			// Run-ahead: continue with the same input, keep the last frame for presenting, come back
+			if (RunAhead && !cpu->Debugging) {
+				auto Start = std::chrono::high_resolution_clock::now ();
+				uint32_t Size = gb->SaveState (RunAheadState, gb->StateSize ());
+				gb->apu->Muted = 1;
+				mmu->Muted = 1;
+				cpu->Trace = NULL; // Only what really ran
+#ifdef HOTSPOTS
+				HotSpots* Spots = cpu->Spots; // Same for the profile
+				cpu->Spots = NULL;
+#endif
+				if (Debug) // Breakpoints only fire on the real timeline
+					Debug->Suspend (1);
+				
+				for (uint8_t i = 1; i <= RunAhead; i++) {
+					ppu->SkipRendering = (i < RunAhead); // Only the last one is shown
+					uint32_t Frame = ppu->FrameCount;
+					uint32_t StartClock = cpu->ClockCount;
+					uint32_t Before;
+					do { // LCD may be off, and a STOP stops the clock
+						Before = cpu->ClockCount;
+						gb->Step ();
+					} while (ppu->FrameCount == Frame && cpu->ClockCount - StartClock < SYNC_FRAME_CLOCKS * 2 && cpu->ClockCount != Before);
+				}
+				
+				ppu->SkipRendering = 0;
+				ppu->KeepAheadFrame ();
+				gb->LoadState (RunAheadState, Size);
+				gb->apu->Muted = 0;
+				mmu->Muted = 0;
+				cpu->Trace = Trace;
+#ifdef HOTSPOTS
+				cpu->Spots = Spots;
+#endif
+				if (Debug)
+					Debug->Suspend (0);
+				
+				RunAheadTime += GetCurrentTime (&Start);
+				RunAheadFrames++;
+			}
 		}
 		
-		// DIV Register
-		if (cpu->ClockCount - LastDivClock >= 256) { // DIV increases every 256 clocks
-			LastDivClock = cpu->ClockCount;
-			IOMap [0x04]++;
+		if (CurrentTime - LastRenderTime >= 1000000 / 50) { // 50 Hz
+			LastRenderTime = CurrentTime;
+			PROFILE_SCOPE (PROF_PRESENT);
+			if (Screen)
+				Screen->Render (ppu); // Actual rendering on the screen
 		}
 		
-		if (!cpu->Debugging) {
-			uint8_t OldDMA = IOMap [0x46];
-			cpu->Clock ();
-			if (IOMap [0x46] != OldDMA) // DMA Write
-				cpu->ClockCount += (160 << 2) + 4;
+		// Sound, move finished samples to the ring every 8192 clocks (~2ms)
+		if (cpu->ClockCount - LastAudioClock >= 8192) {
+			LastAudioClock = cpu->ClockCount;
+			gb->apu->Flush (cpu->ClockCount);
+			
+			if (Wav) {
+				int16_t Samples [1024 * 2];
+				uint32_t Frames;
+				while ((Frames = gb->apu->Output.Read (Samples, 1024)) > 0)
+					Wav->Write (Samples, Frames);
+			}
 		}
-	} 
-}
\ No newline at end of file
+	}
+}
@@ -22,4 +22,13 @@ void Utils::MicroSleep (uint32_t us) {
 uint64_t Utils::GetCurrentTime (time_point <high_resolution_clock>* StartTime) {
 	auto TimeDifference = high_resolution_clock::now () - *StartTime;
 	return duration_cast <microseconds> (TimeDifference).count (); // In Microseconds
+}
+
+uint64_t Utils::HashFrame (const uint8_t* Data, uint32_t Size) {
+	uint64_t Hash = 0xcbf29ce484222325;
+	for (uint32_t i = 0; i < Size; i++) {
+		Hash ^= Data [i];
+		Hash *= 0x100000001b3;
+	}
+	return Hash;
 }
\ No newline at end of file
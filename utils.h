@@ -13,6 +13,7 @@ namespace Utils {
 	void SetBit (uint8_t &Value, uint8_t BitNo, uint8_t Set);
 	void MicroSleep (uint32_t us);
 	uint64_t GetCurrentTime (time_point <high_resolution_clock>* StartTime);
+	uint64_t HashFrame (const uint8_t* Data, uint32_t Size); // FNV-1a
 }
 
 #endif
\ No newline at end of file